@@ -0,0 +1,282 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "shared/zalloc.h"
+#include "weston-frame-stats-client-protocol.h"
+
+static const char * const stage_names[] = {
+	[WESTON_FRAME_STATS_STAGE_VIEW_LIST] = "view list",
+	[WESTON_FRAME_STATS_STAGE_ASSIGN_PLANES] = "assign planes",
+	[WESTON_FRAME_STATS_STAGE_DAMAGE] = "damage",
+	[WESTON_FRAME_STATS_STAGE_RENDER] = "render",
+	[WESTON_FRAME_STATS_STAGE_PRESENT] = "present",
+};
+
+struct output {
+	struct wl_list link;
+	struct wl_output *wl_output;
+	uint32_t global_name;
+	char *make;
+	char *model;
+};
+
+struct frame_stats {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct weston_frame_stats *stats;
+	struct wl_list output_list;
+};
+
+static void
+output_handle_geometry(void *data, struct wl_output *wl_output,
+		       int32_t x, int32_t y,
+		       int32_t physical_width, int32_t physical_height,
+		       int32_t subpixel,
+		       const char *make, const char *model,
+		       int32_t output_transform)
+{
+	struct output *output = data;
+
+	free(output->make);
+	free(output->model);
+	output->make = xstrdup(make);
+	output->model = xstrdup(model);
+}
+
+static void
+output_handle_mode(void *data, struct wl_output *wl_output,
+		   uint32_t flags, int32_t width, int32_t height,
+		   int32_t refresh)
+{
+}
+
+static const struct wl_output_listener output_listener = {
+	output_handle_geometry,
+	output_handle_mode,
+};
+
+static void
+stats_handle_stage(void *data, struct weston_frame_stats *stats,
+		   struct wl_output *wl_output, uint32_t stage,
+		   uint32_t count, uint32_t mean_usec, uint32_t max_usec,
+		   struct wl_array *histogram)
+{
+	const char *name = "unknown";
+	uint32_t *bucket;
+	int i = 0;
+
+	if (stage < ARRAY_LENGTH(stage_names) && stage_names[stage])
+		name = stage_names[stage];
+
+	printf("\t%-14s %8u %9u %9u  ", name, count, mean_usec, max_usec);
+
+	wl_array_for_each(bucket, histogram) {
+		if (*bucket)
+			printf(" <%u:%u", 64u << i, *bucket);
+		i++;
+	}
+	printf("\n");
+}
+
+static void
+stats_handle_deadlines(void *data, struct weston_frame_stats *stats,
+		       struct wl_output *wl_output,
+		       uint32_t frames, uint32_t missed)
+{
+	printf("\tmissed deadlines: %u of %u frames", missed, frames);
+	if (frames)
+		printf(" (%.2f%%)", 100.0 * missed / frames);
+	printf("\n");
+}
+
+static void
+stats_handle_draw_calls(void *data, struct weston_frame_stats *stats,
+			struct wl_output *wl_output,
+			uint32_t mean, uint32_t max)
+{
+	printf("\tdraw calls per frame: mean %u, max %u\n", mean, max);
+}
+
+static void
+stats_handle_done(void *data, struct weston_frame_stats *stats,
+		  struct wl_output *wl_output)
+{
+}
+
+static const struct weston_frame_stats_listener stats_listener = {
+	stats_handle_stage,
+	stats_handle_deadlines,
+	stats_handle_draw_calls,
+	stats_handle_done,
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct frame_stats *fs = data;
+	struct output *output;
+
+	if (strcmp(interface, "wl_output") == 0) {
+		output = xzalloc(sizeof *output);
+		output->global_name = name;
+		output->wl_output = wl_registry_bind(registry, name,
+						     &wl_output_interface, 1);
+		wl_output_add_listener(output->wl_output, &output_listener,
+				       output);
+		wl_list_insert(fs->output_list.prev, &output->link);
+	} else if (strcmp(interface, "weston_frame_stats") == 0) {
+		fs->stats = wl_registry_bind(registry, name,
+					     &weston_frame_stats_interface, 1);
+		weston_frame_stats_add_listener(fs->stats, &stats_listener, fs);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+	struct frame_stats *fs = data;
+	struct output *output;
+
+	wl_list_for_each(output, &fs->output_list, link) {
+		if (output->global_name == name) {
+			wl_list_remove(&output->link);
+			wl_output_destroy(output->wl_output);
+			free(output->make);
+			free(output->model);
+			free(output);
+			break;
+		}
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove,
+};
+
+static void
+print_stats(struct frame_stats *fs, bool reset)
+{
+	struct output *output;
+
+	wl_list_for_each(output, &fs->output_list, link) {
+		printf("output %u (%s %s):\n", output->global_name,
+		       output->make ? output->make : "unknown",
+		       output->model ? output->model : "unknown");
+		printf("\t%-14s %8s %9s %9s   histogram (usec)\n",
+		       "stage", "count", "mean usec", "max usec");
+
+		weston_frame_stats_get_stats(fs->stats, output->wl_output,
+					     reset);
+		wl_display_roundtrip(fs->display);
+	}
+}
+
+static void
+usage(int exit_code)
+{
+	fprintf(stderr, "usage: weston-frame-stats "
+		"[--help] [--reset] [--interval=<seconds>]\n\n"
+		"\t--help\t\t\tthis help text\n"
+		"\t--reset\t\t\tclear the statistics after reading them\n"
+		"\t--interval=<seconds>\tprint the statistics repeatedly\n\n");
+
+	exit(exit_code);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct frame_stats fs = { 0 };
+	struct output *output, *tmp;
+	bool reset = false;
+	int interval = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--reset") == 0)
+			reset = true;
+		else if (sscanf(argv[i], "--interval=%d", &interval) == 1)
+			;
+		else if (strcmp(argv[i], "--help") == 0)
+			usage(EXIT_SUCCESS);
+		else
+			usage(EXIT_FAILURE);
+	}
+
+	fs.display = wl_display_connect(NULL);
+	if (!fs.display) {
+		fprintf(stderr, "failed to create display: %m\n");
+		return -1;
+	}
+
+	wl_list_init(&fs.output_list);
+	fs.registry = wl_display_get_registry(fs.display);
+	wl_registry_add_listener(fs.registry, &registry_listener, &fs);
+	wl_display_roundtrip(fs.display);
+	wl_display_roundtrip(fs.display);
+
+	if (!fs.stats) {
+		fprintf(stderr, "weston_frame_stats is not available, "
+			"enable frame-stats in the [core] section of "
+			"weston.ini\n");
+		return -1;
+	}
+
+	do {
+		print_stats(&fs, reset);
+		if (interval > 0) {
+			sleep(interval);
+			wl_display_roundtrip(fs.display);
+		}
+	} while (interval > 0);
+
+	wl_list_for_each_safe(output, tmp, &fs.output_list, link) {
+		wl_output_destroy(output->wl_output);
+		free(output->make);
+		free(output->model);
+		free(output);
+	}
+	weston_frame_stats_destroy(fs.stats);
+	wl_registry_destroy(fs.registry);
+	wl_display_disconnect(fs.display);
+
+	return 0;
+}
@@ -0,0 +1,557 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Pushes large, heavily damaged SHM buffers at the compositor as fast as
+ * frame callbacks allow, and reports the frame rate and the time from
+ * commit to frame callback. Useful to measure texture upload paths.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <signal.h>
+
+#include <wayland-client.h>
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/zalloc.h"
+#include "xdg-shell-unstable-v6-client-protocol.h"
+
+enum damage_mode {
+	DAMAGE_FULL,
+	DAMAGE_BAND,
+	DAMAGE_SCATTERED,
+};
+
+static const char * const damage_names[] = {
+	[DAMAGE_FULL] = "full",
+	[DAMAGE_BAND] = "band",
+	[DAMAGE_SCATTERED] = "scattered",
+};
+
+#define BAND_DIVISOR 8
+#define SCATTERED_RECTS 16
+#define SCATTERED_SIZE 64
+
+struct display {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct zxdg_shell_v6 *shell;
+	struct wl_shm *shm;
+};
+
+struct buffer {
+	struct wl_buffer *buffer;
+	uint32_t *shm_data;
+	int busy;
+};
+
+struct window {
+	struct display *display;
+	int width, height;
+	enum damage_mode damage;
+	struct wl_surface *surface;
+	struct zxdg_surface_v6 *xdg_surface;
+	struct zxdg_toplevel_v6 *xdg_toplevel;
+	struct buffer buffers[2];
+	struct wl_callback *callback;
+	bool wait_for_configure;
+
+	int frames;
+	int max_frames;
+	uint64_t pixels;
+	struct timespec start;
+	struct timespec commit;
+	uint64_t latency_usec;
+	uint32_t seed;
+};
+
+static int running = 1;
+
+static void
+redraw(void *data, struct wl_callback *callback, uint32_t time);
+
+static uint64_t
+timespec_diff_usec(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000ULL +
+	       (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static void
+buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct buffer *mybuf = data;
+
+	mybuf->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static int
+create_shm_buffer(struct display *display, struct buffer *buffer,
+		  int width, int height)
+{
+	struct wl_shm_pool *pool;
+	int fd, size, stride;
+	void *data;
+
+	stride = width * 4;
+	size = stride * height;
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
+			size);
+		return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, size);
+	buffer->buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+						   stride,
+						   WL_SHM_FORMAT_XRGB8888);
+	wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	buffer->shm_data = data;
+
+	return 0;
+}
+
+static void
+handle_xdg_surface_configure(void *data, struct zxdg_surface_v6 *surface,
+			     uint32_t serial)
+{
+	struct window *window = data;
+
+	zxdg_surface_v6_ack_configure(surface, serial);
+
+	if (window->wait_for_configure) {
+		window->wait_for_configure = false;
+		clock_gettime(CLOCK_MONOTONIC, &window->start);
+		redraw(window, NULL, 0);
+	}
+}
+
+static const struct zxdg_surface_v6_listener xdg_surface_listener = {
+	handle_xdg_surface_configure,
+};
+
+static void
+handle_xdg_toplevel_configure(void *data, struct zxdg_toplevel_v6 *toplevel,
+			      int32_t width, int32_t height,
+			      struct wl_array *state)
+{
+}
+
+static void
+handle_xdg_toplevel_close(void *data, struct zxdg_toplevel_v6 *toplevel)
+{
+	running = 0;
+}
+
+static const struct zxdg_toplevel_v6_listener xdg_toplevel_listener = {
+	handle_xdg_toplevel_configure,
+	handle_xdg_toplevel_close,
+};
+
+static struct window *
+create_window(struct display *display, int width, int height,
+	      enum damage_mode damage, int max_frames)
+{
+	struct window *window;
+
+	window = zalloc(sizeof *window);
+	if (!window)
+		return NULL;
+
+	window->display = display;
+	window->width = width;
+	window->height = height;
+	window->damage = damage;
+	window->max_frames = max_frames;
+	window->seed = 1;
+	window->surface = wl_compositor_create_surface(display->compositor);
+
+	window->xdg_surface =
+		zxdg_shell_v6_get_xdg_surface(display->shell, window->surface);
+	assert(window->xdg_surface);
+	zxdg_surface_v6_add_listener(window->xdg_surface,
+				     &xdg_surface_listener, window);
+
+	window->xdg_toplevel =
+		zxdg_surface_v6_get_toplevel(window->xdg_surface);
+	assert(window->xdg_toplevel);
+	zxdg_toplevel_v6_add_listener(window->xdg_toplevel,
+				      &xdg_toplevel_listener, window);
+
+	zxdg_toplevel_v6_set_title(window->xdg_toplevel, "shm-upload-bench");
+	wl_surface_commit(window->surface);
+	window->wait_for_configure = true;
+
+	return window;
+}
+
+static void
+destroy_window(struct window *window)
+{
+	int i;
+
+	if (window->callback)
+		wl_callback_destroy(window->callback);
+
+	for (i = 0; i < 2; i++) {
+		if (!window->buffers[i].buffer)
+			continue;
+		wl_buffer_destroy(window->buffers[i].buffer);
+		munmap(window->buffers[i].shm_data,
+		       window->width * window->height * 4);
+	}
+
+	zxdg_toplevel_v6_destroy(window->xdg_toplevel);
+	zxdg_surface_v6_destroy(window->xdg_surface);
+	wl_surface_destroy(window->surface);
+	free(window);
+}
+
+static struct buffer *
+window_next_buffer(struct window *window)
+{
+	struct buffer *buffer;
+
+	if (!window->buffers[0].busy)
+		buffer = &window->buffers[0];
+	else if (!window->buffers[1].busy)
+		buffer = &window->buffers[1];
+	else
+		return NULL;
+
+	if (!buffer->buffer &&
+	    create_shm_buffer(window->display, buffer,
+			      window->width, window->height) < 0)
+		return NULL;
+
+	return buffer;
+}
+
+static void
+paint_rect(struct window *window, struct buffer *buffer,
+	   int x, int y, int width, int height)
+{
+	uint32_t color = window->frames * 0x00010203;
+	uint32_t *row;
+	int i, j;
+
+	if (x + width > window->width)
+		width = window->width - x;
+	if (y + height > window->height)
+		height = window->height - y;
+
+	for (j = 0; j < height; j++) {
+		row = buffer->shm_data + (y + j) * window->width + x;
+		for (i = 0; i < width; i++)
+			row[i] = 0xff000000 | (color + (x + i) * 0x0101 +
+					       (y + j) * 0x010000);
+	}
+
+	wl_surface_damage(window->surface, x, y, width, height);
+	window->pixels += (uint64_t) width * height;
+}
+
+static uint32_t
+next_random(struct window *window)
+{
+	window->seed = window->seed * 1103515245 + 12345;
+
+	return window->seed >> 8;
+}
+
+static void
+print_results(struct window *window)
+{
+	struct timespec now;
+	double seconds;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = timespec_diff_usec(&now, &window->start) / 1e6;
+
+	printf("%d frames of %dx%d, %s damage, in %.2f s\n",
+	       window->frames, window->width, window->height,
+	       damage_names[window->damage], seconds);
+	if (window->frames == 0 || seconds <= 0)
+		return;
+
+	printf("\t%.1f frames/s, %.1f Mpixel/s uploaded, "
+	       "%.2f ms mean commit to frame callback\n",
+	       window->frames / seconds, window->pixels / seconds / 1e6,
+	       window->latency_usec / 1000.0 / window->frames);
+}
+
+static const struct wl_callback_listener frame_listener;
+
+static void
+redraw(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+	struct buffer *buffer;
+	struct timespec now;
+	int band, i;
+
+	if (callback) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		window->latency_usec += timespec_diff_usec(&now,
+							   &window->commit);
+		window->frames++;
+		wl_callback_destroy(callback);
+		window->callback = NULL;
+	}
+
+	if (window->max_frames > 0 && window->frames >= window->max_frames) {
+		running = 0;
+		return;
+	}
+
+	buffer = window_next_buffer(window);
+	if (!buffer) {
+		fprintf(stderr, "no free buffer\n");
+		abort();
+	}
+
+	/* Every buffer starts out with undefined contents. */
+	if (window->frames < 2)
+		paint_rect(window, buffer, 0, 0, window->width, window->height);
+
+	switch (window->damage) {
+	case DAMAGE_FULL:
+		paint_rect(window, buffer,
+			   0, 0, window->width, window->height);
+		break;
+	case DAMAGE_BAND:
+		band = window->height / BAND_DIVISOR;
+		paint_rect(window, buffer,
+			   0, (window->frames % BAND_DIVISOR) * band,
+			   window->width, band);
+		break;
+	case DAMAGE_SCATTERED:
+		for (i = 0; i < SCATTERED_RECTS; i++)
+			paint_rect(window, buffer,
+				   next_random(window) % window->width,
+				   next_random(window) % window->height,
+				   SCATTERED_SIZE, SCATTERED_SIZE);
+		break;
+	}
+
+	wl_surface_attach(window->surface, buffer->buffer, 0, 0);
+
+	window->callback = wl_surface_frame(window->surface);
+	wl_callback_add_listener(window->callback, &frame_listener, window);
+	wl_surface_commit(window->surface);
+	buffer->busy = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &window->commit);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	redraw
+};
+
+static void
+xdg_shell_ping(void *data, struct zxdg_shell_v6 *shell, uint32_t serial)
+{
+	zxdg_shell_v6_pong(shell, serial);
+}
+
+static const struct zxdg_shell_v6_listener xdg_shell_listener = {
+	xdg_shell_ping,
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t id, const char *interface, uint32_t version)
+{
+	struct display *d = data;
+
+	if (strcmp(interface, "wl_compositor") == 0) {
+		d->compositor =
+			wl_registry_bind(registry,
+					 id, &wl_compositor_interface, 1);
+	} else if (strcmp(interface, "zxdg_shell_v6") == 0) {
+		d->shell = wl_registry_bind(registry,
+					    id, &zxdg_shell_v6_interface, 1);
+		zxdg_shell_v6_add_listener(d->shell, &xdg_shell_listener, d);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		d->shm = wl_registry_bind(registry,
+					  id, &wl_shm_interface, 1);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static struct display *
+create_display(void)
+{
+	struct display *display;
+
+	display = zalloc(sizeof *display);
+	if (display == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	display->display = wl_display_connect(NULL);
+	if (!display->display) {
+		fprintf(stderr, "failed to create display: %m\n");
+		exit(1);
+	}
+
+	display->registry = wl_display_get_registry(display->display);
+	wl_registry_add_listener(display->registry,
+				 &registry_listener, display);
+	wl_display_roundtrip(display->display);
+
+	if (!display->shm || !display->shell) {
+		fprintf(stderr, "wl_shm or zxdg_shell_v6 not available\n");
+		exit(1);
+	}
+
+	return display;
+}
+
+static void
+destroy_display(struct display *display)
+{
+	wl_shm_destroy(display->shm);
+	zxdg_shell_v6_destroy(display->shell);
+	wl_compositor_destroy(display->compositor);
+	wl_registry_destroy(display->registry);
+	wl_display_flush(display->display);
+	wl_display_disconnect(display->display);
+	free(display);
+}
+
+static void
+signal_int(int signum)
+{
+	running = 0;
+}
+
+static void
+usage(int exit_code)
+{
+	fprintf(stderr, "usage: weston-shm-upload-bench [options]\n\n"
+		"\t--width=<pixels>\tbuffer width, default 1920\n"
+		"\t--height=<pixels>\tbuffer height, default 1080\n"
+		"\t--damage=<mode>\t\tfull, band or scattered, "
+		"default full\n"
+		"\t--frames=<count>\texit after this many frames, "
+		"default 600, 0 to run until interrupted\n"
+		"\t--help\t\t\tthis help text\n\n");
+
+	exit(exit_code);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sigint;
+	struct display *display;
+	struct window *window;
+	enum damage_mode damage = DAMAGE_FULL;
+	int width = 1920, height = 1080, frames = 600;
+	char mode[16];
+	unsigned i;
+	int ret = 0;
+
+	for (i = 1; i < (unsigned) argc; i++) {
+		if (sscanf(argv[i], "--width=%d", &width) == 1 ||
+		    sscanf(argv[i], "--height=%d", &height) == 1 ||
+		    sscanf(argv[i], "--frames=%d", &frames) == 1)
+			continue;
+
+		if (sscanf(argv[i], "--damage=%15s", mode) == 1) {
+			for (damage = 0; damage < ARRAY_LENGTH(damage_names);
+			     damage++)
+				if (strcmp(mode, damage_names[damage]) == 0)
+					break;
+			if (damage == ARRAY_LENGTH(damage_names))
+				usage(EXIT_FAILURE);
+		} else if (strcmp(argv[i], "--help") == 0) {
+			usage(EXIT_SUCCESS);
+		} else {
+			usage(EXIT_FAILURE);
+		}
+	}
+
+	if (width <= 0 || height <= 0)
+		usage(EXIT_FAILURE);
+
+	display = create_display();
+	window = create_window(display, width, height, damage, frames);
+	if (!window)
+		return 1;
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	while (running && ret != -1)
+		ret = wl_display_dispatch(display->display);
+
+	print_results(window);
+
+	destroy_window(window);
+	destroy_display(display);
+
+	return 0;
+}
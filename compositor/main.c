@@ -854,8 +854,12 @@ weston_compositor_init_config(struct weston_compositor *ec,
 {
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
+	char *repaint_window;
 	int repaint_msec;
+	int hidden_frame_rate;
 	int vt_switching;
+	int gl_program_cache;
+	int gl_texture_atlas;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
@@ -882,16 +886,63 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	ec->vt_switching = vt_switching;
 
 	s = weston_config_get_section(config, "core", NULL, NULL);
-	weston_config_section_get_int(s, "repaint-window", &repaint_msec,
-				      ec->repaint_msec);
-	if (repaint_msec < -10 || repaint_msec > 1000) {
-		weston_log("Invalid repaint_window value in config: %d\n",
-			   repaint_msec);
+	weston_config_section_get_string(s, "repaint-window",
+					 &repaint_window, NULL);
+	if (repaint_window && strcmp(repaint_window, "auto") == 0) {
+		ec->repaint_window_adaptive = true;
 	} else {
-		ec->repaint_msec = repaint_msec;
+		weston_config_section_get_int(s, "repaint-window",
+					      &repaint_msec, ec->repaint_msec);
+		if (repaint_msec < -10 || repaint_msec > 1000) {
+			weston_log("Invalid repaint_window value in config: "
+				   "%d\n", repaint_msec);
+		} else {
+			ec->repaint_msec = repaint_msec;
+		}
+	}
+	free(repaint_window);
+
+	if (ec->repaint_window_adaptive)
+		weston_log("Output repaint window is adaptive, "
+			   "starting from %d ms.\n", ec->repaint_msec);
+	else
+		weston_log("Output repaint window is %d ms maximum.\n",
+			   ec->repaint_msec);
+
+	weston_config_section_get_int(s, "hidden-frame-rate",
+				      &hidden_frame_rate, -1);
+	if (hidden_frame_rate == 0) {
+		ec->hidden_frame_interval = -1;
+		weston_log("Frame callbacks of hidden surfaces are paused.\n");
+	} else if (hidden_frame_rate > 0) {
+		ec->hidden_frame_interval = 1000 / hidden_frame_rate;
+		if (ec->hidden_frame_interval < 1)
+			ec->hidden_frame_interval = 1;
+		weston_log("Frame callbacks of hidden surfaces are limited "
+			   "to %d Hz.\n", hidden_frame_rate);
 	}
-	weston_log("Output repaint window is %d ms maximum.\n",
-		   ec->repaint_msec);
+
+	weston_config_section_get_int(s, "damage-max-rects",
+				      &ec->damage_max_rects, 0);
+	if (ec->damage_max_rects > 0)
+		weston_log("Output damage is limited to %d rectangles.\n",
+			   ec->damage_max_rects);
+
+	weston_config_section_get_int(s, "pixman-threads",
+				      &ec->pixman_threads, 0);
+	if (ec->pixman_threads < 0 || ec->pixman_threads > 64) {
+		weston_log("Invalid pixman-threads value in config: %d\n",
+			   ec->pixman_threads);
+		ec->pixman_threads = 0;
+	}
+
+	weston_config_section_get_bool(s, "gl-program-cache",
+				       &gl_program_cache, false);
+	ec->gl_program_cache = gl_program_cache;
+
+	weston_config_section_get_bool(s, "gl-texture-atlas",
+				       &gl_texture_atlas, false);
+	ec->gl_texture_atlas = gl_texture_atlas;
 
 	return 0;
 }
@@ -1748,6 +1799,7 @@ int main(int argc, char *argv[])
 	struct weston_seat *seat;
 	struct wet_compositor user_data;
 	int require_input;
+	int frame_stats;
 
 	const struct weston_option core_options[] = {
 		{ WESTON_OPTION_STRING, "backend", 'B', &backend },
@@ -1843,6 +1895,11 @@ int main(int argc, char *argv[])
 
 	weston_pending_output_coldplug(ec);
 
+	weston_config_section_get_bool(section, "frame-stats",
+				       &frame_stats, false);
+	if (frame_stats)
+		frame_stats_create(ec);
+
 	catch_signals();
 	segv_compositor = ec;
 
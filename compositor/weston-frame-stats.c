@@ -0,0 +1,178 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+#include "weston.h"
+#include "weston-frame-stats-server-protocol.h"
+#include "shared/helpers.h"
+
+struct frame_stats {
+	struct weston_compositor *ec;
+	struct wl_global *global;
+	struct wl_listener destroy_listener;
+};
+
+static void
+frame_stats_destroy_request(struct wl_client *client,
+			    struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+/* wl_output resources keep pointing to their output after it has been
+ * destroyed, so only trust outputs that are still in the list. */
+static struct weston_output *
+frame_stats_find_output(struct frame_stats *fs,
+			struct wl_resource *output_resource)
+{
+	struct weston_output *data;
+	struct weston_output *output;
+
+	data = wl_resource_get_user_data(output_resource);
+
+	wl_list_for_each(output, &fs->ec->output_list, link) {
+		if (output == data)
+			return output;
+	}
+
+	return NULL;
+}
+
+static void
+frame_stats_get_stats(struct wl_client *client,
+		      struct wl_resource *resource,
+		      struct wl_resource *output_resource,
+		      uint32_t reset)
+{
+	struct frame_stats *fs = wl_resource_get_user_data(resource);
+	struct weston_output *output;
+	struct weston_frame_stage_stats *stats;
+	struct wl_array histogram;
+	uint32_t *buckets;
+	uint32_t mean;
+	int i;
+
+	output = frame_stats_find_output(fs, output_resource);
+	if (!output) {
+		weston_frame_stats_send_done(resource, output_resource);
+		return;
+	}
+
+	wl_array_init(&histogram);
+	buckets = wl_array_add(&histogram, sizeof(uint32_t) *
+			       WESTON_FRAME_STATS_BUCKETS);
+	if (!buckets) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	for (i = 0; i < WESTON_FRAME_STAGE_COUNT; i++) {
+		stats = &output->frame_stats.stage[i];
+		mean = stats->count ? stats->total_usec / stats->count : 0;
+		memcpy(buckets, stats->histogram, sizeof stats->histogram);
+
+		weston_frame_stats_send_stage(resource, output_resource, i,
+					      stats->count, mean,
+					      stats->max_usec, &histogram);
+	}
+
+	weston_frame_stats_send_deadlines(resource, output_resource,
+					  output->frame_stats.frames,
+					  output->frame_stats.misses);
+
+	stats = &output->frame_stats.stage[WESTON_FRAME_STAGE_RENDER];
+	mean = stats->count ? output->frame_stats.total_draw_calls /
+			      stats->count : 0;
+	weston_frame_stats_send_draw_calls(resource, output_resource, mean,
+					   output->frame_stats.max_draw_calls);
+	weston_frame_stats_send_done(resource, output_resource);
+
+	wl_array_release(&histogram);
+
+	if (reset)
+		weston_output_reset_frame_stats(output);
+}
+
+static const struct weston_frame_stats_interface frame_stats_implementation = {
+	frame_stats_destroy_request,
+	frame_stats_get_stats,
+};
+
+static void
+bind_frame_stats(struct wl_client *client,
+		 void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_frame_stats_interface,
+				      1, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &frame_stats_implementation,
+				       data, NULL);
+}
+
+static void
+frame_stats_destroy(struct wl_listener *listener, void *data)
+{
+	struct frame_stats *fs =
+		container_of(listener, struct frame_stats, destroy_listener);
+
+	wl_global_destroy(fs->global);
+	free(fs);
+}
+
+void
+frame_stats_create(struct weston_compositor *ec)
+{
+	struct frame_stats *fs;
+
+	fs = zalloc(sizeof *fs);
+	if (fs == NULL)
+		return;
+
+	fs->ec = ec;
+	fs->global = wl_global_create(ec->wl_display,
+				      &weston_frame_stats_interface, 1,
+				      fs, bind_frame_stats);
+	if (!fs->global) {
+		free(fs);
+		return;
+	}
+
+	fs->destroy_listener.notify = frame_stats_destroy;
+	wl_signal_add(&ec->destroy_signal, &fs->destroy_listener);
+
+	weston_log("Frame timing statistics interface enabled.\n");
+}
@@ -964,7 +964,7 @@ drm_output_prepare_overlay_view(struct drm_output *output,
 		return NULL;
 
 	/* Don't import buffers which span multiple outputs. */
-	if (ev->output_mask != (1u << output->base.id))
+	if (!weston_output_mask_is_only(&ev->output_mask, output->base.id))
 		return NULL;
 
 	/* We can only import GBM buffers. */
@@ -1130,7 +1130,7 @@ drm_output_prepare_cursor_view(struct drm_output *output,
 		return NULL;
 
 	/* Don't import buffers which span multiple outputs. */
-	if (ev->output_mask != (1u << output->base.id))
+	if (!weston_output_mask_is_only(&ev->output_mask, output->base.id))
 		return NULL;
 
 	/* We use GBM to import SHM buffers. */
@@ -1911,7 +1911,8 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 			goto err;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	if (pixman_renderer_output_create(&output->base,
+					  PIXMAN_RENDERER_OUTPUT_USE_SHADOW) < 0)
 		goto err;
 
 	pixman_region32_init_rect(&output->previous_damage,
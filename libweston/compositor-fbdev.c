@@ -447,8 +447,11 @@ fbdev_output_enable(struct weston_output *base)
 
 	output->base.start_repaint_loop = fbdev_output_start_repaint_loop;
 	output->base.repaint = fbdev_output_repaint;
+	output->base.assign_planes = pixman_renderer_output_assign_planes;
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	if (pixman_renderer_output_create(&output->base,
+					  PIXMAN_RENDERER_OUTPUT_USE_SHADOW |
+					  PIXMAN_RENDERER_OUTPUT_SW_CURSOR) < 0)
 		goto out_hw_surface;
 
 	loop = wl_display_get_event_loop(backend->compositor->wl_display);
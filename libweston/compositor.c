@@ -54,6 +54,7 @@
 #include "timeline.h"
 
 #include "compositor.h"
+#include "damage-simplify.h"
 #include "viewporter-server-protocol.h"
 #include "presentation-time-server-protocol.h"
 #include "shared/helpers.h"
@@ -73,6 +74,21 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor);
+
+static void
+weston_compositor_pick_grid_dirty(struct weston_compositor *compositor);
+
+static void
+pick_grid_update_view(struct weston_view *view);
+
+static void
+pick_grid_remove_view(struct weston_view *view);
+
+static void
+weston_compositor_output_view_lists_dirty(struct weston_compositor *compositor);
+
 static void weston_mode_switch_finish(struct weston_output *output,
 				      int mode_changed,
 				      int scale_changed)
@@ -93,6 +109,7 @@ static void weston_mode_switch_finish(struct weston_output *output,
 				  output->width, output->height);
 
 	weston_output_update_matrix(output);
+	weston_compositor_pick_grid_dirty(output->compositor);
 
 	/* If a pointer falls outside the outputs new geometry, move it to its
 	 * lower-right corner */
@@ -290,6 +307,7 @@ weston_view_create(struct weston_surface *surface)
 	wl_list_init(&view->geometry.child_list);
 	pixman_region32_init(&view->geometry.scissor);
 	pixman_region32_init(&view->transform.boundingbox);
+	weston_output_mask_init(&view->output_mask);
 	view->transform.dirty = 1;
 
 	return view;
@@ -474,8 +492,10 @@ weston_surface_create(struct weston_compositor *compositor)
 	region_init_infinite(&surface->input);
 
 	wl_list_init(&surface->views);
+	weston_output_mask_init(&surface->output_mask);
 
 	wl_list_init(&surface->frame_callback_list);
+	wl_list_init(&surface->hidden_frame_link);
 	wl_list_init(&surface->feedback_list);
 
 	wl_list_init(&surface->subsurface_list);
@@ -915,6 +935,202 @@ weston_view_damage_below(struct weston_view *view)
 	weston_view_schedule_repaint(view);
 }
 
+/** Initialize an empty output mask */
+WL_EXPORT void
+weston_output_mask_init(struct weston_output_mask *mask)
+{
+	mask->low = 0;
+	mask->high = NULL;
+	mask->n_high = 0;
+}
+
+/** Release the storage of an output mask, leaving it empty */
+WL_EXPORT void
+weston_output_mask_fini(struct weston_output_mask *mask)
+{
+	free(mask->high);
+	weston_output_mask_init(mask);
+}
+
+/** Remove all outputs from a mask, keeping its storage */
+WL_EXPORT void
+weston_output_mask_clear(struct weston_output_mask *mask)
+{
+	mask->low = 0;
+	if (mask->n_high > 0)
+		memset(mask->high, 0, mask->n_high * sizeof *mask->high);
+}
+
+#define OUTPUT_MASK_BIT(id) (UINT64_C(1) << ((id) % 64))
+
+/* Returns the word holding the bit for id, or NULL if the mask has no
+ * storage for it yet, meaning the bit is not set. */
+static uint64_t *
+output_mask_word(const struct weston_output_mask *mask, uint32_t id)
+{
+	uint32_t i;
+
+	if (id < 64)
+		return (uint64_t *) &mask->low;
+
+	i = id / 64 - 1;
+	if (i >= mask->n_high)
+		return NULL;
+
+	return &mask->high[i];
+}
+
+static int
+output_mask_grow(struct weston_output_mask *mask, uint32_t n_high)
+{
+	uint64_t *high;
+
+	if (n_high <= mask->n_high)
+		return 0;
+
+	high = realloc(mask->high, n_high * sizeof *high);
+	if (!high)
+		return -1;
+
+	memset(high + mask->n_high, 0,
+	       (n_high - mask->n_high) * sizeof *high);
+	mask->high = high;
+	mask->n_high = n_high;
+
+	return 0;
+}
+
+static void
+output_mask_swap(struct weston_output_mask *a, struct weston_output_mask *b)
+{
+	struct weston_output_mask tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/** Add an output id to a mask
+ *
+ * Returns 0 on success, -1 if the mask could not be grown.
+ */
+WL_EXPORT int
+weston_output_mask_set(struct weston_output_mask *mask, uint32_t id)
+{
+	if (id >= 64 && output_mask_grow(mask, id / 64) < 0)
+		return -1;
+
+	*output_mask_word(mask, id) |= OUTPUT_MASK_BIT(id);
+
+	return 0;
+}
+
+WL_EXPORT void
+weston_output_mask_unset(struct weston_output_mask *mask, uint32_t id)
+{
+	uint64_t *word = output_mask_word(mask, id);
+
+	if (word)
+		*word &= ~OUTPUT_MASK_BIT(id);
+}
+
+WL_EXPORT bool
+weston_output_mask_test(const struct weston_output_mask *mask, uint32_t id)
+{
+	uint64_t *word = output_mask_word(mask, id);
+
+	return word && (*word & OUTPUT_MASK_BIT(id));
+}
+
+WL_EXPORT bool
+weston_output_mask_is_empty(const struct weston_output_mask *mask)
+{
+	uint32_t i;
+
+	if (mask->low)
+		return false;
+
+	for (i = 0; i < mask->n_high; i++)
+		if (mask->high[i])
+			return false;
+
+	return true;
+}
+
+WL_EXPORT bool
+weston_output_mask_equal(const struct weston_output_mask *a,
+			 const struct weston_output_mask *b)
+{
+	uint32_t n = MAX(a->n_high, b->n_high);
+	uint64_t wa, wb;
+	uint32_t i;
+
+	if (a->low != b->low)
+		return false;
+
+	for (i = 0; i < n; i++) {
+		wa = i < a->n_high ? a->high[i] : 0;
+		wb = i < b->n_high ? b->high[i] : 0;
+		if (wa != wb)
+			return false;
+	}
+
+	return true;
+}
+
+/** Check whether id is the one and only output in the mask */
+WL_EXPORT bool
+weston_output_mask_is_only(const struct weston_output_mask *mask,
+			   uint32_t id)
+{
+	int count;
+	uint32_t i;
+
+	if (!weston_output_mask_test(mask, id))
+		return false;
+
+	count = __builtin_popcountll(mask->low);
+	for (i = 0; i < mask->n_high; i++)
+		count += __builtin_popcountll(mask->high[i]);
+
+	return count == 1;
+}
+
+/** Add all outputs of src to dest
+ *
+ * Returns 0 on success, -1 if dest could not be grown.
+ */
+WL_EXPORT int
+weston_output_mask_union(struct weston_output_mask *dest,
+			 const struct weston_output_mask *src)
+{
+	uint32_t i;
+
+	if (output_mask_grow(dest, src->n_high) < 0)
+		return -1;
+
+	dest->low |= src->low;
+	for (i = 0; i < src->n_high; i++)
+		dest->high[i] |= src->high[i];
+
+	return 0;
+}
+
+/** Return the lowest id that is not in the mask */
+WL_EXPORT uint32_t
+weston_output_mask_first_unset(const struct weston_output_mask *mask)
+{
+	uint32_t i;
+
+	if (~mask->low)
+		return ffsll(~mask->low) - 1;
+
+	for (i = 0; i < mask->n_high; i++)
+		if (~mask->high[i])
+			return (i + 1) * 64 + ffsll(~mask->high[i]) - 1;
+
+	return (mask->n_high + 1) * 64;
+}
+
 /**
  * \param es    The surface
  * \param mask  The new set of outputs for the surface
@@ -923,35 +1139,41 @@ weston_view_damage_below(struct weston_view *view)
  * the new output mask provided.  Identifies the outputs that
  * have changed, the posts enter and leave events for these
  * outputs as appropriate.
+ *
+ * The storage of the surface's old mask is handed back in mask.
  */
 static void
-weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
+weston_surface_update_output_mask(struct weston_surface *es,
+				  struct weston_output_mask *mask)
 {
-	uint32_t different = es->output_mask ^ mask;
-	uint32_t entered = mask & different;
-	uint32_t left = es->output_mask & different;
 	struct weston_output *output;
-	struct wl_resource *resource = NULL;
+	struct wl_resource *resource;
 	struct wl_client *client;
+	bool was_on, is_on;
 
-	es->output_mask = mask;
-	if (es->resource == NULL)
+	if (weston_output_mask_equal(&es->output_mask, mask))
 		return;
-	if (different == 0)
+
+	output_mask_swap(&es->output_mask, mask);
+
+	if (es->resource == NULL)
 		return;
 
 	client = wl_resource_get_client(es->resource);
 
 	wl_list_for_each(output, &es->compositor->output_list, link) {
-		if (1u << output->id & different)
-			resource =
-				wl_resource_find_for_client(&output->resource_list,
-							 client);
+		was_on = weston_output_mask_test(mask, output->id);
+		is_on = weston_output_mask_test(&es->output_mask, output->id);
+		if (was_on == is_on)
+			continue;
+
+		resource = wl_resource_find_for_client(&output->resource_list,
+						       client);
 		if (resource == NULL)
 			continue;
-		if (1u << output->id & entered)
+		if (is_on)
 			wl_surface_send_enter(es->resource, resource);
-		if (1u << output->id & left)
+		else
 			wl_surface_send_leave(es->resource, resource);
 	}
 }
@@ -971,14 +1193,15 @@ static void
 weston_surface_assign_output(struct weston_surface *es)
 {
 	struct weston_output *new_output;
+	struct weston_output_mask *mask = &es->compositor->output_mask_scratch;
 	struct weston_view *view;
 	pixman_region32_t region;
-	uint32_t max, area, mask;
+	uint32_t max, area;
 	pixman_box32_t *e;
 
 	new_output = NULL;
 	max = 0;
-	mask = 0;
+	weston_output_mask_clear(mask);
 	pixman_region32_init(&region);
 	wl_list_for_each(view, &es->views, surface_link) {
 		if (!view->output)
@@ -990,7 +1213,7 @@ weston_surface_assign_output(struct weston_surface *es)
 		e = pixman_region32_extents(&region);
 		area = (e->x2 - e->x1) * (e->y2 - e->y1);
 
-		mask |= view->output_mask;
+		weston_output_mask_union(mask, &view->output_mask);
 
 		if (area >= max) {
 			new_output = view->output;
@@ -1018,14 +1241,15 @@ static void
 weston_view_assign_output(struct weston_view *ev)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
+	struct weston_output_mask *mask = &ec->output_mask_scratch;
 	struct weston_output *output, *new_output;
 	pixman_region32_t region;
-	uint32_t max, area, mask;
+	uint32_t max, area;
 	pixman_box32_t *e;
 
 	new_output = NULL;
 	max = 0;
-	mask = 0;
+	weston_output_mask_clear(mask);
 	pixman_region32_init(&region);
 	wl_list_for_each(output, &ec->output_list, link) {
 		if (output->destroying)
@@ -1038,7 +1262,7 @@ weston_view_assign_output(struct weston_view *ev)
 		area = (e->x2 - e->x1) * (e->y2 - e->y1);
 
 		if (area > 0)
-			mask |= 1u << output->id;
+			weston_output_mask_set(mask, output->id);
 
 		if (area >= max) {
 			new_output = output;
@@ -1047,8 +1271,13 @@ weston_view_assign_output(struct weston_view *ev)
 	}
 	pixman_region32_fini(&region);
 
+	/* Keep the old storage in the scratch mask for the next caller. */
+	if (!weston_output_mask_equal(&ev->output_mask, mask)) {
+		weston_compositor_output_view_lists_dirty(ec);
+		output_mask_swap(&ev->output_mask, mask);
+	}
+
 	ev->output = new_output;
-	ev->output_mask = mask;
 
 	weston_surface_assign_output(ev->surface);
 }
@@ -1278,6 +1507,7 @@ weston_view_update_transform(struct weston_view *view)
 	weston_view_damage_below(view);
 
 	weston_view_assign_output(view);
+	pick_grid_update_view(view);
 
 	wl_signal_emit(&view->surface->compositor->transform_signal,
 		       view->surface);
@@ -1384,7 +1614,7 @@ weston_surface_schedule_repaint(struct weston_surface *surface)
 	struct weston_output *output;
 
 	wl_list_for_each(output, &surface->compositor->output_list, link)
-		if (surface->output_mask & (1u << output->id))
+		if (weston_output_mask_test(&surface->output_mask, output->id))
 			weston_output_schedule_repaint(output);
 }
 
@@ -1400,7 +1630,7 @@ weston_view_schedule_repaint(struct weston_view *view)
 	struct weston_output *output;
 
 	wl_list_for_each(output, &view->surface->compositor->output_list, link)
-		if (view->output_mask & (1u << output->id))
+		if (weston_output_mask_test(&view->output_mask, output->id))
 			weston_output_schedule_repaint(output);
 }
 
@@ -1701,38 +1931,322 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    wl_fixed_t x, wl_fixed_t y,
-			    wl_fixed_t *vx, wl_fixed_t *vy)
+/* The grid never has more than this many cells along either axis; the
+ * cell size grows with the output area instead. */
+#define PICK_GRID_MAX_CELLS 64
+#define PICK_GRID_MIN_CELL_SIZE 128
+
+static void
+weston_compositor_pick_grid_dirty(struct weston_compositor *compositor)
+{
+	compositor->pick_grid.dirty = true;
+}
+
+static void
+pick_grid_release(struct weston_compositor *compositor)
+{
+	struct wl_array *cell;
+
+	wl_array_for_each(cell, &compositor->pick_grid.cells)
+		wl_array_release(cell);
+	wl_array_release(&compositor->pick_grid.cells);
+}
+
+static bool
+pick_grid_resize(struct weston_compositor *compositor, int n_cells)
+{
+	struct wl_array *cells = &compositor->pick_grid.cells;
+	size_t old = cells->size / sizeof(struct wl_array);
+	struct wl_array *cell;
+	size_t i;
+
+	if ((size_t) n_cells > old) {
+		cell = wl_array_add(cells,
+				    (n_cells - old) * sizeof(struct wl_array));
+		if (!cell)
+			return false;
+
+		for (i = old; i < (size_t) n_cells; i++)
+			wl_array_init(&cell[i - old]);
+	}
+
+	cell = cells->data;
+	for (i = 0; i < (size_t) n_cells; i++)
+		cell[i].size = 0;
+
+	return true;
+}
+
+/* Finds the range of cells the box overlaps, returns false if none. */
+static bool
+pick_grid_cell_range(struct weston_compositor *compositor,
+		     const pixman_box32_t *box,
+		     int *cx1, int *cy1, int *cx2, int *cy2)
+{
+	const pixman_box32_t *extents = &compositor->pick_grid.extents;
+	int size = compositor->pick_grid.cell_size;
+
+	if (compositor->pick_grid.width == 0 ||
+	    box->x1 >= box->x2 || box->y1 >= box->y2 ||
+	    box->x2 <= extents->x1 || box->y2 <= extents->y1 ||
+	    box->x1 >= extents->x2 || box->y1 >= extents->y2)
+		return false;
+
+	*cx1 = (MAX(box->x1, extents->x1) - extents->x1) / size;
+	*cy1 = (MAX(box->y1, extents->y1) - extents->y1) / size;
+	*cx2 = (MIN(box->x2, extents->x2) - extents->x1 - 1) / size;
+	*cy2 = (MIN(box->y2, extents->y2) - extents->y1 - 1) / size;
+
+	return true;
+}
+
+/* Puts the view into a cell, keeping the cell in view_list order. */
+static bool
+pick_grid_cell_insert(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views;
+	size_t i;
+
+	if (!wl_array_add(cell, sizeof *views))
+		return false;
+
+	views = cell->data;
+	i = cell->size / sizeof *views - 1;
+	for (; i > 0 && views[i - 1]->pick_grid.order > view->pick_grid.order;
+	     i--)
+		views[i] = views[i - 1];
+	views[i] = view;
+
+	return true;
+}
+
+static void
+pick_grid_cell_remove(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views = cell->data;
+	size_t i, n = cell->size / sizeof *views;
+
+	for (i = 0; i < n; i++) {
+		if (views[i] != view)
+			continue;
+
+		memmove(&views[i], &views[i + 1],
+			(n - i - 1) * sizeof *views);
+		cell->size -= sizeof *views;
+		return;
+	}
+}
+
+/* Adds the view to, or removes it from, the cells its recorded box
+ * overlaps. */
+static bool
+pick_grid_update_cells(struct weston_compositor *compositor,
+		       struct weston_view *view, bool insert)
+{
+	struct wl_array *cells = compositor->pick_grid.cells.data;
+	int w = compositor->pick_grid.width;
+	int cx1, cy1, cx2, cy2, cx, cy;
+
+	if (!pick_grid_cell_range(compositor, &view->pick_grid.box,
+				  &cx1, &cy1, &cx2, &cy2))
+		return true;
+
+	for (cy = cy1; cy <= cy2; cy++) {
+		for (cx = cx1; cx <= cx2; cx++) {
+			if (!insert)
+				pick_grid_cell_remove(&cells[cy * w + cx],
+						      view);
+			else if (!pick_grid_cell_insert(&cells[cy * w + cx],
+							view))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool
+pick_grid_has_view(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+
+	return !compositor->pick_grid.dirty &&
+	       view->pick_grid.serial == compositor->pick_grid.serial;
+}
+
+/* Moves a view to the cells of its new bounding box, instead of
+ * rebuilding the whole grid. */
+static void
+pick_grid_update_view(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+
+	if (!pick_grid_has_view(view))
+		return;
+
+	pick_grid_update_cells(compositor, view, false);
+	view->pick_grid.box =
+		*pixman_region32_extents(&view->transform.boundingbox);
+	if (!pick_grid_update_cells(compositor, view, true))
+		weston_compositor_pick_grid_dirty(compositor);
+}
+
+static void
+pick_grid_remove_view(struct weston_view *view)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+
+	if (!pick_grid_has_view(view))
+		return;
+
+	pick_grid_update_cells(compositor, view, false);
+	view->pick_grid.serial = 0;
+}
+
+static void
+pick_grid_rebuild(struct weston_compositor *compositor)
 {
+	struct weston_output *output;
 	struct weston_view *view;
+	pixman_box32_t extents = { 0, 0, 0, 0 };
+	pixman_box32_t *box;
+	bool first = true;
+	uint32_t order = 0;
+	int size, w, h;
+
+	compositor->pick_grid.dirty = false;
+	compositor->pick_grid.width = 0;
+	compositor->pick_grid.height = 0;
+
+	/* 0 marks views that are not in the grid. */
+	if (++compositor->pick_grid.serial == 0)
+		compositor->pick_grid.serial = 1;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		box = pixman_region32_extents(&output->region);
+		if (first) {
+			extents = *box;
+			first = false;
+			continue;
+		}
+		extents.x1 = MIN(extents.x1, box->x1);
+		extents.y1 = MIN(extents.y1, box->y1);
+		extents.x2 = MAX(extents.x2, box->x2);
+		extents.y2 = MAX(extents.y2, box->y2);
+	}
+
+	w = extents.x2 - extents.x1;
+	h = extents.y2 - extents.y1;
+	if (w <= 0 || h <= 0)
+		return;
+
+	size = (MAX(w, h) + PICK_GRID_MAX_CELLS - 1) / PICK_GRID_MAX_CELLS;
+	size = MAX(size, PICK_GRID_MIN_CELL_SIZE);
+	w = (w + size - 1) / size;
+	h = (h + size - 1) / size;
+
+	if (!pick_grid_resize(compositor, w * h))
+		return;
+
+	compositor->pick_grid.extents = extents;
+	compositor->pick_grid.cell_size = size;
+	compositor->pick_grid.width = w;
+	compositor->pick_grid.height = h;
+
+	/* Views are appended in view_list order, so every cell lists its
+	 * views topmost first. Views outside the grid are recorded too,
+	 * they may move into it later. */
+	wl_list_for_each(view, &compositor->view_list, link) {
+		view->pick_grid.serial = compositor->pick_grid.serial;
+		view->pick_grid.order = order++;
+		view->pick_grid.box =
+			*pixman_region32_extents(&view->transform.boundingbox);
+
+		if (!pick_grid_update_cells(compositor, view, true)) {
+			compositor->pick_grid.width = 0;
+			compositor->pick_grid.height = 0;
+			return;
+		}
+	}
+}
+
+/* Returns the grid cell holding the given global point, or NULL if the
+ * point is outside of the grid and all views need to be checked. */
+static struct wl_array *
+pick_grid_lookup(struct weston_compositor *compositor, int x, int y)
+{
+	struct wl_array *cells;
+	const pixman_box32_t *extents = &compositor->pick_grid.extents;
+	int size;
+
+	if (compositor->pick_grid.dirty)
+		pick_grid_rebuild(compositor);
+
+	size = compositor->pick_grid.cell_size;
+
+	if (compositor->pick_grid.width == 0 ||
+	    x < extents->x1 || x >= extents->x2 ||
+	    y < extents->y1 || y >= extents->y2)
+		return NULL;
+
+	cells = compositor->pick_grid.cells.data;
+
+	return &cells[(y - extents->y1) / size * compositor->pick_grid.width +
+		      (x - extents->x1) / size];
+}
+
+static bool
+view_accepts_input_at(struct weston_view *view,
+		      wl_fixed_t x, wl_fixed_t y,
+		      wl_fixed_t *vx, wl_fixed_t *vy)
+{
 	wl_fixed_t view_x, view_y;
 	int view_ix, view_iy;
 	int ix = wl_fixed_to_int(x);
 	int iy = wl_fixed_to_int(y);
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, ix, iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    ix, iy, NULL))
+		return false;
 
-		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
-		view_ix = wl_fixed_to_int(view_x);
-		view_iy = wl_fixed_to_int(view_y);
+	weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+	view_ix = wl_fixed_to_int(view_x);
+	view_iy = wl_fixed_to_int(view_y);
 
-		if (!pixman_region32_contains_point(&view->surface->input,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->surface->input,
+					    view_ix, view_iy, NULL))
+		return false;
 
-		if (view->geometry.scissor_enabled &&
-		    !pixman_region32_contains_point(&view->geometry.scissor,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (view->geometry.scissor_enabled &&
+	    !pixman_region32_contains_point(&view->geometry.scissor,
+					    view_ix, view_iy, NULL))
+		return false;
+
+	*vx = view_x;
+	*vy = view_y;
+	return true;
+}
+
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    wl_fixed_t x, wl_fixed_t y,
+			    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_view *view, **p;
+	struct wl_array *cell;
 
-		*vx = view_x;
-		*vy = view_y;
-		return view;
+	cell = pick_grid_lookup(compositor,
+				wl_fixed_to_int(x), wl_fixed_to_int(y));
+	if (cell) {
+		wl_array_for_each(p, cell) {
+			if (view_accepts_input_at(*p, x, y, vx, vy))
+				return *p;
+		}
+	} else {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (view_accepts_input_at(view, x, y, vx, vy))
+				return view;
+		}
 	}
 
 	*vx = wl_fixed_from_int(-1000000);
@@ -1767,7 +2281,9 @@ weston_view_unmap(struct weston_view *view)
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
-	view->output_mask = 0;
+	pick_grid_remove_view(view);
+	weston_compositor_output_view_lists_dirty(view->surface->compositor);
+	weston_output_mask_clear(&view->output_mask);
 	weston_surface_assign_output(view->surface);
 
 	if (weston_surface_is_mapped(view->surface))
@@ -1797,6 +2313,10 @@ weston_surface_unmap(struct weston_surface *surface)
 	wl_list_for_each(view, &surface->views, surface_link)
 		weston_view_unmap(view);
 	surface->output = NULL;
+
+	/* Views of sub-surfaces are only created and destroyed when the
+	 * view list is rebuilt. */
+	weston_compositor_view_list_dirty(surface->compositor);
 }
 
 static void
@@ -1823,11 +2343,14 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->link);
 	weston_layer_entry_remove(&view->layer_link);
+	pick_grid_remove_view(view);
+	weston_compositor_output_view_lists_dirty(view->surface->compositor);
 
 	pixman_region32_fini(&view->clip);
 	pixman_region32_fini(&view->geometry.scissor);
 	pixman_region32_fini(&view->transform.boundingbox);
 	pixman_region32_fini(&view->transform.opaque);
+	weston_output_mask_fini(&view->output_mask);
 
 	weston_view_set_transform_parent(view, NULL);
 
@@ -1863,9 +2386,11 @@ weston_surface_destroy(struct weston_surface *surface)
 	pixman_region32_fini(&surface->damage);
 	pixman_region32_fini(&surface->opaque);
 	pixman_region32_fini(&surface->input);
+	weston_output_mask_fini(&surface->output_mask);
 
 	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link)
 		wl_resource_destroy(cb->resource);
+	wl_list_remove(&surface->hidden_frame_link);
 
 	weston_presentation_feedback_discard_list(&surface->feedback_list);
 
@@ -2047,6 +2572,46 @@ view_accumulate_damage(struct weston_view *view,
 	pixman_region32_union(opaque, opaque, &view->transform.opaque);
 }
 
+/* Whether some part of the view shows on an output, given the clip
+ * regions computed by compositor_accumulate_damage(). */
+static bool
+view_is_visible(struct weston_view *view)
+{
+	struct weston_output *output;
+	pixman_region32_t visible, tmp;
+	bool ret = false;
+
+	if (weston_output_mask_is_empty(&view->output_mask))
+		return false;
+
+	pixman_region32_init(&visible);
+	pixman_region32_subtract(&visible, &view->transform.boundingbox,
+				 &view->clip);
+	pixman_region32_subtract(&visible, &visible, &view->plane->clip);
+
+	if (pixman_region32_not_empty(&visible)) {
+		pixman_region32_init(&tmp);
+		wl_list_for_each(output, &view->surface->compositor->output_list,
+				 link) {
+			if (!weston_output_mask_test(&view->output_mask,
+						     output->id))
+				continue;
+
+			pixman_region32_intersect(&tmp, &visible,
+						  &output->region);
+			if (pixman_region32_not_empty(&tmp)) {
+				ret = true;
+				break;
+			}
+		}
+		pixman_region32_fini(&tmp);
+	}
+
+	pixman_region32_fini(&visible);
+
+	return ret;
+}
+
 static void
 compositor_accumulate_damage(struct weston_compositor *ec)
 {
@@ -2074,8 +2639,16 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 
 	pixman_region32_fini(&clip);
 
-	wl_list_for_each(ev, &ec->view_list, link)
+	wl_list_for_each(ev, &ec->view_list, link) {
 		ev->surface->touched = false;
+		ev->surface->occluded = true;
+	}
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		ev->occluded = !view_is_visible(ev);
+		if (!ev->occluded)
+			ev->surface->occluded = false;
+	}
 
 	wl_list_for_each(ev, &ec->view_list, link) {
 		if (ev->surface->touched)
@@ -2200,12 +2773,61 @@ view_list_add(struct weston_compositor *compositor,
 	}
 }
 
+static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor)
+{
+	compositor->view_list_dirty = true;
+}
+
+/* Shells restack whole layers by manipulating weston_layer::link
+ * directly, so compare the current layer order with the one the view
+ * list was built from. There are only a handful of layers.
+ */
+static bool
+weston_compositor_layers_changed(struct weston_compositor *compositor)
+{
+	struct weston_layer *layer;
+	struct weston_layer **cached = compositor->view_list_layers.data;
+	size_t n = compositor->view_list_layers.size / sizeof *cached;
+	size_t i = 0;
+
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if (i >= n || cached[i] != layer)
+			return true;
+		i++;
+	}
+
+	return i != n;
+}
+
+static void
+weston_compositor_save_layers(struct weston_compositor *compositor)
+{
+	struct weston_layer *layer;
+	struct weston_layer **p;
+
+	compositor->view_list_layers.size = 0;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		p = wl_array_add(&compositor->view_list_layers, sizeof *p);
+		if (!p) {
+			/* Force a rebuild on the next repaint instead. */
+			compositor->view_list_layers.size = 0;
+			compositor->view_list_dirty = true;
+			return;
+		}
+		*p = layer;
+	}
+}
+
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
 	struct weston_view *view;
 	struct weston_layer *layer;
 
+	compositor->view_list_dirty = false;
+	weston_compositor_save_layers(compositor);
+
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_stash_subsurface_views(view->surface);
@@ -2220,6 +2842,82 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	weston_compositor_pick_grid_dirty(compositor);
+	weston_compositor_output_view_lists_dirty(compositor);
+}
+
+/** Make sure the view list is up to date before repainting
+ *
+ * \param compositor The compositor.
+ *
+ * The view list is only rebuilt when the stacking has changed since the
+ * last build: a view entered or left a layer, layers were restacked, a
+ * sub-surface was mapped, unmapped or restacked. Otherwise the list from
+ * the previous build, possibly made by the repaint of another output in
+ * the same cycle, is reused and only the view transforms are updated.
+ */
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	if (compositor->view_list_dirty ||
+	    weston_compositor_layers_changed(compositor)) {
+		weston_compositor_build_view_list(compositor);
+		return;
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
+}
+
+static void
+weston_compositor_output_view_lists_dirty(struct weston_compositor *compositor)
+{
+	compositor->output_view_lists_dirty = true;
+}
+
+/** Sort the views into the per-output view lists
+ *
+ * \param compositor The compositor.
+ *
+ * This needs to run after the view transforms are up to date. The lists
+ * are only rebuilt after the view list or some view's output_mask has
+ * changed, so outputs repainting in the same cycle share the work.
+ */
+static void
+weston_compositor_build_output_view_lists(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+	struct weston_view *view, **p;
+
+	if (!compositor->output_view_lists_dirty)
+		return;
+
+	compositor->output_view_lists_dirty = false;
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		output->view_list.size = 0;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (weston_output_mask_is_empty(&view->output_mask))
+			continue;
+
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (!weston_output_mask_test(&view->output_mask,
+						     output->id))
+				continue;
+
+			p = wl_array_add(&output->view_list, sizeof *p);
+			if (!p) {
+				/* Try again on the next repaint. */
+				compositor->output_view_lists_dirty = true;
+				continue;
+			}
+			*p = view;
+		}
+	}
 }
 
 static void
@@ -2236,7 +2934,7 @@ weston_output_take_feedback_list(struct weston_output *output,
 	/* All views must have the flag for the flag to survive. */
 	wl_list_for_each(view, &surface->views, surface_link) {
 		/* ignore views that are not on this output at all */
-		if (view->output_mask & (1u << output->id))
+		if (weston_output_mask_test(&view->output_mask, output->id))
 			flags &= view->psf_flags;
 	}
 
@@ -2247,24 +2945,284 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+/* Adaptive repaint window: the predicted repaint duration is the
+ * REPAINT_ADAPTIVE_PERCENTILE of the recent history plus a safety margin. */
+#define REPAINT_ADAPTIVE_PERCENTILE 95
+#define REPAINT_ADAPTIVE_MARGIN_USEC 1000
+#define REPAINT_ADAPTIVE_MIN_SAMPLES 8
+
+static bool
+timespec_is_zero(const struct timespec *ts)
+{
+	return ts->tv_sec == 0 && ts->tv_nsec == 0;
+}
+
+static void
+weston_output_repaint_timing_begin(struct weston_output *output)
+{
+	struct weston_repaint_timing *timing = &output->repaint_timing;
+	struct timespec gone;
+	int64_t refresh_nsec;
+	int64_t frames;
+
+	weston_compositor_read_presentation_clock(output->compositor,
+						  &timing->begin);
+
+	/* Aim at the first vblank after the repaint started. */
+	if (timespec_is_zero(&timing->vblank) ||
+	    output->current_mode->refresh == 0) {
+		timing->target.tv_sec = 0;
+		timing->target.tv_nsec = 0;
+		return;
+	}
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	timespec_sub(&gone, &timing->begin, &timing->vblank);
+	frames = timespec_to_nsec(&gone) / refresh_nsec + 1;
+	if (frames < 1)
+		frames = 1;
+	timespec_add_nsec(&timing->target, &timing->vblank,
+			  frames * refresh_nsec);
+}
+
+static void
+weston_output_repaint_timing_end(struct weston_output *output,
+				 const struct timespec *now)
+{
+	struct weston_repaint_timing *timing = &output->repaint_timing;
+	struct timespec duration;
+	int64_t usec;
+
+	timespec_sub(&duration, now, &timing->begin);
+	usec = timespec_to_nsec(&duration) / 1000;
+	if (usec < 0)
+		usec = 0;
+	if (usec > UINT32_MAX)
+		usec = UINT32_MAX;
+
+	timing->history[timing->history_pos] = usec;
+	timing->history_pos = (timing->history_pos + 1) %
+			      WESTON_REPAINT_HISTORY;
+	if (timing->history_len < WESTON_REPAINT_HISTORY)
+		timing->history_len++;
+}
+
+/* Count the frame as missed if it was presented more than half a refresh
+ * period after the vblank it aimed at. */
+static void
+weston_output_repaint_timing_check(struct weston_output *output,
+				   const struct timespec *stamp,
+				   int64_t refresh_nsec,
+				   uint32_t presented_flags)
+{
+	struct weston_repaint_timing *timing = &output->repaint_timing;
+	struct timespec late;
+
+	if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID) {
+		timing->vblank.tv_sec = 0;
+		timing->vblank.tv_nsec = 0;
+		return;
+	}
+
+	timing->vblank = *stamp;
+
+	if (timespec_is_zero(&timing->target))
+		return;
+
+	timespec_sub(&late, stamp, &timing->target);
+	timing->frames++;
+	output->frame_stats.frames++;
+	if (timespec_to_nsec(&late) > refresh_nsec / 2) {
+		timing->misses++;
+		output->frame_stats.misses++;
+	}
+
+	timing->target.tv_sec = 0;
+	timing->target.tv_nsec = 0;
+}
+
+/* Returns the repaint window in milliseconds, predicted from the recent
+ * repaint durations of the output. Falls back to the configured
+ * repaint_msec until enough samples have been collected. */
+static int
+weston_output_repaint_window_msec(struct weston_output *output,
+				  int64_t refresh_nsec)
+{
+	struct weston_repaint_timing *timing = &output->repaint_timing;
+	uint32_t sorted[WESTON_REPAINT_HISTORY];
+	unsigned int i, j, n;
+	int64_t usec;
+	int msec;
+
+	n = timing->history_len;
+	if (n < REPAINT_ADAPTIVE_MIN_SAMPLES) {
+		timing->predicted_usec = output->compositor->repaint_msec * 1000;
+		return output->compositor->repaint_msec;
+	}
+
+	/* Insertion sort, the history is short. */
+	for (i = 0; i < n; i++) {
+		uint32_t v = timing->history[i];
+
+		for (j = i; j > 0 && sorted[j - 1] > v; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = v;
+	}
+
+	i = (n * REPAINT_ADAPTIVE_PERCENTILE + 99) / 100 - 1;
+	usec = (int64_t)sorted[i] + REPAINT_ADAPTIVE_MARGIN_USEC;
+	if (usec > refresh_nsec / 1000)
+		usec = refresh_nsec / 1000;
+	timing->predicted_usec = usec;
+
+	msec = (usec + 999) / 1000;
+	if (msec < 1)
+		msec = 1;
+
+	return msec;
+}
+
+static int
+hidden_frame_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_surface *surface, *next;
+	struct weston_frame_callback *cb, *cnext;
+	struct timespec now;
+	uint32_t msecs;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	msecs = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	wl_list_for_each_safe(surface, next, &ec->hidden_frame_list,
+			      hidden_frame_link) {
+		wl_list_for_each_safe(cb, cnext,
+				      &surface->frame_callback_list, link) {
+			wl_callback_send_done(cb->resource, msecs);
+			wl_resource_destroy(cb->resource);
+		}
+
+		wl_list_remove(&surface->hidden_frame_link);
+		wl_list_init(&surface->hidden_frame_link);
+	}
+
+	return 0;
+}
+
+/* Called instead of sending frame events to a surface that is assigned to
+ * the output being repainted but not visible on any output, when
+ * weston_compositor::hidden_frame_interval is set. */
+static void
+weston_surface_throttle_frames(struct weston_surface *surface)
+{
+	struct weston_compositor *ec = surface->compositor;
+
+	/* None of the content updates will be seen. */
+	weston_presentation_feedback_discard_list(&surface->feedback_list);
+
+	if (ec->hidden_frame_interval < 0 ||
+	    wl_list_empty(&surface->frame_callback_list) ||
+	    !wl_list_empty(&surface->hidden_frame_link))
+		return;
+
+	if (wl_list_empty(&ec->hidden_frame_list))
+		wl_event_source_timer_update(ec->hidden_frame_timer,
+					     ec->hidden_frame_interval);
+
+	wl_list_insert(&ec->hidden_frame_list, &surface->hidden_frame_link);
+}
+
+static void
+weston_output_frame_stats_record(struct weston_output *output,
+				 enum weston_frame_stage stage,
+				 const struct timespec *begin,
+				 const struct timespec *end)
+{
+	struct weston_frame_stage_stats *stats =
+		&output->frame_stats.stage[stage];
+	struct timespec duration;
+	int64_t usec;
+	int bucket;
+
+	timespec_sub(&duration, end, begin);
+	usec = timespec_to_nsec(&duration) / 1000;
+	if (usec < 0)
+		usec = 0;
+	if (usec > UINT32_MAX)
+		usec = UINT32_MAX;
+
+	if (usec < 64)
+		bucket = 0;
+	else
+		bucket = 31 - __builtin_clz(usec) - 5;
+	if (bucket >= WESTON_FRAME_STATS_BUCKETS)
+		bucket = WESTON_FRAME_STATS_BUCKETS - 1;
+
+	stats->count++;
+	stats->total_usec += usec;
+	if (usec > stats->max_usec)
+		stats->max_usec = usec;
+	stats->histogram[bucket]++;
+}
+
+/* Ends the current repaint stage and starts the next one at now. */
+static void
+weston_output_frame_stage_end(struct weston_output *output,
+			      enum weston_frame_stage stage,
+			      struct timespec *now)
+{
+	struct weston_frame_stats *stats = &output->frame_stats;
+
+	weston_compositor_read_presentation_clock(output->compositor, now);
+	weston_output_frame_stats_record(output, stage,
+					 &stats->stage_begin, now);
+	stats->stage_begin = *now;
+}
+
+/** Clear the frame timing statistics of an output
+ *
+ * \param output The output.
+ *
+ * Resets the repaint stage histograms, the draw call counts and the
+ * missed deadline counters. The counters in weston_output::repaint_timing,
+ * which the timeline reports, keep running.
+ */
+WL_EXPORT void
+weston_output_reset_frame_stats(struct weston_output *output)
+{
+	memset(output->frame_stats.stage, 0,
+	       sizeof output->frame_stats.stage);
+	output->frame_stats.total_draw_calls = 0;
+	output->frame_stats.max_draw_calls = 0;
+	output->frame_stats.frames = 0;
+	output->frame_stats.misses = 0;
+}
+
 static int
 weston_output_repaint(struct weston_output *output)
 {
 	struct weston_compositor *ec = output->compositor;
-	struct weston_view *ev;
+	struct weston_view *ev, **view;
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	struct timespec now;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
 	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
+	weston_output_repaint_timing_begin(output);
+	output->frame_stats.stage_begin = output->repaint_timing.begin;
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	/* Rebuild the surface list if needed and update surface transforms
+	 * up front. */
+	weston_compositor_update_view_list(ec);
+	weston_compositor_build_output_view_lists(ec);
+	weston_output_frame_stage_end(output, WESTON_FRAME_STAGE_VIEW_LIST,
+				      &now);
 
 	if (output->assign_planes && !output->disable_planes) {
 		output->assign_planes(output);
@@ -2274,33 +3232,61 @@ weston_output_repaint(struct weston_output *output)
 			ev->psf_flags = 0;
 		}
 	}
+	weston_output_frame_stage_end(output, WESTON_FRAME_STAGE_ASSIGN_PLANES,
+				      &now);
+
+	compositor_accumulate_damage(ec);
 
+	/* Collected only after accumulating damage, which determines
+	 * which surfaces are occluded. */
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(ev, &ec->view_list, link) {
+	wl_array_for_each(view, &output->view_list) {
+		ev = *view;
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
-		if (ev->surface->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &ev->surface->frame_callback_list);
-			wl_list_init(&ev->surface->frame_callback_list);
+		if (ev->surface->output != output)
+			continue;
 
-			weston_output_take_feedback_list(output, ev->surface);
+		if (ev->surface->occluded && ec->hidden_frame_interval != 0) {
+			weston_surface_throttle_frames(ev->surface);
+			continue;
 		}
-	}
 
-	compositor_accumulate_damage(ec);
+		wl_list_insert_list(&frame_callback_list,
+				    &ev->surface->frame_callback_list);
+		wl_list_init(&ev->surface->frame_callback_list);
+		wl_list_remove(&ev->surface->hidden_frame_link);
+		wl_list_init(&ev->surface->hidden_frame_link);
+
+		weston_output_take_feedback_list(output, ev->surface);
+	}
 
+	/* Many small updates make for many small rectangles, each costing
+	 * the renderer a primitive. Trade them for some overdraw. */
 	pixman_region32_init(&output_damage);
-	pixman_region32_intersect(&output_damage,
-				  &ec->primary_plane.damage, &output->region);
-	pixman_region32_subtract(&output_damage,
-				 &output_damage, &ec->primary_plane.clip);
+	weston_damage_clip_and_simplify(&output_damage,
+					&ec->primary_plane.damage,
+					&output->region,
+					&ec->primary_plane.clip,
+					ec->damage_max_rects);
+	weston_output_frame_stage_end(output, WESTON_FRAME_STAGE_DAMAGE, &now);
 
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
+	output->frame_stats.draw_calls = 0;
 	r = output->repaint(output, &output_damage);
+	weston_output_frame_stage_end(output, WESTON_FRAME_STAGE_RENDER, &now);
+	output->frame_stats.total_draw_calls += output->frame_stats.draw_calls;
+	if (output->frame_stats.draw_calls > output->frame_stats.max_draw_calls)
+		output->frame_stats.max_draw_calls =
+			output->frame_stats.draw_calls;
+	if (r == 0) {
+		weston_output_repaint_timing_end(output, &now);
+		output->frame_stats.presenting = true;
+	}
 
 	pixman_region32_fini(&output_damage);
 
@@ -2369,10 +3355,24 @@ weston_output_finish_frame(struct weston_output *output,
 
 	output->frame_time = stamp->tv_sec * 1000 + stamp->tv_nsec / 1000000;
 
+	weston_output_repaint_timing_check(output, stamp, refresh_nsec,
+					   presented_flags);
+
 	weston_compositor_read_presentation_clock(compositor, &now);
+	if (output->frame_stats.presenting) {
+		weston_output_frame_stats_record(output,
+						 WESTON_FRAME_STAGE_PRESENT,
+						 &output->repaint_timing.begin,
+						 &now);
+		output->frame_stats.presenting = false;
+	}
+
 	timespec_sub(&gone, &now, stamp);
 	msec = (refresh_nsec - timespec_to_nsec(&gone)) / 1000000; /* floor */
-	msec -= compositor->repaint_msec;
+	if (compositor->repaint_window_adaptive)
+		msec -= weston_output_repaint_window_msec(output, refresh_nsec);
+	else
+		msec -= compositor->repaint_msec;
 
 	if (msec < -1000 || msec > 1000) {
 		static bool warned;
@@ -2392,6 +3392,12 @@ weston_output_finish_frame(struct weston_output *output,
 	if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID && msec < 0)
 		msec += refresh_nsec / 1000000;
 
+	output->repaint_timing.delay_usec =
+		(timespec_to_nsec(&gone) + (msec < 1 ? 0 : msec * 1000000LL))
+		/ 1000;
+	TL_POINT("core_repaint_delay", TLP_OUTPUT(output),
+		 TLP_REPAINT_TIMING(&output->repaint_timing), TLP_END);
+
 	if (msec < 1)
 		output_repaint_timer_handler(output);
 	else
@@ -2410,13 +3416,23 @@ WL_EXPORT void
 weston_layer_entry_insert(struct weston_layer_entry *list,
 			  struct weston_layer_entry *entry)
 {
+	struct weston_view *view =
+		container_of(entry, struct weston_view, layer_link);
+
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	weston_compositor_view_list_dirty(view->surface->compositor);
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	struct weston_view *view =
+		container_of(entry, struct weston_view, layer_link);
+
+	if (entry->layer)
+		weston_compositor_view_list_dirty(view->surface->compositor);
+
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -2619,16 +3635,37 @@ surface_set_input_region(struct wl_client *client,
 	}
 }
 
+static bool
+weston_surface_subsurface_order_changed(struct weston_surface *surface)
+{
+	struct weston_subsurface *sub;
+	struct wl_list *link = surface->subsurface_list.next;
+
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (link != &sub->parent_link)
+			return true;
+		link = link->next;
+	}
+
+	return false;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (!weston_surface_subsurface_order_changed(surface))
+		return;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 	}
+
+	weston_compositor_view_list_dirty(surface->compositor);
 }
 
 static void
@@ -3294,6 +4331,7 @@ subsurface_committed(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 	if (!weston_surface_is_mapped(surface)) {
 		surface->is_mapped = true;
+		weston_compositor_view_list_dirty(surface->compositor);
 
 		/* Cannot call weston_view_update_transform(),
 		 * because that would call it also for the parent surface,
@@ -3507,6 +4545,110 @@ weston_surface_copy_content(struct weston_surface *surface,
 					 src_x, src_y, width, height);
 }
 
+/** Read back a rectangle of the last repainted output contents
+ *
+ * \param output The output to read from.
+ * \param format The pixel format to read in.
+ * \param pixels Where to store the pixels, width * height * 4 bytes.
+ * \param x X of the rectangle, as for weston_renderer::read_pixels.
+ * \param y Y of the rectangle, as for weston_renderer::read_pixels.
+ * \param width Width of the rectangle in pixels.
+ * \param height Height of the rectangle in pixels.
+ * \param done Called when the pixels are in place.
+ * \param data User data for \c done.
+ * \return 0 if the pixels were or will be read, -1 on failure.
+ *
+ * Works like weston_renderer::read_pixels, and must be called at the same
+ * times, usually from the frame signal of the output. Renderers that can
+ * do so only start the transfer here and call \c done from a later
+ * dispatch, so reading the pixels does not stall the repaint. Read backs
+ * of one output complete in the order they were started, and \c pixels
+ * must stay valid until then. Otherwise the pixels are read right away and
+ * \c done is called before this returns, also when reading fails.
+ */
+WL_EXPORT int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format, void *pixels,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data)
+{
+	struct weston_renderer *rer = output->compositor->renderer;
+
+	if (rer->read_pixels_async &&
+	    rer->read_pixels_async(output, format, pixels, x, y,
+				   width, height, NULL, done, data) == 0)
+		return 0;
+
+	if (rer->read_pixels(output, format, pixels,
+			     x, y, width, height) < 0) {
+		done(data, false);
+		return -1;
+	}
+
+	done(data, true);
+
+	return 0;
+}
+
+/** Read back a rectangle of the output and hand the pixels to a callback
+ *
+ * \param output The output to read from.
+ * \param format The pixel format to read in.
+ * \param x X of the rectangle, as for weston_renderer::read_pixels.
+ * \param y Y of the rectangle, as for weston_renderer::read_pixels.
+ * \param width Width of the rectangle in pixels.
+ * \param height Height of the rectangle in pixels.
+ * \param copy Called with the pixels once they are read.
+ * \param done Called after \c copy, or when reading fails.
+ * \param data User data for \c copy and \c done.
+ * \return 0 if the pixels were or will be read, -1 on failure.
+ *
+ * Like weston_output_read_pixels_async(), but instead of filling in a
+ * buffer that has to stay around until the read back completes, \c copy
+ * gets to convert the pixels straight from wherever the renderer has
+ * them, for example a mapped pixel buffer object. Renderers that cannot
+ * do that read into a temporary buffer, which the output keeps around
+ * for the next read back of the same size.
+ */
+WL_EXPORT int
+weston_output_read_pixels_copy_async(struct weston_output *output,
+				     pixman_format_code_t format,
+				     uint32_t x, uint32_t y,
+				     uint32_t width, uint32_t height,
+				     weston_read_pixels_copy_func_t copy,
+				     weston_read_pixels_done_func_t done,
+				     void *data)
+{
+	struct weston_renderer *rer = output->compositor->renderer;
+	size_t size = (size_t) width * height * 4;
+
+	if (rer->read_pixels_async &&
+	    rer->read_pixels_async(output, format, NULL, x, y,
+				   width, height, copy, done, data) == 0)
+		return 0;
+
+	if (output->read_pixels_scratch_size != size) {
+		free(output->read_pixels_scratch);
+		output->read_pixels_scratch = malloc(size);
+		output->read_pixels_scratch_size =
+			output->read_pixels_scratch ? size : 0;
+	}
+
+	if (!output->read_pixels_scratch ||
+	    rer->read_pixels(output, format, output->read_pixels_scratch,
+			     x, y, width, height) < 0) {
+		done(data, false);
+		return -1;
+	}
+
+	copy(data, output->read_pixels_scratch);
+	done(data, true);
+
+	return 0;
+}
+
 static void
 subsurface_set_position(struct wl_client *client,
 			struct wl_resource *resource, int32_t x, int32_t y)
@@ -4209,6 +5351,9 @@ weston_output_transform_scale_init(struct weston_output *output, uint32_t transf
 					output->current_mode->width,
 					output->current_mode->height,
 					transform, scale);
+
+	/* The output size changes with the transform and scale */
+	weston_compositor_pick_grid_dirty(output->compositor);
 }
 
 static void
@@ -4235,6 +5380,7 @@ weston_output_move(struct weston_output *output, int x, int y)
 		return;
 
 	weston_output_init_geometry(output, x, y);
+	weston_compositor_pick_grid_dirty(output->compositor);
 
 	output->dirty = 1;
 
@@ -4271,6 +5417,8 @@ weston_compositor_add_output(struct weston_compositor *compositor,
 	struct weston_view *view, *next;
 
 	wl_list_insert(compositor->output_list.prev, &output->link);
+	weston_compositor_output_view_lists_dirty(compositor);
+	weston_compositor_pick_grid_dirty(compositor);
 	wl_signal_emit(&compositor->output_created_signal, output);
 
 	wl_list_for_each_safe(view, next, &compositor->view_list, link)
@@ -4301,6 +5449,7 @@ weston_output_transform_coordinate(struct weston_output *output,
  * Removes the repaint timer.
  * Destroys the Wayland global assigned to the output.
  * Destroys pixman regions allocated to the output.
+ * Frees the read back temporary.
  * Deallocates output's ID and updates compositor's output_id_pool.
  */
 static void
@@ -4312,7 +5461,12 @@ weston_output_enable_undo(struct weston_output *output)
 
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
-	output->compositor->output_id_pool &= ~(1u << output->id);
+	wl_array_release(&output->view_list);
+	free(output->read_pixels_scratch);
+	output->read_pixels_scratch = NULL;
+	output->read_pixels_scratch_size = 0;
+	weston_output_mask_unset(&output->compositor->output_id_pool,
+				 output->id);
 
 	output->enabled = false;
 }
@@ -4340,7 +5494,7 @@ weston_compositor_remove_output(struct weston_output *output)
 	assert(output->destroying);
 
 	wl_list_for_each(view, &output->compositor->view_list, link) {
-		if (view->output_mask & (1u << output->id))
+		if (weston_output_mask_test(&view->output_mask, output->id))
 			weston_view_assign_output(view);
 	}
 
@@ -4348,6 +5502,7 @@ weston_compositor_remove_output(struct weston_output *output)
 
 	weston_compositor_reflow_outputs(output->compositor, output, output->width);
 	wl_list_remove(&output->link);
+	weston_compositor_pick_grid_dirty(output->compositor);
 
 	wl_signal_emit(&output->compositor->output_destroyed_signal, output);
 	wl_signal_emit(&output->destroy_signal, output);
@@ -4425,6 +5580,8 @@ weston_output_init(struct weston_output *output,
 	wl_list_init(&output->link);
 
 	output->enabled = false;
+	output->read_pixels_scratch = NULL;
+	output->read_pixels_scratch_size = 0;
 
 	/* Add some (in)sane defaults which can be used
 	 * for checking if an output was properly configured
@@ -4465,10 +5622,10 @@ weston_compositor_add_pending_output(struct weston_output *output,
  * Establishes a repaint timer for the output with the relevant display
  * object's event loop. See output_repaint_timer_handler().
  *
- * The output is assigned an ID. Weston can support up to 32 distinct
- * outputs, with IDs numbered from 0-31; the compositor's output_id_pool
+ * The output is assigned an ID. The compositor's output_id_pool
  * is referred to and used to find the first available ID number, and
- * then this ID is marked as used in output_id_pool.
+ * then this ID is marked as used in output_id_pool. There is no fixed
+ * limit on the number of outputs.
  *
  * The output is also assigned a Wayland global with the wl_output
  * external interface.
@@ -4506,12 +5663,18 @@ weston_output_enable(struct weston_output *output)
 	/* Make sure we have a transform set */
 	assert(output->transform != UINT32_MAX);
 
+	/* Look for the lowest unused ID in the compositor's output_id_pool.
+	 * Take that as our ID, and mark it used. */
+	output->id = weston_output_mask_first_unset(&c->output_id_pool);
+	if (weston_output_mask_set(&c->output_id_pool, output->id) < 0) {
+		weston_log("Enabling output \"%s\" failed: out of memory.\n",
+			   output->name);
+		return -1;
+	}
+
 	/* Remove it from pending/disabled output list */
 	wl_list_remove(&output->link);
 
-	/* Verify we haven't reached the limit of 32 available output IDs */
-	assert(ffs(~c->output_id_pool) > 0);
-
 	output->x = x;
 	output->y = y;
 	output->dirty = 1;
@@ -4529,18 +5692,12 @@ weston_output_enable(struct weston_output *output)
 	wl_list_init(&output->resource_list);
 	wl_list_init(&output->feedback_list);
 	wl_list_init(&output->link);
+	wl_array_init(&output->view_list);
 
 	loop = wl_display_get_event_loop(c->wl_display);
 	output->repaint_timer = wl_event_loop_add_timer(loop,
 					output_repaint_timer_handler, output);
 
-	/* Invert the output id pool and look for the lowest numbered
-	 * switch (the least significant bit).  Take that bit's position
-	 * as our ID, and mark it used in the compositor's output_id_pool.
-	 */
-	output->id = ffs(~output->compositor->output_id_pool) - 1;
-	output->compositor->output_id_pool |= 1u << output->id;
-
 	output->global =
 		wl_global_create(c->wl_display, &wl_output_interface, 3,
 				 output, bind_output);
@@ -4987,7 +6144,8 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	wl_signal_init(&ec->session_signal);
 	ec->session_active = 1;
 
-	ec->output_id_pool = 0;
+	weston_output_mask_init(&ec->output_id_pool);
+	weston_output_mask_init(&ec->output_mask_scratch);
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
 
 	ec->activate_serial = 1;
@@ -5012,6 +6170,11 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 		goto fail;
 
 	wl_list_init(&ec->view_list);
+	wl_array_init(&ec->view_list_layers);
+	ec->view_list_dirty = true;
+	wl_array_init(&ec->pick_grid.cells);
+	ec->pick_grid.dirty = true;
+	ec->output_view_lists_dirty = true;
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -5035,6 +6198,9 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
+	ec->hidden_frame_timer = wl_event_loop_add_timer(loop,
+						hidden_frame_timer_handler, ec);
+	wl_list_init(&ec->hidden_frame_list);
 
 	weston_layer_init(&ec->fade_layer, &ec->layer_list);
 	weston_layer_init(&ec->cursor_layer, &ec->fade_layer.link);
@@ -5055,6 +6221,7 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	struct weston_output *output, *next;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->hidden_frame_timer);
 
 	/* Destroy all outputs associated with this compositor */
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
@@ -5287,6 +6454,12 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 
 	weston_plugin_api_destroy_list(compositor);
 
+	wl_array_release(&compositor->view_list_layers);
+	pick_grid_release(compositor);
+	weston_output_mask_fini(&compositor->output_id_pool);
+	weston_output_mask_fini(&compositor->output_mask_scratch);
+	free(compositor->screenshot_scratch);
+
 	free(compositor);
 }
 
@@ -146,6 +146,92 @@ enum dpms_enum {
 	WESTON_DPMS_OFF
 };
 
+/** A set of outputs, indexed by weston_output::id
+ *
+ * Ids below 64 are stored inline, larger ids in an array that is
+ * allocated on demand. A zero-initialized mask is a valid empty mask.
+ */
+struct weston_output_mask {
+	uint64_t low;
+	uint64_t *high;
+	uint32_t n_high;
+};
+
+#define WESTON_REPAINT_HISTORY 64
+
+/** Repaint duration history of an output
+ *
+ * Used to pick the repaint delay when the adaptive repaint window is
+ * enabled, see weston_compositor::repaint_window_adaptive.
+ */
+struct weston_repaint_timing {
+	/** Recent repaint durations in microseconds, a ring buffer */
+	uint32_t history[WESTON_REPAINT_HISTORY];
+	unsigned int history_len;
+	unsigned int history_pos;
+
+	/** Last vblank reported by the backend, zero if unknown */
+	struct timespec vblank;
+	/** When the repaint in progress started */
+	struct timespec begin;
+	/** The vblank the last repaint aimed at, zero if unknown */
+	struct timespec target;
+	/** Last delay from vblank to repaint start, in microseconds */
+	int32_t delay_usec;
+	/** Last predicted repaint duration, in microseconds */
+	int32_t predicted_usec;
+
+	/** Frames checked against their target vblank */
+	uint32_t frames;
+	/** Frames that were presented later than their target vblank */
+	uint32_t misses;
+};
+
+/** Repaint stages measured by struct weston_frame_stats */
+enum weston_frame_stage {
+	WESTON_FRAME_STAGE_VIEW_LIST = 0,
+	WESTON_FRAME_STAGE_ASSIGN_PLANES,
+	WESTON_FRAME_STAGE_DAMAGE,
+	WESTON_FRAME_STAGE_RENDER,
+	WESTON_FRAME_STAGE_PRESENT,
+	WESTON_FRAME_STAGE_COUNT
+};
+
+#define WESTON_FRAME_STATS_BUCKETS 16
+
+/** Duration statistics of one repaint stage
+ *
+ * Bucket 0 of the histogram counts durations below 64 microseconds,
+ * bucket i durations from (32 << i) to (64 << i) microseconds. The last
+ * bucket also counts all longer durations.
+ */
+struct weston_frame_stage_stats {
+	uint32_t count;
+	uint32_t max_usec;
+	uint64_t total_usec;
+	uint32_t histogram[WESTON_FRAME_STATS_BUCKETS];
+};
+
+/** Per-output repaint stage timings, see weston_output_repaint() */
+struct weston_frame_stats {
+	/** When the stage in progress started */
+	struct timespec stage_begin;
+	/** A repaint has been submitted and waits for finish_frame */
+	bool presenting;
+	struct weston_frame_stage_stats stage[WESTON_FRAME_STAGE_COUNT];
+
+	/** Draw calls of the frame being rendered, counted by the renderer */
+	uint32_t draw_calls;
+	/** Sum and maximum of draw_calls over the rendered frames */
+	uint64_t total_draw_calls;
+	uint32_t max_draw_calls;
+
+	/** Like the weston_repaint_timing counters, but reset along with
+	 * the rest of the stats */
+	uint32_t frames;
+	uint32_t misses;
+};
+
 struct weston_output {
 	uint32_t id;
 	char *name;
@@ -169,6 +255,11 @@ struct weston_output {
 	/** Output area in global coordinates, simple rect */
 	pixman_region32_t region;
 
+	/** Views overlapping this output, in the same order as
+	 * weston_compositor::view_list (topmost first). Array of
+	 * struct weston_view *, valid during weston_output::repaint. */
+	struct wl_array view_list;
+
 	pixman_region32_t previous_damage;
 	int repaint_needed;
 	int repaint_scheduled;
@@ -180,6 +271,11 @@ struct weston_output {
 	int move_x, move_y;
 	uint32_t frame_time; /* presentation timestamp in milliseconds */
 	uint64_t msc;        /* media stream counter */
+	struct weston_repaint_timing repaint_timing;
+	struct weston_frame_stats frame_stats;
+	/* temporary of weston_output_read_pixels_copy_async() */
+	void *read_pixels_scratch;
+	size_t read_pixels_scratch_size;
 	int disable_planes;
 	int destroying;
 	struct wl_list feedback_list;
@@ -646,6 +742,25 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+/** Called once weston_output_read_pixels_async() has filled in the pixels
+ *
+ * \param data The user data passed along with the read back.
+ * \param success False if the pixels could not be read, for example
+ * because the output went away in the meantime.
+ */
+typedef void (*weston_read_pixels_done_func_t)(void *data, bool success);
+
+/** Called by weston_output_read_pixels_copy_async() with the pixels read
+ *
+ * \param data The user data passed along with the read back.
+ * \param pixels The pixels, laid out as weston_renderer::read_pixels
+ * stores them. They are only valid during the call.
+ *
+ * Called before the done function, and only if the read back succeeded.
+ */
+typedef void (*weston_read_pixels_copy_func_t)(void *data,
+					       const void *pixels);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
@@ -674,6 +789,18 @@ struct weston_renderer {
 	/** See weston_compositor_import_dmabuf() */
 	bool (*import_dmabuf)(struct weston_compositor *ec,
 			      struct linux_dmabuf_buffer *buffer);
+
+	/** See weston_output_read_pixels_async(), returns -1 if the
+	 * read back cannot be started, 0 otherwise. If copy is not NULL,
+	 * the pixels are handed to it instead of being stored in pixels,
+	 * see weston_output_read_pixels_copy_async(). */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format, void *pixels,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_copy_func_t copy,
+				 weston_read_pixels_done_func_t done,
+				 void *data);
 };
 
 enum weston_capability {
@@ -775,6 +902,20 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;
 	struct wl_list view_list;	/* struct weston_view::link */
+	bool view_list_dirty;
+	struct wl_array view_list_layers; /* layer_list order of last build */
+	bool output_view_lists_dirty;	/* see weston_output::view_list */
+
+	/* Uniform grid over the output area, indexing the views in
+	 * view_list by bounding box for weston_compositor_pick_view(). */
+	struct {
+		bool dirty;
+		uint32_t serial;	/* bumped on every rebuild */
+		pixman_box32_t extents;
+		int cell_size;
+		int width, height;	/* in cells */
+		struct wl_array cells;	/* struct wl_array of weston_view * */
+	} pick_grid;
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -804,7 +945,13 @@ struct weston_compositor {
 
 	struct wl_list plugin_api_list; /* struct weston_plugin_api::link */
 
-	uint32_t output_id_pool;
+	struct weston_output_mask output_id_pool;
+	/* Reused while recomputing output masks to avoid allocations. */
+	struct weston_output_mask output_mask_scratch;
+	/* Reused by screenshots that cannot be read back in place. */
+	void *screenshot_scratch;
+	size_t screenshot_scratch_size;
+	bool screenshot_scratch_busy;
 
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
@@ -820,6 +967,32 @@ struct weston_compositor {
 
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
+	/** Derive the repaint window from measured repaint durations
+	 * instead of using repaint_msec as is. */
+	bool repaint_window_adaptive;
+
+	/* Frame callbacks of surfaces that are assigned to an output but
+	 * not visible on any: 0 sends them on every repaint as usual, a
+	 * positive value sends them at most once per that many
+	 * milliseconds, and a negative value holds them back until the
+	 * surface becomes visible. */
+	int32_t hidden_frame_interval;
+	struct wl_list hidden_frame_list;
+	struct wl_event_source *hidden_frame_timer;
+
+	/* If positive, output damage with more rectangles than this is
+	 * merged into fewer, larger ones before repainting. */
+	int32_t damage_max_rects;
+
+	/* Threads the pixman renderer composites with, including the
+	 * main thread. 0 and 1 both mean no extra threads. */
+	int32_t pixman_threads;
+
+	/* Keep linked GL programs in an on-disk cache. */
+	bool gl_program_cache;
+
+	/* Let the GL renderer pack small SHM surfaces into one texture. */
+	bool gl_texture_atlas;
 
 	unsigned int activate_serial;
 
@@ -991,12 +1164,26 @@ struct weston_view {
 	 * A more complete representation of all outputs this surface is
 	 * displayed on.
 	 */
-	uint32_t output_mask;
+	struct weston_output_mask output_mask;
 
 	/* Per-surface Presentation feedback flags, controlled by backend. */
 	uint32_t psf_flags;
 
 	bool is_mapped;
+
+	/* No part of the view is visible on any output. Updated when
+	 * damage is accumulated for a repaint. */
+	bool occluded;
+
+	/* How the view is entered into weston_compositor::pick_grid: its
+	 * position in view_list and the bounding box extents it was
+	 * last put into the cells with. Only valid while serial matches
+	 * the grid's. */
+	struct {
+		uint32_t serial;
+		uint32_t order;
+		pixman_box32_t box;
+	} pick_grid;
 };
 
 struct weston_surface_state {
@@ -1097,11 +1284,18 @@ struct weston_surface {
 	 * A more complete representation of all outputs this surface is
 	 * displayed on.
 	 */
-	uint32_t output_mask;
+	struct weston_output_mask output_mask;
 
 	struct wl_list frame_callback_list;
 	struct wl_list feedback_list;
 
+	/* No view of the surface is visible on any output. Updated when
+	 * damage is accumulated for a repaint. */
+	bool occluded;
+	/* weston_compositor::hidden_frame_list, while frame callbacks
+	 * are being throttled */
+	struct wl_list hidden_frame_link;
+
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
 	int32_t width_from_buffer; /* before applying viewport */
@@ -1329,6 +1523,23 @@ weston_output_schedule_repaint(struct weston_output *output);
 void
 weston_output_damage(struct weston_output *output);
 void
+weston_output_reset_frame_stats(struct weston_output *output);
+int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format, void *pixels,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data);
+int
+weston_output_read_pixels_copy_async(struct weston_output *output,
+				     pixman_format_code_t format,
+				     uint32_t x, uint32_t y,
+				     uint32_t width, uint32_t height,
+				     weston_read_pixels_copy_func_t copy,
+				     weston_read_pixels_done_func_t done,
+				     void *data);
+void
 weston_compositor_schedule_repaint(struct weston_compositor *compositor);
 void
 weston_compositor_fade(struct weston_compositor *compositor, float tint);
@@ -1480,6 +1691,42 @@ weston_view_is_mapped(struct weston_view *view);
 void
 weston_view_schedule_repaint(struct weston_view *view);
 
+void
+weston_output_mask_init(struct weston_output_mask *mask);
+
+void
+weston_output_mask_fini(struct weston_output_mask *mask);
+
+void
+weston_output_mask_clear(struct weston_output_mask *mask);
+
+int
+weston_output_mask_set(struct weston_output_mask *mask, uint32_t id);
+
+void
+weston_output_mask_unset(struct weston_output_mask *mask, uint32_t id);
+
+bool
+weston_output_mask_test(const struct weston_output_mask *mask, uint32_t id);
+
+bool
+weston_output_mask_is_empty(const struct weston_output_mask *mask);
+
+bool
+weston_output_mask_equal(const struct weston_output_mask *a,
+			 const struct weston_output_mask *b);
+
+bool
+weston_output_mask_is_only(const struct weston_output_mask *mask,
+			   uint32_t id);
+
+int
+weston_output_mask_union(struct weston_output_mask *dest,
+			 const struct weston_output_mask *src);
+
+uint32_t
+weston_output_mask_first_unset(const struct weston_output_mask *mask);
+
 bool
 weston_surface_is_mapped(struct weston_surface *surface);
 
@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "damage-simplify.h"
+
+static inline int32_t
+round_down(int32_t v, int32_t origin, int32_t tile)
+{
+	return origin + (v - origin) / tile * tile;
+}
+
+static inline int32_t
+round_up(int32_t v, int32_t origin, int32_t tile)
+{
+	return origin + (v - origin + tile - 1) / tile * tile;
+}
+
+/* Grow every rectangle of src to the tile grid anchored at the region
+ * extents, and store the union in dst. Rectangles are clamped to the
+ * extents so the result never covers more than the bounding box. */
+static bool
+snap_to_grid(pixman_region32_t *dst, pixman_region32_t *src,
+	     pixman_box32_t *scratch, int32_t tile)
+{
+	pixman_box32_t *ext = pixman_region32_extents(src);
+	pixman_box32_t *rects;
+	int n, i;
+
+	rects = pixman_region32_rectangles(src, &n);
+	for (i = 0; i < n; i++) {
+		scratch[i].x1 = round_down(rects[i].x1, ext->x1, tile);
+		scratch[i].y1 = round_down(rects[i].y1, ext->y1, tile);
+		scratch[i].x2 = round_up(rects[i].x2, ext->x1, tile);
+		scratch[i].y2 = round_up(rects[i].y2, ext->y1, tile);
+
+		if (scratch[i].x2 > ext->x2)
+			scratch[i].x2 = ext->x2;
+		if (scratch[i].y2 > ext->y2)
+			scratch[i].y2 = ext->y2;
+	}
+
+	pixman_region32_fini(dst);
+	return pixman_region32_init_rects(dst, scratch, n);
+}
+
+/** Bound the number of rectangles in a region
+ *
+ * \param region The region to simplify, replaced in place.
+ * \param max_rects Maximum number of rectangles the result may have.
+ * \param tile_size Edge length of the first grid to try, in pixels.
+ * \return true if the region was changed.
+ *
+ * Rectangles are snapped to a grid of tile_size pixels, doubling the
+ * tile size until the region has at most max_rects rectangles. At worst
+ * the region becomes its own bounding box. The result always covers
+ * the original region, and never exceeds its extents, so it can be
+ * used in place of damage at the cost of some overdraw.
+ */
+bool
+weston_region_simplify(pixman_region32_t *region, int max_rects,
+		       int tile_size)
+{
+	pixman_region32_t snapped;
+	pixman_box32_t *scratch;
+	pixman_box32_t ext;
+	int32_t tile, size;
+	int n;
+
+	n = pixman_region32_n_rects(region);
+	if (n <= max_rects || n <= 1)
+		return false;
+
+	ext = *pixman_region32_extents(region);
+	size = ext.x2 - ext.x1;
+	if (ext.y2 - ext.y1 > size)
+		size = ext.y2 - ext.y1;
+
+	scratch = malloc(n * sizeof *scratch);
+	if (max_rects <= 1 || !scratch || tile_size < 1) {
+		free(scratch);
+		goto extents;
+	}
+
+	pixman_region32_init(&snapped);
+	for (tile = tile_size; tile < size; tile *= 2) {
+		if (!snap_to_grid(&snapped, region, scratch, tile))
+			break;
+
+		if (pixman_region32_n_rects(&snapped) <= max_rects) {
+			pixman_region32_copy(region, &snapped);
+			pixman_region32_fini(&snapped);
+			free(scratch);
+			return true;
+		}
+	}
+	pixman_region32_fini(&snapped);
+	free(scratch);
+
+extents:
+	pixman_region32_fini(region);
+	pixman_region32_init_rect(region, ext.x1, ext.y1,
+				  ext.x2 - ext.x1, ext.y2 - ext.y1);
+	return true;
+}
+
+/** Compute the damage an output repaints
+ *
+ * \param result An initialised region, replaced with the damage.
+ * \param damage The damage of the plane.
+ * \param output_region The area of the output.
+ * \param clip The area covered by other planes.
+ * \param max_rects Maximum number of rectangles, or 0 for no limit.
+ *
+ * The clip is cut out before simplifying and not again afterwards:
+ * that would split the merged rectangles and break the limit, while
+ * repainting under the clip inside a merged rectangle does no harm.
+ */
+void
+weston_damage_clip_and_simplify(pixman_region32_t *result,
+				pixman_region32_t *damage,
+				pixman_region32_t *output_region,
+				pixman_region32_t *clip,
+				int max_rects)
+{
+	pixman_region32_intersect(result, damage, output_region);
+	pixman_region32_subtract(result, result, clip);
+
+	if (max_rects > 0)
+		weston_region_simplify(result, max_rects,
+				       WESTON_DAMAGE_TILE_SIZE);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_DAMAGE_SIMPLIFY_H
+#define _WESTON_DAMAGE_SIMPLIFY_H
+
+#include <stdbool.h>
+#include <pixman.h>
+
+/* Initial tile size used when snapping damage to a coarser grid. */
+#define WESTON_DAMAGE_TILE_SIZE 32
+
+bool
+weston_region_simplify(pixman_region32_t *region, int max_rects,
+		       int tile_size);
+
+void
+weston_damage_clip_and_simplify(pixman_region32_t *result,
+				pixman_region32_t *damage,
+				pixman_region32_t *output_region,
+				pixman_region32_t *clip,
+				int max_rects);
+
+#endif
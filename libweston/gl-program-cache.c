@@ -0,0 +1,338 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compositor.h"
+#include "gl-program-cache.h"
+#include "shared/platform.h"
+#include "shared/zalloc.h"
+
+#define PROGRAM_CACHE_MAGIC 0x50474c57	/* "WLGP" */
+#define PROGRAM_CACHE_VERSION 1
+
+/* Binaries larger than this are not trusted when read back. */
+#define PROGRAM_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+struct gl_program_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint64_t driver;
+	uint32_t format;
+	uint32_t length;
+};
+
+struct gl_program_cache {
+	char dir[PATH_MAX];
+	/* Hash of the vendor, renderer and version strings of the driver */
+	uint64_t driver;
+
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+};
+
+/* 64 bit FNV-1a */
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *) str; *p; p++) {
+		hash ^= *p;
+		hash *= 0x100000001b3ULL;
+	}
+
+	/* Keeps "ab" + "c" apart from "a" + "bc". */
+	hash ^= 0xff;
+	hash *= 0x100000001b3ULL;
+
+	return hash;
+}
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+static uint64_t
+cache_key(struct gl_program_cache *cache, const char * const *sources,
+	  int count)
+{
+	uint64_t hash = cache->driver;
+	int i;
+
+	for (i = 0; i < count; i++)
+		hash = hash_string(hash, sources[i]);
+
+	return hash;
+}
+
+static void
+cache_path(struct gl_program_cache *cache, uint64_t key,
+	   char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx.bin",
+		 cache->dir, (unsigned long long) key);
+}
+
+static int
+mkdir_parents(char *path)
+{
+	char *p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+/** Set up the program binary cache of the current GL context
+ *
+ * \param extensions The GL extension string.
+ * \return The cache, or NULL if program binaries are not supported or
+ * there is no cache directory.
+ *
+ * Binaries are stored in $XDG_CACHE_HOME/weston/programs, falling back
+ * to $HOME/.cache.
+ */
+struct gl_program_cache *
+gl_program_cache_create(const char *extensions)
+{
+	struct gl_program_cache *cache;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	const char *str;
+	GLint formats = 0;
+	int len;
+
+	if (!weston_check_egl_extension(extensions,
+					"GL_OES_get_program_binary"))
+		return NULL;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats <= 0)
+		return NULL;
+
+	cache = zalloc(sizeof *cache);
+	if (!cache)
+		return NULL;
+
+	cache->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	cache->program_binary =
+		(void *) eglGetProcAddress("glProgramBinaryOES");
+	if (!cache->get_program_binary || !cache->program_binary)
+		goto err;
+
+	if (cache_home && cache_home[0] == '/')
+		len = snprintf(cache->dir, sizeof cache->dir,
+			       "%s/weston/programs", cache_home);
+	else if (home)
+		len = snprintf(cache->dir, sizeof cache->dir,
+			       "%s/.cache/weston/programs", home);
+	else
+		goto err;
+
+	if (len < 0 || len >= (int) sizeof cache->dir)
+		goto err;
+
+	if (mkdir_parents(cache->dir) < 0) {
+		weston_log("GL program cache: cannot create %s: %m\n",
+			   cache->dir);
+		goto err;
+	}
+
+	/* A driver update invalidates all binaries. */
+	cache->driver = HASH_INIT;
+	str = (const char *) glGetString(GL_VENDOR);
+	cache->driver = hash_string(cache->driver, str ? str : "");
+	str = (const char *) glGetString(GL_RENDERER);
+	cache->driver = hash_string(cache->driver, str ? str : "");
+	str = (const char *) glGetString(GL_VERSION);
+	cache->driver = hash_string(cache->driver, str ? str : "");
+
+	weston_log("GL program cache in %s\n", cache->dir);
+
+	return cache;
+
+err:
+	free(cache);
+	return NULL;
+}
+
+void
+gl_program_cache_destroy(struct gl_program_cache *cache)
+{
+	free(cache);
+}
+
+/** Link a program from a cached binary
+ *
+ * \param cache The program cache.
+ * \param program A program object without shaders attached.
+ * \param sources All shader sources the program is built from.
+ * \param count The number of sources.
+ * \return 0 if the program was linked from the cache, -1 otherwise.
+ *
+ * Entries that do not match the sources and driver, or that the driver
+ * refuses, are removed, so the caller compiles and stores the program
+ * again.
+ */
+int
+gl_program_cache_load(struct gl_program_cache *cache, GLuint program,
+		      const char * const *sources, int count)
+{
+	struct gl_program_cache_header header;
+	uint64_t key = cache_key(cache, sources, count);
+	char path[PATH_MAX];
+	void *binary = NULL;
+	GLint status = 0;
+	ssize_t len;
+	int fd;
+
+	cache_path(cache, key, path, sizeof path);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, &header, sizeof header);
+	if (len != sizeof header ||
+	    header.magic != PROGRAM_CACHE_MAGIC ||
+	    header.version != PROGRAM_CACHE_VERSION ||
+	    header.key != key ||
+	    header.driver != cache->driver ||
+	    header.length == 0 ||
+	    header.length > PROGRAM_CACHE_MAX_SIZE)
+		goto invalid;
+
+	binary = malloc(header.length);
+	if (!binary)
+		goto out;
+
+	len = read(fd, binary, header.length);
+	if (len != (ssize_t) header.length)
+		goto invalid;
+
+	cache->program_binary(program, header.format, binary, header.length);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status)
+		goto out;
+
+invalid:
+	weston_log("GL program cache: discarding stale %s\n", path);
+	unlink(path);
+out:
+	free(binary);
+	close(fd);
+
+	return status ? 0 : -1;
+}
+
+/** Store the binary of a linked program in the cache
+ *
+ * \param cache The program cache.
+ * \param program A successfully linked program.
+ * \param sources All shader sources the program was built from.
+ * \param count The number of sources.
+ * \return 0 if the program was written to the cache, -1 otherwise.
+ */
+int
+gl_program_cache_store(struct gl_program_cache *cache, GLuint program,
+		       const char * const *sources, int count)
+{
+	struct gl_program_cache_header header;
+	char path[PATH_MAX], tmp[PATH_MAX];
+	GLint length = 0;
+	GLsizei written = 0;
+	GLenum format;
+	void *binary;
+	int fd, ok;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0 || length > PROGRAM_CACHE_MAX_SIZE)
+		return -1;
+
+	binary = malloc(length);
+	if (!binary)
+		return -1;
+
+	cache->get_program_binary(program, length, &written, &format, binary);
+	if (written <= 0) {
+		free(binary);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof header);
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = cache_key(cache, sources, count);
+	header.driver = cache->driver;
+	header.format = format;
+	header.length = written;
+
+	/* Write to a temporary file first, so that a concurrently starting
+	 * compositor never reads a partial entry. */
+	cache_path(cache, header.key, path, sizeof path);
+	snprintf(tmp, sizeof tmp, "%s.%d", path, (int) getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		free(binary);
+		return -1;
+	}
+
+	ok = write(fd, &header, sizeof header) == sizeof header &&
+	     write(fd, binary, written) == written;
+	close(fd);
+	free(binary);
+
+	if (!ok || rename(tmp, path) < 0) {
+		weston_log("GL program cache: failed to write %s\n", path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WESTON_GL_PROGRAM_CACHE_H
+#define _WESTON_GL_PROGRAM_CACHE_H
+
+#include <GLES2/gl2.h>
+
+/* Linked GL programs stored on disk with GL_OES_get_program_binary,
+ * keyed by the GL driver strings and the shader sources. */
+struct gl_program_cache;
+
+struct gl_program_cache *
+gl_program_cache_create(const char *extensions);
+
+void
+gl_program_cache_destroy(struct gl_program_cache *cache);
+
+int
+gl_program_cache_load(struct gl_program_cache *cache, GLuint program,
+		      const char * const *sources, int count);
+
+int
+gl_program_cache_store(struct gl_program_cache *cache, GLuint program,
+		       const char * const *sources, int count);
+
+#endif
@@ -32,15 +32,19 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
+#include <math.h>
 #include <assert.h>
+#include <time.h>
 #include <linux/input.h>
 #include <drm_fourcc.h>
 
 #include "gl-renderer.h"
+#include "gl-program-cache.h"
 #include "vertex-clipping.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
@@ -61,6 +65,17 @@ struct gl_shader {
 
 #define BUFFER_DAMAGE_COUNT 2
 
+/* Number of pixel buffer objects SHM uploads cycle through. */
+#define UPLOAD_PBO_COUNT 4
+
+/* How often pending output read backs are checked for completion while
+ * the output does not repaint. */
+#define READBACK_POLL_MSECS 2
+
+/* SHM surfaces up to this many pixels may share the texture atlas. */
+#define ATLAS_MAX_AREA (256 * 256)
+#define ATLAS_MAX_SIZE 2048
+
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
 	BORDER_TOP_DIRTY = 1 << GL_RENDERER_BORDER_TOP,
@@ -78,6 +93,20 @@ struct gl_border_image {
 	void *data;
 };
 
+/* An output read back into a pixel buffer object, see
+ * gl_renderer_read_pixels_async() */
+struct gl_readback {
+	struct wl_list link;	/* gl_output_state::readback_list */
+	GLuint pbo;
+	GLsizeiptr capacity;
+	GLsizeiptr size;
+	EGLSyncKHR sync;
+	void *pixels;
+	weston_read_pixels_copy_func_t copy;
+	weston_read_pixels_done_func_t done;
+	void *data;
+};
+
 struct gl_output_state {
 	EGLSurface egl_surface;
 	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
@@ -87,6 +116,11 @@ struct gl_output_state {
 	enum gl_border_status border_status;
 
 	struct weston_matrix output_matrix;
+
+	/* In flight oldest first, and finished ones to reuse */
+	struct wl_list readback_list;
+	struct wl_list readback_free_list;
+	struct wl_event_source *readback_timer;
 };
 
 enum buffer_type {
@@ -136,6 +170,53 @@ struct yuv_format_descriptor {
 	struct yuv_plane_descriptor plane[4];
 };
 
+/* A row of atlas entries of at most the shelf height, filled left to
+ * right.  Entries are surrounded by a one texel gutter holding a copy
+ * of their edges, so linear filtering never samples a neighbour. */
+struct gl_atlas_shelf {
+	struct wl_list link;	/* gl_atlas::shelf_list, top to bottom */
+	int y, height;
+	int x;			/* where the next entry goes */
+	int entries;
+};
+
+struct gl_atlas {
+	GLuint texture;
+	int size;		/* 0 if the atlas is disabled */
+	int height_used;
+	struct wl_list shelf_list;
+};
+
+/* Everything the geometry of a view on screen is computed from */
+struct gl_view_geometry_key {
+	struct weston_matrix view_inverse;
+	struct weston_matrix surface_to_buffer;
+	int transformed;
+	struct texcoord_layout layout;
+};
+
+struct gl_view_geometry_slot {
+	pixman_region32_t region;	/* in surface coordinates */
+	struct clip_quad *quads;	/* one per rectangle of region */
+	int nquads;			/* -1 if unused */
+};
+
+/* Geometry of a view that stays the same from frame to frame unless the
+ * view or its buffer is transformed differently, so that only clipping
+ * to the repainted region is left to do for each frame. */
+struct gl_view_geometry {
+	struct wl_list link;		/* gl_surface_state::view_geometry_list */
+	struct weston_view *view;
+	struct wl_listener view_destroy_listener;
+
+	struct gl_view_geometry_key key;
+	struct weston_matrix texcoord_matrix;	/* from global coordinates */
+
+	/* A view is usually drawn as an opaque and a translucent part. */
+	struct gl_view_geometry_slot slots[2];
+	int last_slot;
+};
+
 struct gl_surface_state {
 	GLfloat color[4];
 	struct gl_shader *shader;
@@ -161,6 +242,13 @@ struct gl_surface_state {
 	int height; /* in pixels */
 	int y_inverted;
 
+	/* Set while the SHM buffer lives in the texture atlas, in which
+	 * case textures[0] is the atlas texture and must not be deleted. */
+	struct gl_atlas_shelf *atlas_shelf;
+	int atlas_x, atlas_y, atlas_width, atlas_height;
+
+	struct wl_list view_geometry_list;
+
 	/* Extension needed for SHM YUV texture */
 	int offset[3]; /* offset per plane */
 	int hsub[3];  /* horizontal subsampling per plane */
@@ -172,6 +260,18 @@ struct gl_surface_state {
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* Everything that has to be equal for views to be drawn together */
+struct gl_batch_state {
+	struct gl_shader *shader;
+	GLenum target;
+	GLuint textures[3];
+	int num_textures;
+	GLint filter;
+	bool blend;
+	GLfloat alpha;
+	GLfloat color[4];
+};
+
 struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
@@ -185,8 +285,13 @@ struct gl_renderer {
 
 	EGLSurface dummy_surface;
 
+	/* Geometry of the batch being collected, see gl_batch_flush() */
+	struct gl_batch_state batch;
+	struct weston_output *batch_output;
 	struct wl_array vertices;
-	struct wl_array vtxcnt;
+	struct wl_array indices;
+	GLuint vertex_buffer;
+	GLuint index_buffer;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -196,6 +301,29 @@ struct gl_renderer {
 
 	int has_unpack_subimage;
 
+	/* NULL unless enabled and supported */
+	struct gl_program_cache *program_cache;
+
+	/* SHM uploads are staged in a ring of pixel buffer objects, so
+	 * the GPU can copy them to textures without stalling the repaint.
+	 * The buffer mapping entry points are also used for read backs,
+	 * even with has_pbo disabled. */
+	int has_pbo;
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+	GLuint upload_pbo[UPLOAD_PBO_COUNT];
+	GLsizeiptr upload_pbo_size[UPLOAD_PBO_COUNT];
+	int upload_pbo_next;
+	/* Usage hint for read back PBOs, GLES 2 only knows the DRAW ones. */
+	GLenum readback_usage;
+
+	int has_fence_sync;
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+
+	struct gl_atlas atlas;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -374,76 +502,164 @@ gl_renderer_print_egl_error_state(void)
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 #define min(a, b) (((a) > (b)) ? (b) : (a))
 
-/*
- * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
- * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
- * polygon area.
+static void
+gl_view_geometry_slot_clear(struct gl_view_geometry_slot *slot)
+{
+	pixman_region32_clear(&slot->region);
+	slot->nquads = -1;
+}
+
+static void
+gl_view_geometry_destroy(struct gl_view_geometry *geometry)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		pixman_region32_fini(&geometry->slots[i].region);
+		free(geometry->slots[i].quads);
+	}
+	wl_list_remove(&geometry->view_destroy_listener.link);
+	wl_list_remove(&geometry->link);
+	free(geometry);
+}
+
+static void
+gl_view_geometry_handle_view_destroy(struct wl_listener *listener,
+				     void *data)
+{
+	struct gl_view_geometry *geometry =
+		container_of(listener, struct gl_view_geometry,
+			     view_destroy_listener);
+
+	gl_view_geometry_destroy(geometry);
+}
+
+/** Get the cached geometry of a view, up to date
+ *
+ * The mapping from global to texture coordinates is rebuilt, and all
+ * cached quads dropped, whenever the view transformation, the buffer
+ * transformation or the texture layout differ from last time.
  */
-static int
-calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
+static struct gl_view_geometry *
+gl_view_geometry_get(struct gl_renderer *gr, struct gl_surface_state *gs,
+		     struct weston_view *ev)
 {
+	struct gl_view_geometry *geometry, *found = NULL;
+	struct gl_view_geometry_key key;
+	struct weston_matrix *m;
+	int i;
 
-	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
-	};
+	wl_list_for_each(geometry, &gs->view_geometry_list, link) {
+		if (geometry->view == ev) {
+			found = geometry;
+			break;
+		}
+	}
+
+	memset(&key, 0, sizeof key);
+	key.view_inverse = ev->transform.inverse;
+	key.surface_to_buffer = ev->surface->surface_to_buffer_matrix;
+	key.transformed = ev->transform.enabled;
+	key.layout.y_inverted = gs->y_inverted;
+	key.layout.height = gs->height;
+	if (gs->atlas_shelf) {
+		key.layout.x = gs->atlas_x;
+		key.layout.y = gs->atlas_y;
+		key.layout.inv_width = 1.0 / gr->atlas.size;
+		key.layout.inv_height = 1.0 / gr->atlas.size;
+	} else {
+		key.layout.inv_width = 1.0 / gs->pitch;
+		key.layout.inv_height = 1.0 / gs->height;
+	}
+
+	if (found && memcmp(&found->key, &key, sizeof key) == 0)
+		return found;
+
+	if (!found) {
+		found = zalloc(sizeof *found);
+		if (!found)
+			return NULL;
+		found->view = ev;
+		for (i = 0; i < 2; i++)
+			pixman_region32_init(&found->slots[i].region);
+		found->view_destroy_listener.notify =
+			gl_view_geometry_handle_view_destroy;
+		wl_signal_add(&ev->destroy_signal,
+			      &found->view_destroy_listener);
+		wl_list_insert(&gs->view_geometry_list, &found->link);
+	}
+
+	found->key = key;
+	for (i = 0; i < 2; i++)
+		gl_view_geometry_slot_clear(&found->slots[i]);
 
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
+	/* global -> surface -> buffer -> normalized texture coordinates */
+	m = &found->texcoord_matrix;
+	*m = key.view_inverse;
+	weston_matrix_multiply(m, &key.surface_to_buffer);
+	texcoord_matrix_append(m, &key.layout);
 
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
+	return found;
+}
+
+/* The surface rectangles of surf_region as quads in global coordinates,
+ * from the cache when the region was seen in one of the last two calls. */
+static struct clip_quad *
+gl_view_geometry_get_quads(struct gl_view_geometry *geometry,
+			   struct weston_view *ev,
+			   pixman_region32_t *surf_region, int *nquads)
+{
+	struct gl_view_geometry_slot *slot;
+	struct clip_quad *quads;
+	struct polygon8 surf;
+	pixman_box32_t *rects;
+	int i, j, n;
 
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
+	*nquads = 0;
 
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
+	for (i = 0; i < 2; i++) {
+		slot = &geometry->slots[i];
+		if (slot->nquads >= 0 &&
+		    pixman_region32_equal(&slot->region, surf_region)) {
+			geometry->last_slot = i;
+			*nquads = slot->nquads;
+			return slot->quads;
+		}
 	}
 
-	/* First, simple bounding box check to discard early transformed
-	 * surface rects that do not intersect with the clip region:
-	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
-		return 0;
+	geometry->last_slot = !geometry->last_slot;
+	slot = &geometry->slots[geometry->last_slot];
+	gl_view_geometry_slot_clear(slot);
 
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!ev->transform.enabled)
-		return clip_simple(&ctx, &surf, ex, ey);
-
-	/* Transformed case: use a general polygon clipping algorithm to
-	 * clip the surface rectangle with each side of 'rect'.
-	 * The algorithm is Sutherland-Hodgman, as explained in
-	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
-	 * but without looking at any of that code.
-	 */
-	n = clip_transformed(&ctx, &surf, ex, ey);
+	rects = pixman_region32_rectangles(surf_region, &n);
+	quads = realloc(slot->quads, n * sizeof *quads);
+	if (n > 0 && !quads)
+		return NULL;
+	slot->quads = quads;
 
-	if (n < 3)
-		return 0;
+	for (i = 0; i < n; i++) {
+		surf.x[0] = rects[i].x1;
+		surf.y[0] = rects[i].y1;
+		surf.x[1] = rects[i].x2;
+		surf.y[1] = rects[i].y1;
+		surf.x[2] = rects[i].x2;
+		surf.y[2] = rects[i].y2;
+		surf.x[3] = rects[i].x1;
+		surf.y[3] = rects[i].y2;
+		surf.n = 4;
+
+		for (j = 0; j < surf.n; j++)
+			weston_view_to_global_float(ev, surf.x[j], surf.y[j],
+						    &surf.x[j], &surf.y[j]);
+
+		clip_quad_init(&quads[i], &surf, !ev->transform.enabled);
+	}
 
-	return n;
+	pixman_region32_copy(&slot->region, surf_region);
+	slot->nquads = n;
+	*nquads = n;
+
+	return quads;
 }
 
 static bool
@@ -495,21 +711,36 @@ compress_bands(pixman_box32_t *inrects, int nrects,
 	return nout;
 }
 
-static int
+static void
+gl_batch_flush(struct gl_renderer *gr);
+
+/* Appends the geometry to the current batch, as indexed triangles. */
+static void
 texture_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
 {
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
-	unsigned int *vtxcnt, nvtx = 0;
-	pixman_box32_t *rects, *surf_rects;
+	struct gl_view_geometry *geometry;
+	struct clip_quad *quads;
+	struct clip_context ctx;
+	GLfloat *v;
+	GLushort *index;
+	unsigned int first;
+	pixman_box32_t *rects;
 	pixman_box32_t *raw_rects;
 	int i, j, k, nrects, nsurf, raw_nrects;
 	bool used_band_compression;
+
+	geometry = gl_view_geometry_get(gr, gs, ev);
+	if (!geometry)
+		return;
+	quads = gl_view_geometry_get_quads(geometry, ev, surf_region, &nsurf);
+	if (!quads)
+		return;
+
 	raw_rects = pixman_region32_rectangles(region, &raw_nrects);
-	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
 
 	if (raw_nrects < 4) {
 		used_band_compression = false;
@@ -519,20 +750,14 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 		nrects = compress_bands(raw_rects, raw_nrects, &rects);
 		used_band_compression = true;
 	}
-	/* worst case we can have 8 vertices per rect (ie. clipped into
-	 * an octagon):
-	 */
-	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
-	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
-
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
 
 	for (i = 0; i < nrects; i++) {
-		pixman_box32_t *rect = &rects[i];
+		ctx.clip.x1 = rects[i].x1;
+		ctx.clip.y1 = rects[i].y1;
+		ctx.clip.x2 = rects[i].x2;
+		ctx.clip.y2 = rects[i].y2;
+
 		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
-			GLfloat sx, sy, bx, by;
 			GLfloat ex[8], ey[8];          /* edge points in screen space */
 			int n;
 
@@ -548,123 +773,50 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 			 *
 			 * To do this, we first calculate the (up to eight) points that
 			 * form the intersection of the clip rect and the transformed
-			 * surface.
+			 * surface, which is cached in global coordinates already.
 			 */
-			n = calculate_edges(ev, rect, surf_rect, ex, ey);
+			n = clip_quad(&ctx, &quads[j], ex, ey);
 			if (n < 3)
 				continue;
 
+			first = gr->vertices.size / (4 * sizeof *v);
+			if (first + n > UINT16_MAX + 1) {
+				gl_batch_flush(gr);
+				first = 0;
+			}
+
+			index = wl_array_add(&gr->indices,
+					     (n - 2) * 3 * sizeof *index);
+			if (!index)
+				continue;
+			v = wl_array_add(&gr->vertices, n * 4 * sizeof *v);
+			if (!v) {
+				gr->indices.size -= (n - 2) * 3 * sizeof *index;
+				continue;
+			}
+
+			/* the fan becomes triangles sharing its first vertex: */
+			for (k = 2; k < n; k++) {
+				*(index++) = first;
+				*(index++) = first + k - 1;
+				*(index++) = first + k;
+			}
+
 			/* emit edge points: */
 			for (k = 0; k < n; k++) {
-				weston_view_from_global_float(ev, ex[k], ey[k],
-							      &sx, &sy);
 				/* position: */
 				*(v++) = ex[k];
 				*(v++) = ey[k];
 				/* texcoord: */
-				weston_surface_to_buffer_float(ev->surface,
-							       sx, sy,
-							       &bx, &by);
-				*(v++) = bx * inv_width;
-				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
-				} else {
-					*(v++) = (gs->height - by) * inv_height;
-				}
+				texcoord_from_global(&geometry->texcoord_matrix,
+						     ex[k], ey[k], &v[0], &v[1]);
+				v += 2;
 			}
-
-			vtxcnt[nvtx++] = n;
 		}
 	}
 
 	if (used_band_compression)
 		free(rects);
-	return nvtx;
-}
-
-static void
-triangle_fan_debug(struct weston_view *view, int first, int count)
-{
-	struct weston_compositor *compositor = view->surface->compositor;
-	struct gl_renderer *gr = get_renderer(compositor);
-	int i;
-	GLushort *buffer;
-	GLushort *index;
-	int nelems;
-	static int color_idx = 0;
-	static const GLfloat color[][4] = {
-			{ 1.0, 0.0, 0.0, 1.0 },
-			{ 0.0, 1.0, 0.0, 1.0 },
-			{ 0.0, 0.0, 1.0, 1.0 },
-			{ 1.0, 1.0, 1.0, 1.0 },
-	};
-
-	nelems = (count - 1 + count - 2) * 2;
-
-	buffer = malloc(sizeof(GLushort) * nelems);
-	index = buffer;
-
-	for (i = 1; i < count; i++) {
-		*index++ = first;
-		*index++ = first + i;
-	}
-
-	for (i = 2; i < count; i++) {
-		*index++ = first + i - 1;
-		*index++ = first + i;
-	}
-
-	glUseProgram(gr->solid_shader.program);
-	glUniform4fv(gr->solid_shader.color_uniform, 1,
-			color[color_idx++ % ARRAY_LENGTH(color)]);
-	glDrawElements(GL_LINES, nelems, GL_UNSIGNED_SHORT, buffer);
-	glUseProgram(gr->current_shader->program);
-	free(buffer);
-}
-
-static void
-repaint_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
-{
-	struct weston_compositor *ec = ev->surface->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
-	unsigned int *vtxcnt;
-	int i, first, nfans;
-
-	/* The final region to be painted is the intersection of
-	 * 'region' and 'surf_region'. However, 'region' is in the global
-	 * coordinates, and 'surf_region' is in the surface-local
-	 * coordinates. texture_region() will iterate over all pairs of
-	 * rectangles from both regions, compute the intersection
-	 * polygon for each pair, and store it as a triangle fan if
-	 * it has a non-zero area (at least 3 vertices, actually).
-	 */
-	nfans = texture_region(ev, region, surf_region);
-
-	v = gr->vertices.data;
-	vtxcnt = gr->vtxcnt.data;
-
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
-
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
-
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(ev, first, vtxcnt[i]);
-		first += vtxcnt[i];
-	}
-
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
-
-	gr->vertices.size = 0;
-	gr->vtxcnt.size = 0;
 }
 
 static int
@@ -714,22 +866,154 @@ use_shader(struct gl_renderer *gr, struct gl_shader *shader)
 	gr->current_shader = shader;
 }
 
+static bool
+gl_batch_state_equal(const struct gl_batch_state *a,
+		     const struct gl_batch_state *b)
+{
+	int i;
+
+	if (a->shader != b->shader ||
+	    a->target != b->target ||
+	    a->num_textures != b->num_textures ||
+	    a->filter != b->filter ||
+	    a->blend != b->blend ||
+	    a->alpha != b->alpha ||
+	    memcmp(a->color, b->color, sizeof a->color) != 0)
+		return false;
+
+	for (i = 0; i < a->num_textures; i++)
+		if (a->textures[i] != b->textures[i])
+			return false;
+
+	return true;
+}
+
+static void
+gl_batch_draw_debug(struct gl_renderer *gr, struct gl_output_state *go)
+{
+	static int color_idx = 0;
+	static const GLfloat color[][4] = {
+			{ 1.0, 0.0, 0.0, 1.0 },
+			{ 0.0, 1.0, 0.0, 1.0 },
+			{ 0.0, 0.0, 1.0, 1.0 },
+			{ 1.0, 1.0, 1.0, 1.0 },
+	};
+	GLushort *tri = gr->indices.data;
+	GLushort *buffer, *line;
+	int i, ntri;
+
+	ntri = gr->indices.size / sizeof *tri / 3;
+	buffer = malloc(ntri * 6 * sizeof *buffer);
+	if (!buffer)
+		return;
+
+	line = buffer;
+	for (i = 0; i < ntri; i++, tri += 3) {
+		*line++ = tri[0];
+		*line++ = tri[1];
+		*line++ = tri[1];
+		*line++ = tri[2];
+		*line++ = tri[2];
+		*line++ = tri[0];
+	}
+
+	use_shader(gr, &gr->solid_shader);
+	glUniformMatrix4fv(gr->solid_shader.proj_uniform,
+			   1, GL_FALSE, go->output_matrix.d);
+	glUniform4fv(gr->solid_shader.color_uniform, 1,
+		     color[color_idx++ % ARRAY_LENGTH(color)]);
+	glUniform1f(gr->solid_shader.alpha_uniform, 1.0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDrawElements(GL_LINES, ntri * 6, GL_UNSIGNED_SHORT, buffer);
+	free(buffer);
+}
+
+/* Draws the geometry collected in the current batch with one call. */
 static void
-shader_uniforms(struct gl_shader *shader,
-		struct weston_view *view,
-		struct weston_output *output)
+gl_batch_flush(struct gl_renderer *gr)
 {
+	struct gl_batch_state *state = &gr->batch;
+	struct weston_output *output = gr->batch_output;
+	struct gl_output_state *go;
 	int i;
-	struct gl_surface_state *gs = get_surface_state(view->surface);
-	struct gl_output_state *go = get_output_state(output);
 
-	glUniformMatrix4fv(shader->proj_uniform,
+	if (gr->indices.size == 0) {
+		gr->vertices.size = 0;
+		return;
+	}
+
+	go = get_output_state(output);
+
+	use_shader(gr, state->shader);
+	glUniformMatrix4fv(state->shader->proj_uniform,
 			   1, GL_FALSE, go->output_matrix.d);
-	glUniform4fv(shader->color_uniform, 1, gs->color);
-	glUniform1f(shader->alpha_uniform, view->alpha);
+	glUniform4fv(state->shader->color_uniform, 1, state->color);
+	glUniform1f(state->shader->alpha_uniform, state->alpha);
 
-	for (i = 0; i < gs->num_textures; i++)
-		glUniform1i(shader->tex_uniforms[i], i);
+	for (i = 0; i < state->num_textures; i++) {
+		glUniform1i(state->shader->tex_uniforms[i], i);
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(state->target, state->textures[i]);
+		glTexParameteri(state->target, GL_TEXTURE_MIN_FILTER,
+				state->filter);
+		glTexParameteri(state->target, GL_TEXTURE_MAG_FILTER,
+				state->filter);
+	}
+
+	if (state->blend)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+
+	/* Orphaning the storage every time keeps the driver from waiting
+	 * on draws that still read the previous contents. */
+	glBindBuffer(GL_ARRAY_BUFFER, gr->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, gr->vertices.size,
+		     gr->vertices.data, GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gr->index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, gr->indices.size,
+		     gr->indices.data, GL_STREAM_DRAW);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      (void *) 0);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      (void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+
+	glDrawElements(GL_TRIANGLES, gr->indices.size / sizeof(GLushort),
+		       GL_UNSIGNED_SHORT, (void *) 0);
+	output->frame_stats.draw_calls++;
+
+	if (gr->fan_debug)
+		gl_batch_draw_debug(gr, go);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	gr->vertices.size = 0;
+	gr->indices.size = 0;
+}
+
+/* Starts collecting geometry drawn with the given state, submitting the
+ * current batch first if its state differs. */
+static void
+gl_batch_begin(struct gl_renderer *gr, struct weston_output *output,
+	       const struct gl_batch_state *state)
+{
+	if (gr->batch_output == output &&
+	    gl_batch_state_equal(&gr->batch, state))
+		return;
+
+	gl_batch_flush(gr);
+	gr->batch = *state;
+	gr->batch_output = output;
 }
 
 static void
@@ -739,13 +1023,13 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_batch_state state;
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
 	/* opaque region in surface coordinates: */
 	pixman_region32_t surface_opaque;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
-	GLint filter;
 	int i;
 
 	/* In case of a runtime switch of renderers, we may not have received
@@ -762,28 +1046,20 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-	if (gr->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, ev, output);
-	}
-
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, ev, output);
+	memset(&state, 0, sizeof state);
+	state.shader = gs->shader;
+	state.target = gs->target;
+	state.num_textures = gs->num_textures;
+	for (i = 0; i < gs->num_textures; i++)
+		state.textures[i] = gs->textures[i];
+	state.alpha = ev->alpha;
+	memcpy(state.color, gs->color, sizeof state.color);
 
 	if (ev->transform.enabled || output->zoom.active ||
 	    output->current_scale != ev->surface->buffer_viewport.buffer.scale)
-		filter = GL_LINEAR;
+		state.filter = GL_LINEAR;
 	else
-		filter = GL_NEAREST;
-
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
+		state.filter = GL_NEAREST;
 
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
@@ -810,22 +1086,19 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
+			state.shader = &gr->texture_shader_rgbx;
 		}
 
-		if (ev->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
-		repaint_region(ev, &repaint, &surface_opaque);
+		state.blend = ev->alpha < 1.0;
+		gl_batch_begin(gr, output, &state);
+		texture_region(ev, &repaint, &surface_opaque);
 	}
 
 	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(ev, &repaint, &surface_blend);
+		state.shader = gs->shader;
+		state.blend = true;
+		gl_batch_begin(gr, output, &state);
+		texture_region(ev, &repaint, &surface_blend);
 	}
 
 	pixman_region32_fini(&surface_blend);
@@ -839,11 +1112,19 @@ static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **views = output->view_list.data;
+	size_t i = output->view_list.size / sizeof *views;
+
+	struct gl_renderer *gr = get_renderer(compositor);
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	/* Bottom-most first; views not on this output are not listed. */
+	while (i--)
+		if (views[i]->plane == &compositor->primary_plane)
+			draw_view(views[i], output, damage);
+
+	gl_batch_flush(gr);
 }
 
 static void
@@ -1074,6 +1355,9 @@ output_rotate_damage(struct weston_output *output,
 	go->border_damage[go->buffer_damage_index] = border_status;
 }
 
+static void
+gl_renderer_poll_readbacks(struct weston_output *output);
+
 /* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
  * unavailable, so we're assuming the background has no transparency
  * and that everything with a blend, like drop shadows, will have something
@@ -1100,6 +1384,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
+	gl_renderer_poll_readbacks(output);
+
 	/* Calculate the viewport */
 	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
 		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
@@ -1228,6 +1514,534 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+static void
+gl_readback_finish(struct gl_renderer *gr, struct gl_output_state *go,
+		   struct gl_readback *rb, bool success)
+{
+	void *map = NULL;
+
+	if (success) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+		map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER_NV, 0,
+					   rb->size, GL_MAP_READ_BIT_EXT);
+		if (map) {
+			if (rb->copy)
+				rb->copy(rb->data, map);
+			else
+				memcpy(rb->pixels, map, rb->size);
+			gr->unmap_buffer(GL_PIXEL_PACK_BUFFER_NV);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+	}
+
+	if (rb->sync != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, rb->sync);
+	rb->sync = EGL_NO_SYNC_KHR;
+
+	wl_list_remove(&rb->link);
+	wl_list_insert(&go->readback_free_list, &rb->link);
+
+	rb->done(rb->data, map != NULL);
+}
+
+/* Hands out the read backs the GPU has finished, in order. Without
+ * fence syncs, mapping the buffer waits for the GPU instead. */
+static void
+gl_renderer_poll_readbacks(struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
+	EGLint status;
+
+	while (!wl_list_empty(&go->readback_list)) {
+		rb = container_of(go->readback_list.next,
+				  struct gl_readback, link);
+
+		status = EGL_CONDITION_SATISFIED_KHR;
+		if (rb->sync != EGL_NO_SYNC_KHR)
+			status = gr->client_wait_sync(gr->egl_display,
+						      rb->sync, 0, 0);
+		if (status == EGL_TIMEOUT_EXPIRED_KHR)
+			break;
+
+		gl_readback_finish(gr, go, rb, status != EGL_FALSE);
+	}
+
+	if (!wl_list_empty(&go->readback_list))
+		wl_event_source_timer_update(go->readback_timer,
+					     READBACK_POLL_MSECS);
+}
+
+static int
+readback_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	if (use_output(output) == 0)
+		gl_renderer_poll_readbacks(output);
+
+	return 0;
+}
+
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format, void *pixels,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_copy_func_t copy,
+			      weston_read_pixels_done_func_t done,
+			      void *data)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	GLsizeiptr size = (GLsizeiptr) width * height * 4;
+	struct gl_readback *rb;
+	GLenum gl_format;
+
+	if (!gr->map_buffer_range || size == 0)
+		return -1;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	if (!wl_list_empty(&go->readback_free_list)) {
+		rb = container_of(go->readback_free_list.next,
+				  struct gl_readback, link);
+		wl_list_remove(&rb->link);
+	} else {
+		rb = zalloc(sizeof *rb);
+		if (!rb)
+			return -1;
+		glGenBuffers(1, &rb->pbo);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+	if (rb->capacity < size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER_NV, size, NULL,
+			     gr->readback_usage);
+		rb->capacity = size;
+	}
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+	rb->size = size;
+	rb->pixels = pixels;
+	rb->copy = copy;
+	rb->done = done;
+	rb->data = data;
+	rb->sync = EGL_NO_SYNC_KHR;
+	if (gr->has_fence_sync)
+		rb->sync = gr->create_sync(gr->egl_display,
+					   EGL_SYNC_FENCE_KHR, NULL);
+	glFlush();
+
+	wl_list_insert(go->readback_list.prev, &rb->link);
+	wl_event_source_timer_update(go->readback_timer, READBACK_POLL_MSECS);
+
+	return 0;
+}
+
+/* Size in bytes of one texel of an SHM texture plane. */
+static int
+shm_plane_cpp(GLenum format, GLenum type)
+{
+	if (type == GL_UNSIGNED_SHORT_5_6_5)
+		return 2;
+
+	switch (format) {
+	case GL_BGRA_EXT:
+		return 4;
+	case GL_RG8_EXT:
+	case GL_LUMINANCE_ALPHA:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* Rows staged in a PBO are padded to the default GL_UNPACK_ALIGNMENT. */
+#define UPLOAD_ROW_ALIGN(n) (((n) + 3) & ~3)
+
+static void
+upload_box_align(struct gl_surface_state *gs, int height, pixman_box32_t *box)
+{
+	int i, hsub = 1, vsub = 1;
+
+	for (i = 0; i < gs->num_textures; i++) {
+		hsub = max(hsub, gs->hsub[i]);
+		vsub = max(vsub, gs->vsub[i]);
+	}
+
+	/* Subsampled planes need even coordinates. */
+	box->x1 = max(box->x1 - box->x1 % hsub, 0);
+	box->y1 = max(box->y1 - box->y1 % vsub, 0);
+	box->x2 = min(box->x2 + (hsub - box->x2 % hsub) % hsub, gs->pitch);
+	box->y2 = min(box->y2 + (vsub - box->y2 % vsub) % vsub, height);
+}
+
+/* Copies the damaged part of an SHM buffer into the next PBO of the
+ * ring and uploads the textures from there. The damage is staged in one
+ * go, as its extents unless those are much larger than the damage
+ * itself, so the client buffer can be released right away while the
+ * GPU does the actual transfer asynchronously.
+ */
+static bool
+gl_renderer_upload_pbo(struct gl_renderer *gr, struct gl_surface_state *gs,
+		       struct weston_surface *surface,
+		       struct weston_buffer *buffer)
+{
+	pixman_region32_t damage;
+	pixman_box32_t *rects, *boxes, r;
+	uint64_t area = 0, extents_area;
+	GLsizeiptr size = 0, offset;
+	uint8_t *data, *map, *src;
+	int cpp, width, rows, row_bytes, plane_stride;
+	int i, j, n, y, pbo;
+
+	pixman_region32_init(&damage);
+	if (gs->needs_full_upload) {
+		pixman_region32_union_rect(&damage, &damage, 0, 0,
+					   gs->pitch, buffer->height);
+	} else {
+		rects = pixman_region32_rectangles(&gs->texture_damage, &n);
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface, rects[i]);
+			upload_box_align(gs, buffer->height, &r);
+			if (r.x1 >= r.x2 || r.y1 >= r.y2)
+				continue;
+			pixman_region32_union_rect(&damage, &damage,
+						   r.x1, r.y1,
+						   r.x2 - r.x1, r.y2 - r.y1);
+		}
+	}
+
+	boxes = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t) (boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1);
+	r = *pixman_region32_extents(&damage);
+	extents_area = (uint64_t) (r.x2 - r.x1) * (r.y2 - r.y1);
+	if (extents_area <= 2 * area) {
+		boxes = &r;
+		n = 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < gs->num_textures; j++) {
+			cpp = shm_plane_cpp(gs->gl_format[j],
+					    gs->gl_pixel_type);
+			width = (boxes[i].x2 - boxes[i].x1) / gs->hsub[j];
+			rows = (boxes[i].y2 - boxes[i].y1) / gs->vsub[j];
+			size += (GLsizeiptr) UPLOAD_ROW_ALIGN(width * cpp) * rows;
+		}
+	}
+
+	if (size == 0) {
+		pixman_region32_fini(&damage);
+		return true;
+	}
+
+	pbo = gr->upload_pbo_next;
+	gr->upload_pbo_next = (pbo + 1) % UPLOAD_PBO_COUNT;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, gr->upload_pbo[pbo]);
+	if (gr->upload_pbo_size[pbo] < size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, size, NULL,
+			     GL_STREAM_DRAW);
+		gr->upload_pbo_size[pbo] = size;
+	}
+
+	/* Invalidating lets the driver hand out fresh storage if the GPU
+	 * is still reading from this buffer. */
+	map = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV, 0, size,
+				   GL_MAP_WRITE_BIT_EXT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT_EXT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		pixman_region32_fini(&damage);
+		return false;
+	}
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < gs->num_textures; j++) {
+			cpp = shm_plane_cpp(gs->gl_format[j],
+					    gs->gl_pixel_type);
+			plane_stride = gs->pitch / gs->hsub[j] * cpp;
+			width = (boxes[i].x2 - boxes[i].x1) / gs->hsub[j];
+			rows = (boxes[i].y2 - boxes[i].y1) / gs->vsub[j];
+			row_bytes = UPLOAD_ROW_ALIGN(width * cpp);
+			src = data + gs->offset[j] +
+			      boxes[i].y1 / gs->vsub[j] * plane_stride +
+			      boxes[i].x1 / gs->hsub[j] * cpp;
+
+			if (row_bytes == plane_stride &&
+			    width * cpp == plane_stride) {
+				memcpy(map + offset, src,
+				       (size_t) row_bytes * rows);
+			} else {
+				for (y = 0; y < rows; y++)
+					memcpy(map + offset + y * row_bytes,
+					       src + y * plane_stride,
+					       width * cpp);
+			}
+			offset += (GLsizeiptr) row_bytes * rows;
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+	gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV);
+
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < gs->num_textures; j++) {
+			cpp = shm_plane_cpp(gs->gl_format[j],
+					    gs->gl_pixel_type);
+			width = (boxes[i].x2 - boxes[i].x1) / gs->hsub[j];
+			rows = (boxes[i].y2 - boxes[i].y1) / gs->vsub[j];
+
+			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
+			if (gs->needs_full_upload)
+				glTexImage2D(GL_TEXTURE_2D, 0,
+					     gs->gl_format[j],
+					     width, rows, 0,
+					     gs->gl_format[j],
+					     gs->gl_pixel_type,
+					     (void *) (uintptr_t) offset);
+			else
+				glTexSubImage2D(GL_TEXTURE_2D, 0,
+						boxes[i].x1 / gs->hsub[j],
+						boxes[i].y1 / gs->vsub[j],
+						width, rows,
+						gs->gl_format[j],
+						gs->gl_pixel_type,
+						(void *) (uintptr_t) offset);
+			offset += (GLsizeiptr) UPLOAD_ROW_ALIGN(width * cpp) *
+				  rows;
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+	pixman_region32_fini(&damage);
+
+	return true;
+}
+
+/** Find room for an SHM buffer in the texture atlas
+ *
+ * \param gr The renderer.
+ * \param gs The surface state, which must not be in the atlas yet.
+ * \param width The buffer width in pixels.
+ * \param height The buffer height in pixels.
+ * \return true if the buffer got an entry, false if the atlas is full.
+ *
+ * The entry goes into the lowest shelf it fits in, unless that would
+ * waste more than half of the shelf and a new one can still be opened.
+ */
+static bool
+gl_atlas_alloc(struct gl_renderer *gr, struct gl_surface_state *gs,
+	       int width, int height)
+{
+	struct gl_atlas *atlas = &gr->atlas;
+	struct gl_atlas_shelf *shelf, *best = NULL;
+	int w = width + 2, h = height + 2;
+
+	if (atlas->texture == 0) {
+		glGenTextures(1, &atlas->texture);
+		glBindTexture(GL_TEXTURE_2D, atlas->texture);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+			     atlas->size, atlas->size, 0,
+			     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	wl_list_for_each(shelf, &atlas->shelf_list, link) {
+		if (shelf->height < h || atlas->size - shelf->x < w)
+			continue;
+		if (!best || shelf->height < best->height)
+			best = shelf;
+	}
+
+	if ((!best || best->height > 2 * h) &&
+	    atlas->size - atlas->height_used >= h) {
+		shelf = zalloc(sizeof *shelf);
+		if (shelf) {
+			shelf->y = atlas->height_used;
+			shelf->height = h;
+			wl_list_insert(atlas->shelf_list.prev, &shelf->link);
+			atlas->height_used += h;
+			best = shelf;
+		}
+	}
+
+	if (!best)
+		return false;
+
+	gs->atlas_shelf = best;
+	gs->atlas_x = best->x + 1;
+	gs->atlas_y = best->y + 1;
+	gs->atlas_width = width;
+	gs->atlas_height = height;
+	best->x += w;
+	best->entries++;
+
+	gs->textures[0] = atlas->texture;
+	gs->num_textures = 1;
+
+	return true;
+}
+
+static void
+gl_atlas_release(struct gl_renderer *gr, struct gl_surface_state *gs)
+{
+	struct gl_atlas *atlas = &gr->atlas;
+	struct gl_atlas_shelf *shelf = gs->atlas_shelf;
+
+	if (!shelf)
+		return;
+
+	gs->atlas_shelf = NULL;
+	gs->textures[0] = 0;
+	gs->num_textures = 0;
+
+	/* Space in a shelf is only reclaimed once all of it is free. */
+	if (--shelf->entries > 0)
+		return;
+
+	shelf->x = 0;
+	while (!wl_list_empty(&atlas->shelf_list)) {
+		shelf = container_of(atlas->shelf_list.prev,
+				     struct gl_atlas_shelf, link);
+		if (shelf->entries > 0)
+			break;
+		atlas->height_used = shelf->y;
+		wl_list_remove(&shelf->link);
+		free(shelf);
+	}
+}
+
+static void
+gl_atlas_fini(struct gl_renderer *gr)
+{
+	struct gl_atlas_shelf *shelf, *next;
+
+	wl_list_for_each_safe(shelf, next, &gr->atlas.shelf_list, link)
+		free(shelf);
+	wl_list_init(&gr->atlas.shelf_list);
+
+	if (gr->atlas.texture)
+		glDeleteTextures(1, &gr->atlas.texture);
+	gr->atlas.texture = 0;
+}
+
+/* Copies the w x h rectangle at sx, sy of the buffer to dx, dy of its
+ * atlas entry; dx and dy may point into the gutter. */
+static void
+atlas_upload_rect(struct gl_surface_state *gs, void *data,
+		  int sx, int sy, int w, int h, int dx, int dy)
+{
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, sx);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, sy);
+	glTexSubImage2D(GL_TEXTURE_2D, 0,
+			gs->atlas_x + dx, gs->atlas_y + dy, w, h,
+			GL_BGRA_EXT, GL_UNSIGNED_BYTE, data);
+}
+
+/* Uploads the extents of the damage into the atlas entry, and the edges
+ * of it into the gutter where the damage touches them. */
+static void
+gl_atlas_upload(struct gl_renderer *gr, struct gl_surface_state *gs,
+		struct weston_surface *surface, struct weston_buffer *buffer)
+{
+	int width = gs->atlas_width, height = gs->atlas_height;
+	pixman_box32_t *rects, r, box;
+	void *data;
+	int i, n, w, h;
+
+	if (gs->needs_full_upload) {
+		box.x1 = 0;
+		box.y1 = 0;
+		box.x2 = width;
+		box.y2 = height;
+	} else {
+		box.x1 = width;
+		box.y1 = height;
+		box.x2 = 0;
+		box.y2 = 0;
+		rects = pixman_region32_rectangles(&gs->texture_damage, &n);
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface, rects[i]);
+			box.x1 = min(box.x1, max(r.x1, 0));
+			box.y1 = min(box.y1, max(r.y1, 0));
+			box.x2 = max(box.x2, min(r.x2, width));
+			box.y2 = max(box.y2, min(r.y2, height));
+		}
+	}
+
+	if (box.x1 >= box.x2 || box.y1 >= box.y2)
+		return;
+
+	w = box.x2 - box.x1;
+	h = box.y2 - box.y1;
+
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	glBindTexture(GL_TEXTURE_2D, gr->atlas.texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	atlas_upload_rect(gs, data, box.x1, box.y1, w, h, box.x1, box.y1);
+
+	if (box.x1 == 0)
+		atlas_upload_rect(gs, data, 0, box.y1, 1, h, -1, box.y1);
+	if (box.x2 == width)
+		atlas_upload_rect(gs, data, width - 1, box.y1, 1, h,
+				  width, box.y1);
+	if (box.y1 == 0)
+		atlas_upload_rect(gs, data, box.x1, 0, w, 1, box.x1, -1);
+	if (box.y2 == height)
+		atlas_upload_rect(gs, data, box.x1, height - 1, w, 1,
+				  box.x1, height);
+
+	if (box.x1 == 0 && box.y1 == 0)
+		atlas_upload_rect(gs, data, 0, 0, 1, 1, -1, -1);
+	if (box.x2 == width && box.y1 == 0)
+		atlas_upload_rect(gs, data, width - 1, 0, 1, 1, width, -1);
+	if (box.x1 == 0 && box.y2 == height)
+		atlas_upload_rect(gs, data, 0, height - 1, 1, 1, -1, height);
+	if (box.x2 == width && box.y2 == height)
+		atlas_upload_rect(gs, data, width - 1, height - 1, 1, 1,
+				  width, height);
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -1249,11 +2063,12 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	/* Avoid upload, if the texture won't be used this time.
 	 * We still accumulate the damage in texture_damage, and
 	 * hold the reference to the buffer, in case the surface
-	 * migrates back to the primary plane.
+	 * migrates back to the primary plane or is uncovered.
 	 */
 	texture_used = false;
 	wl_list_for_each(view, &surface->views, surface_link) {
-		if (view->plane == &surface->compositor->primary_plane) {
+		if (view->plane == &surface->compositor->primary_plane &&
+		    !view->occluded) {
 			texture_used = true;
 			break;
 		}
@@ -1265,6 +2080,14 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	    !gs->needs_full_upload)
 		goto done;
 
+	if (gs->atlas_shelf) {
+		gl_atlas_upload(gr, gs, surface, buffer);
+		goto done;
+	}
+
+	if (gr->has_pbo && gl_renderer_upload_pbo(gr, gs, surface, buffer))
+		goto done;
+
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
 	if (!gr->has_unpack_subimage) {
@@ -1368,6 +2191,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	GLenum gl_pixel_type;
 	int pitch;
 	int num_planes;
+	bool use_atlas;
 
 	buffer->shm_buffer = shm_buffer;
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
@@ -1456,11 +2280,20 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		return;
 	}
 
+	use_atlas = gr->atlas.size > 0 &&
+		    num_planes == 1 &&
+		    gl_format[0] == GL_BGRA_EXT &&
+		    gl_pixel_type == GL_UNSIGNED_BYTE &&
+		    buffer->width * buffer->height <= ATLAS_MAX_AREA &&
+		    buffer->width + 2 <= gr->atlas.size &&
+		    buffer->height + 2 <= gr->atlas.size;
+
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
 	 * happening, we need to allocate a new texture buffer. */
 	if (pitch != gs->pitch ||
 	    buffer->height != gs->height ||
+	    (gs->atlas_shelf && buffer->width != gs->atlas_width) ||
 	    gl_format[0] != gs->gl_format[0] ||
 	    gl_format[1] != gs->gl_format[1] ||
 	    gl_format[2] != gs->gl_format[2] ||
@@ -1479,7 +2312,16 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 
 		gs->surface = es;
 
-		ensure_textures(gs, num_planes);
+		/* When the atlas is full, the buffer gets private textures
+		 * until its size or format changes. */
+		gl_atlas_release(gr, gs);
+		if (use_atlas) {
+			glDeleteTextures(gs->num_textures, gs->textures);
+			gs->num_textures = 0;
+			gl_atlas_alloc(gr, gs, buffer->width, buffer->height);
+		}
+		if (!gs->atlas_shelf)
+			ensure_textures(gs, num_planes);
 	}
 }
 
@@ -2013,6 +2855,7 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 			gs->images[i] = NULL;
 		}
 		gs->num_images = 0;
+		gl_atlas_release(gr, gs);
 		glDeleteTextures(gs->num_textures, gs->textures);
 		gs->num_textures = 0;
 		gs->buffer_type = BUFFER_TYPE_NULL;
@@ -2022,6 +2865,10 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
+	/* EGL images are bound to textures of their own. */
+	if (!shm_buffer)
+		gl_atlas_release(gr, gs);
+
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
 	else if (gr->has_bind_display &&
@@ -2049,6 +2896,7 @@ gl_renderer_surface_set_color(struct weston_surface *surface,
 	gs->color[1] = green;
 	gs->color[2] = blue;
 	gs->color[3] = alpha;
+	gl_atlas_release(gr, gs);
 	gs->buffer_type = BUFFER_TYPE_SOLID;
 	gs->pitch = 1;
 	gs->height = 1;
@@ -2117,6 +2965,8 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
 	struct gl_renderer *gr = get_renderer(surface->compositor);
 	struct gl_surface_state *gs = get_surface_state(surface);
+	GLfloat texcoords[4 * 2];
+	const GLfloat *tc = verts;
 	int cw, ch;
 	GLuint fbo;
 	GLuint tex;
@@ -2178,12 +3028,24 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	}
 
+	/* Only the entry of the surface in the atlas */
+	if (gs->atlas_shelf) {
+		for (i = 0; i < 4; i++) {
+			texcoords[i * 2] = (gs->atlas_x + verts[i * 2] * cw) /
+					   gr->atlas.size;
+			texcoords[i * 2 + 1] =
+				(gs->atlas_y + verts[i * 2 + 1] * ch) /
+				gr->atlas.size;
+		}
+		tc = texcoords;
+	}
+
 	/* position: */
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
 	glEnableVertexAttribArray(0);
 
 	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, tc);
 	glEnableVertexAttribArray(1);
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -2204,6 +3066,7 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 static void
 surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 {
+	struct gl_view_geometry *geometry, *next;
 	int i;
 
 	wl_list_remove(&gs->surface_destroy_listener.link);
@@ -2211,11 +3074,15 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
+	gl_atlas_release(gr, gs);
 	glDeleteTextures(gs->num_textures, gs->textures);
 
 	for (i = 0; i < gs->num_images; i++)
 		egl_image_unref(gs->images[i]);
 
+	wl_list_for_each_safe(geometry, next, &gs->view_geometry_list, link)
+		gl_view_geometry_destroy(geometry);
+
 	weston_buffer_reference(&gs->buffer_ref, NULL);
 	pixman_region32_fini(&gs->texture_damage);
 	free(gs);
@@ -2269,6 +3136,7 @@ gl_renderer_create_surface(struct weston_surface *surface)
 	gs->surface = surface;
 
 	pixman_region32_init(&gs->texture_damage);
+	wl_list_init(&gs->view_geometry_list);
 	surface->renderer_state = gs;
 
 	gs->surface_destroy_listener.notify =
@@ -2424,26 +3292,45 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 	char msg[512];
 	GLint status;
 	int count;
-	const char *sources[3];
+	/* the vertex source, followed by the fragment sources: */
+	const char *sources[4];
+	struct timespec begin, end;
+	bool cached = false, stored = false;
 
-	shader->vertex_shader =
-		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 
+	sources[0] = vertex_source;
 	if (renderer->fragment_shader_debug) {
-		sources[0] = fragment_source;
-		sources[1] = fragment_debug;
-		sources[2] = fragment_brace;
+		sources[1] = fragment_source;
+		sources[2] = fragment_debug;
+		sources[3] = fragment_brace;
 		count = 3;
 	} else {
-		sources[0] = fragment_source;
-		sources[1] = fragment_brace;
+		sources[1] = fragment_source;
+		sources[2] = fragment_brace;
 		count = 2;
 	}
 
+	shader->program = glCreateProgram();
+
+	if (renderer->program_cache) {
+		if (gl_program_cache_load(renderer->program_cache,
+					  shader->program,
+					  sources, count + 1) == 0) {
+			cached = true;
+			goto uniforms;
+		}
+
+		/* Do not link on top of a rejected binary. */
+		glDeleteProgram(shader->program);
+		shader->program = glCreateProgram();
+	}
+
+	shader->vertex_shader =
+		compile_shader(GL_VERTEX_SHADER, 1, &sources[0]);
 	shader->fragment_shader =
-		compile_shader(GL_FRAGMENT_SHADER, count, sources);
+		compile_shader(GL_FRAGMENT_SHADER, count, &sources[1]);
 
-	shader->program = glCreateProgram();
 	glAttachShader(shader->program, shader->vertex_shader);
 	glAttachShader(shader->program, shader->fragment_shader);
 	glBindAttribLocation(shader->program, 0, "position");
@@ -2457,6 +3344,23 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
+	if (renderer->program_cache)
+		stored = gl_program_cache_store(renderer->program_cache,
+						shader->program,
+						sources, count + 1) == 0;
+
+uniforms:
+	if (renderer->program_cache) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		weston_log("GL program %s in %.2f ms%s\n",
+			   cached ? "loaded from cache" :
+			   stored ? "compiled and cached" : "compiled",
+			   ((end.tv_sec - begin.tv_sec) * 1000000000LL +
+			    end.tv_nsec - begin.tv_nsec) / 1e6,
+			   cached || stored ?
+			   "" : ", storing it in the cache failed");
+	}
+
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
@@ -2703,6 +3607,8 @@ static int
 gl_renderer_output_create(struct weston_output *output,
 			  EGLSurface surface)
 {
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(output->compositor->wl_display);
 	struct gl_output_state *go;
 	int i;
 
@@ -2710,6 +3616,16 @@ gl_renderer_output_create(struct weston_output *output,
 	if (go == NULL)
 		return -1;
 
+	go->readback_timer = wl_event_loop_add_timer(loop,
+						     readback_timer_handler,
+						     output);
+	if (go->readback_timer == NULL) {
+		free(go);
+		return -1;
+	}
+	wl_list_init(&go->readback_list);
+	wl_list_init(&go->readback_free_list);
+
 	go->egl_surface = surface;
 
 	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
@@ -2755,11 +3671,20 @@ gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb, *next;
 	int i;
 
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	wl_list_for_each_safe(rb, next, &go->readback_list, link)
+		gl_readback_finish(gr, go, rb, false);
+	wl_list_for_each_safe(rb, next, &go->readback_free_list, link) {
+		glDeleteBuffers(1, &rb->pbo);
+		free(rb);
+	}
+	wl_event_source_remove(go->readback_timer);
+
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
 		       EGL_NO_CONTEXT);
@@ -2786,6 +3711,12 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	if (gr->has_pbo)
+		glDeleteBuffers(UPLOAD_PBO_COUNT, gr->upload_pbo);
+	glDeleteBuffers(1, &gr->vertex_buffer);
+	glDeleteBuffers(1, &gr->index_buffer);
+	gl_atlas_fini(gr);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -2805,7 +3736,10 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_list_remove(&gr->output_destroy_listener.link);
 
 	wl_array_release(&gr->vertices);
-	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
+
+	if (gr->program_cache)
+		gl_program_cache_destroy(gr->program_cache);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
@@ -2877,6 +3811,17 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 			gr->has_bind_display = 0;
 	}
 
+	if (weston_check_egl_extension(extensions, "EGL_KHR_fence_sync")) {
+		gr->create_sync =
+			(void *) eglGetProcAddress("eglCreateSyncKHR");
+		gr->destroy_sync =
+			(void *) eglGetProcAddress("eglDestroySyncKHR");
+		gr->client_wait_sync =
+			(void *) eglGetProcAddress("eglClientWaitSyncKHR");
+		gr->has_fence_sync = gr->create_sync && gr->destroy_sync &&
+				     gr->client_wait_sync;
+	}
+
 	if (weston_check_egl_extension(extensions, "EGL_EXT_buffer_age"))
 		gr->has_egl_buffer_age = 1;
 	else
@@ -3086,6 +4031,7 @@ gl_renderer_display_create(struct weston_compositor *ec, EGLenum platform,
 		return -1;
 
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
@@ -3146,6 +4092,7 @@ gl_renderer_display_create(struct weston_compositor *ec, EGLenum platform,
 		goto fail_with_error;
 
 	wl_list_init(&gr->dmabuf_images);
+	wl_list_init(&gr->atlas.shelf_list);
 	if (gr->has_dmabuf_import)
 		gr->base.import_dmabuf = gl_renderer_import_dmabuf;
 
@@ -3260,6 +4207,47 @@ fan_debug_repaint_binding(struct weston_keyboard *keyboard, uint32_t time,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+setup_pixel_buffers(struct gl_renderer *gr, const char *extensions)
+{
+	const char *version = (const char *) glGetString(GL_VERSION);
+	const char *env = getenv("WESTON_GL_UPLOAD_PBO");
+	int major = 0;
+
+	if (version)
+		sscanf(version, "OpenGL ES %d.", &major);
+
+	if (major >= 3) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRange");
+		gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBuffer");
+		gr->readback_usage = GL_STREAM_READ;
+	} else if (weston_check_egl_extension(extensions,
+					      "GL_NV_pixel_buffer_object") &&
+		   weston_check_egl_extension(extensions,
+					      "GL_EXT_map_buffer_range") &&
+		   weston_check_egl_extension(extensions,
+					      "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+		gr->readback_usage = GL_STREAM_DRAW;
+	}
+
+	if (!gr->map_buffer_range || !gr->unmap_buffer) {
+		gr->map_buffer_range = NULL;
+		return;
+	}
+
+	/* Allows comparing against the direct upload path. */
+	if (env && strcmp(env, "0") == 0)
+		return;
+
+	glGenBuffers(UPLOAD_PBO_COUNT, gr->upload_pbo);
+	gr->has_pbo = 1;
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -3327,6 +4315,22 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (weston_check_egl_extension(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	setup_pixel_buffers(gr, extensions);
+
+	glGenBuffers(1, &gr->vertex_buffer);
+	glGenBuffers(1, &gr->index_buffer);
+
+	if (ec->gl_program_cache)
+		gr->program_cache = gl_program_cache_create(extensions);
+
+	/* Entries are placed with GL_EXT_unpack_subimage. */
+	if (ec->gl_texture_atlas && gr->has_unpack_subimage) {
+		GLint max_size;
+
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+		gr->atlas.size = min(max_size, ATLAS_MAX_SIZE);
+	}
+
 	glActiveTexture(GL_TEXTURE0);
 
 	if (compile_shaders(ec))
@@ -3350,6 +4354,14 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBOs: %s\n",
+			    gr->has_pbo ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "asynchronous read back: %s\n",
+			    gr->map_buffer_range ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "program binary cache: %s\n",
+			    gr->program_cache ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "texture atlas: %s\n",
+			    gr->atlas.size ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
 
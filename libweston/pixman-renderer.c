@@ -31,29 +31,88 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "pixman-renderer.h"
+#include "yuv-convert.h"
 #include "shared/helpers.h"
 
 #include <linux/input.h>
 
 struct pixman_output_state {
+	uint32_t flags;
+	int32_t width, height;
+
+	/* NULL when views are drawn straight into hw_buffer. */
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+	/* The shadow was just created, the next repaint covers it all. */
+	bool shadow_new;
+
+	/* Software cursor, drawn onto hw_buffer after everything else.
+	 * The pixels it covers are saved, so that moving it only needs
+	 * them put back instead of repainting the views below. With a
+	 * shadow, they are put back from the shadow instead. */
+	struct weston_plane cursor_plane;
+	struct weston_view *cursor_view;
+	pixman_image_t *cursor_save;
+	pixman_box32_t cursor_box;		/* output coordinates */
+	pixman_region32_t cursor_region;	/* global coordinates */
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color;	/* if image is a solid fill */
 	struct weston_buffer_reference buffer_ref;
 
+	/* RGB copy of a YUV buffer, kept while YUV buffers are attached
+	 * so that only damaged areas need converting. */
+	pixman_image_t *converted;
+	pixman_region32_t convert_damage;	/* surface coordinates */
+	bool convert_full;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* The part of an output rendered by one thread. With a worker pool,
+ * each band gets its own images wrapping the output buffers, as pixman
+ * images carry state like the clip region and must not be shared
+ * between threads. */
+struct pixman_band {
+	pixman_image_t *target;		/* the shadow image or hw buffer */
+	pixman_image_t *hw_buffer;	/* NULL if target is the hw buffer */
+	pixman_image_t *debug_color;
+	pixman_region32_t *clip;	/* output coordinates, NULL for all */
+};
+
+struct pixman_worker_pool {
+	pthread_t *threads;
+	int n_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	uint32_t generation;
+	int busy;
+	bool quit;
+
+	/* The frame being rendered, set up by the main thread. */
+	struct weston_output *output;
+	pixman_region32_t *damage;		/* global coordinates */
+	pixman_region32_t damage_output;	/* output coordinates */
+	int band_height;
+	int n_bands;
+	int next_band;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
@@ -61,6 +120,9 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	/* NULL if rendering on the main thread only. */
+	struct pixman_worker_pool *pool;
+
 	struct wl_signal destroy_signal;
 };
 
@@ -316,6 +378,21 @@ composite_clipped(pixman_image_t *src,
 	}
 }
 
+/* A private image sharing the pixels of image, so that its transform,
+ * filter and clip can be set without affecting other threads. */
+static pixman_image_t *
+wrap_image(pixman_image_t *image, const pixman_color_t *color)
+{
+	if (!pixman_image_get_data(image))
+		return pixman_image_create_solid_fill(color);
+
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
+
 /** Paint an intersected region
  *
  * \param ev The view to be painted.
@@ -324,25 +401,38 @@ composite_clipped(pixman_image_t *src,
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
  * \param pixman_op Compositing operator, either SRC or OVER.
+ * \param band The band of the output being painted, clips repaint_output.
  */
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
-	       pixman_op_t pixman_op)
+	       pixman_op_t pixman_op,
+	       struct pixman_band *band)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
+	pixman_image_t *src_image;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
+	if (band->clip) {
+		pixman_region32_intersect(repaint_output, repaint_output,
+					  band->clip);
+		if (!pixman_region32_not_empty(repaint_output))
+			return;
+
+		src_image = wrap_image(ps->image, &ps->color);
+		if (!src_image)
+			return;
+	} else {
+		src_image = pixman_image_ref(ps->image);
+	}
+
 	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(po->shadow_image, repaint_output);
+	pixman_image_set_clip_region32(band->target, repaint_output);
 
 	pixman_renderer_compute_transform(&transform, ev, output);
 
@@ -362,35 +452,37 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	}
 
 	if (source_clip)
-		composite_clipped(ps->image, mask_image, po->shadow_image,
+		composite_clipped(src_image, mask_image, band->target,
 				  &transform, filter, source_clip);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
-				po->shadow_image, &transform, filter);
+		composite_whole(pixman_op, src_image, mask_image,
+				band->target, &transform, filter);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
+	pixman_image_unref(src_image);
 
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
 
-	if (pr->repaint_debug)
+	if (band->debug_color)
 		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+					 band->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 band->target, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (band->target), /* width */
+					 pixman_image_get_height (band->target) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (band->target, NULL);
 }
 
 static void
 draw_view_translated(struct weston_view *view, struct weston_output *output,
-		     pixman_region32_t *repaint_global)
+		     pixman_region32_t *repaint_global,
+		     struct pixman_band *band)
 {
 	struct weston_surface *surface = view->surface;
 	/* non-opaque region in surface coordinates: */
@@ -418,7 +510,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 			region_global_to_output(output, &repaint_output);
 
 			repaint_region(view, output, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+				       PIXMAN_OP_SRC, band);
 		}
 	}
 
@@ -429,7 +521,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 		region_global_to_output(output, &repaint_output);
 
 		repaint_region(view, output, &repaint_output, NULL,
-			       PIXMAN_OP_OVER);
+			       PIXMAN_OP_OVER, band);
 	}
 
 	pixman_region32_fini(&surface_blend);
@@ -439,7 +531,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 static void
 draw_view_source_clipped(struct weston_view *view,
 			 struct weston_output *output,
-			 pixman_region32_t *repaint_global)
+			 pixman_region32_t *repaint_global,
+			 struct pixman_band *band)
 {
 	struct weston_surface *surface = view->surface;
 	pixman_region32_t surf_region;
@@ -465,7 +558,7 @@ draw_view_source_clipped(struct weston_view *view,
 	region_global_to_output(output, &repaint_output);
 
 	repaint_region(view, output, &repaint_output, &buffer_region,
-		       PIXMAN_OP_OVER);
+		       PIXMAN_OP_OVER, band);
 
 	pixman_region32_fini(&repaint_output);
 	pixman_region32_fini(&buffer_region);
@@ -474,7 +567,8 @@ draw_view_source_clipped(struct weston_view *view,
 
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
+	  pixman_region32_t *damage, /* in global coordinates */
+	  struct pixman_band *band)
 {
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
 	/* repaint bounding region in global coordinates: */
@@ -500,7 +594,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(ev, output, &repaint);
+		draw_view_translated(ev, output, &repaint, band);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -509,48 +603,308 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(ev, output, &repaint);
+		draw_view_source_clipped(ev, output, &repaint, band);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct weston_output *output, pixman_region32_t *damage,
+		 struct pixman_band *band)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **views = output->view_list.data;
+	size_t i = output->view_list.size / sizeof *views;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	/* Bottom-most first; views not on this output are not listed. */
+	while (i--)
+		if (views[i]->plane == &compositor->primary_plane)
+			draw_view(views[i], output, damage, band);
 }
 
 static void
-copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
+copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region,
+		  struct pixman_band *band)
 {
-	struct pixman_output_state *po = get_output_state(output);
 	pixman_region32_t output_region;
 
 	pixman_region32_init(&output_region);
 	pixman_region32_copy(&output_region, region);
 
 	region_global_to_output(output, &output_region);
+	if (band->clip)
+		pixman_region32_intersect(&output_region, &output_region,
+					  band->clip);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+	pixman_image_set_clip_region32 (band->hw_buffer, &output_region);
 	pixman_region32_fini(&output_region);
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
+				 band->target, /* src */
 				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
+				 band->hw_buffer, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+				 pixman_image_get_width (band->hw_buffer), /* width */
+				 pixman_image_get_height (band->hw_buffer) /* height */);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	pixman_image_set_clip_region32 (band->hw_buffer, NULL);
+}
+
+static pixman_image_t *
+create_debug_color(void)
+{
+	pixman_color_t red = {
+		0x3fff, 0x0000, 0x0000, 0x3fff
+	};
+
+	return pixman_image_create_solid_fill(&red);
+}
+
+static void
+render_band(struct pixman_worker_pool *pool, int index)
+{
+	struct weston_output *output = pool->output;
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_band band = { NULL };
+	pixman_region32_t clip;
+	pixman_box32_t box;
+
+	box.x1 = 0;
+	box.y1 = index * pool->band_height;
+	box.x2 = po->width;
+	box.y2 = box.y1 + pool->band_height;
+
+	if (pixman_region32_contains_rectangle(&pool->damage_output, &box) ==
+	    PIXMAN_REGION_OUT)
+		return;
+
+	pixman_region32_init_rect(&clip, box.x1, box.y1,
+				  box.x2 - box.x1, box.y2 - box.y1);
+	band.clip = &clip;
+	if (po->shadow_image) {
+		band.target = wrap_image(po->shadow_image, NULL);
+		band.hw_buffer = wrap_image(po->hw_buffer, NULL);
+	} else {
+		band.target = wrap_image(po->hw_buffer, NULL);
+	}
+	if (pr->repaint_debug)
+		band.debug_color = create_debug_color();
+
+	if (band.target && (band.hw_buffer || !po->shadow_image)) {
+		repaint_surfaces(output, pool->damage, &band);
+		if (band.hw_buffer)
+			copy_to_hw_buffer(output, pool->damage, &band);
+	}
+
+	if (band.target)
+		pixman_image_unref(band.target);
+	if (band.hw_buffer)
+		pixman_image_unref(band.hw_buffer);
+	if (band.debug_color)
+		pixman_image_unref(band.debug_color);
+	pixman_region32_fini(&clip);
+}
+
+/* Run by the main thread and all workers until no bands are left. */
+static void
+render_bands(struct pixman_worker_pool *pool)
+{
+	int index;
+
+	while ((index = __atomic_fetch_add(&pool->next_band, 1,
+					   __ATOMIC_RELAXED)) < pool->n_bands)
+		render_band(pool, index);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pixman_worker_pool *pool = data;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		render_bands(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/* Split the output into horizontal bands and render them on all
+ * threads of the pool. Every pixel is computed exactly as when
+ * rendering serially, only the clip differs. */
+static void
+repaint_output_parallel(struct pixman_worker_pool *pool,
+			struct weston_output *output,
+			pixman_region32_t *damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view **views = output->view_list.data;
+	size_t i = output->view_list.size / sizeof *views;
+	int height = po->height;
+
+	/* Surface state is created on demand, which must not happen
+	 * concurrently. */
+	while (i--)
+		if (views[i]->plane == &compositor->primary_plane)
+			get_surface_state(views[i]->surface);
+
+	/* More bands than threads, as damage is rarely evenly spread. */
+	pool->n_bands = (pool->n_threads + 1) * 4;
+	pool->band_height = (height + pool->n_bands - 1) / pool->n_bands;
+	pool->next_band = 0;
+	pool->output = output;
+	pool->damage = damage;
+	pixman_region32_copy(&pool->damage_output, damage);
+	region_global_to_output(output, &pool->damage_output);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->busy = pool->n_threads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	render_bands(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool->output = NULL;
+	pool->damage = NULL;
+}
+
+static void
+cursor_restore(struct pixman_output_state *po)
+{
+	pixman_box32_t *box = &po->cursor_box;
+	pixman_image_t *src = po->cursor_save;
+	int src_x = 0, src_y = 0;
+
+	if (box->x1 >= box->x2 || box->y1 >= box->y2)
+		return;
+
+	/* The shadow never has the cursor in it. */
+	if (po->shadow_image) {
+		src = po->shadow_image;
+		src_x = box->x1;
+		src_y = box->y1;
+	}
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 src, /* src */
+				 NULL /* mask */,
+				 po->hw_buffer, /* dest */
+				 src_x, src_y, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 box->x1, box->y1, /* dest_x, dest_y */
+				 box->x2 - box->x1, /* width */
+				 box->y2 - box->y1 /* height */);
+
+	box->x1 = box->x2 = box->y1 = box->y2 = 0;
+}
+
+static bool
+cursor_save_under(struct pixman_output_state *po, pixman_box32_t *box)
+{
+	int width = box->x2 - box->x1;
+	int height = box->y2 - box->y1;
+
+	/* Reading back the hardware buffer can be slow, cursor_restore()
+	 * copies from the shadow instead. */
+	if (po->shadow_image) {
+		po->cursor_box = *box;
+		return true;
+	}
+
+	if (po->cursor_save &&
+	    (pixman_image_get_width(po->cursor_save) < width ||
+	     pixman_image_get_height(po->cursor_save) < height ||
+	     pixman_image_get_format(po->cursor_save) !=
+	     pixman_image_get_format(po->hw_buffer))) {
+		pixman_image_unref(po->cursor_save);
+		po->cursor_save = NULL;
+	}
+
+	if (!po->cursor_save)
+		po->cursor_save =
+			pixman_image_create_bits(pixman_image_get_format(po->hw_buffer),
+						 width, height, NULL, 0);
+	if (!po->cursor_save)
+		return false;
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 po->hw_buffer, /* src */
+				 NULL /* mask */,
+				 po->cursor_save, /* dest */
+				 box->x1, box->y1, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 width, height);
+	po->cursor_box = *box;
+
+	return true;
+}
+
+/* Draws the software cursor onto the hardware buffer, and adds the
+ * areas it left and entered to damage if it moved or changed. */
+static void
+cursor_draw(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_view *ev = po->cursor_view;
+	struct pixman_band band = {
+		.target = po->hw_buffer,
+		.clip = NULL,
+	};
+	pixman_region32_t region;
+	pixman_box32_t box;
+
+	pixman_region32_init(&region);
+	if (ev)
+		pixman_region32_copy(&region, &ev->transform.boundingbox);
+
+	if (pixman_region32_not_empty(&po->cursor_plane.damage) ||
+	    !pixman_region32_equal(&region, &po->cursor_region)) {
+		pixman_region32_union(damage, damage, &po->cursor_region);
+		pixman_region32_union(damage, damage, &region);
+		pixman_region32_copy(&po->cursor_region, &region);
+	}
+	pixman_region32_clear(&po->cursor_plane.damage);
+
+	if (!ev)
+		goto out;
+
+	region_global_to_output(output, &region);
+	pixman_region32_intersect_rect(&region, &region,
+				       0, 0, po->width, po->height);
+	if (!pixman_region32_not_empty(&region))
+		goto out;
+
+	box = *pixman_region32_extents(&region);
+	if (cursor_save_under(po, &box))
+		draw_view(ev, output, &po->cursor_region, &band);
+
+out:
+	pixman_region32_fini(&region);
 }
 
 static void
@@ -558,23 +912,207 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_band band = {
+		.debug_color = pr->repaint_debug ? pr->debug_color : NULL,
+		.clip = NULL,
+	};
+	pixman_region32_t full_damage;
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	/* Only damaged areas get repainted and copied out, but a shadow
+	 * that replaces direct rendering has none of the earlier frames
+	 * in it yet. */
+	pixman_region32_init(&full_damage);
+	if (po->shadow_image && po->shadow_new) {
+		pixman_region32_copy(&full_damage, &output->region);
+		output_damage = &full_damage;
+	}
+	po->shadow_new = false;
+
+	/* Views are painted onto what was below the cursor. */
+	cursor_restore(po);
+
+	if (po->shadow_image) {
+		band.target = po->shadow_image;
+		band.hw_buffer = po->hw_buffer;
+	} else {
+		band.target = po->hw_buffer;
+	}
+
+	if (pr->pool) {
+		repaint_output_parallel(pr->pool, output, output_damage);
+	} else {
+		repaint_surfaces(output, output_damage, &band);
+		if (band.hw_buffer)
+			copy_to_hw_buffer(output, output_damage, &band);
+	}
+
+	if (po->flags & PIXMAN_RENDERER_OUTPUT_SW_CURSOR)
+		cursor_draw(output, output_damage);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
+	pixman_region32_fini(&full_damage);
 	wl_signal_emit(&output->frame_signal, output);
 
 	/* Actual flip should be done by caller */
 }
 
+/* Bytes from the start of a 4:2:0 buffer up to the last one that
+ * convert_yuv_buffer() reads, with its plane layout. */
+static uint64_t
+yuv_buffer_size(uint32_t format, int32_t width, int32_t height,
+		int32_t stride)
+{
+	uint64_t luma = (uint64_t) stride * height;
+	uint64_t rows = (height + 1) / 2, cols = (width + 1) / 2;
+	uint64_t uv_stride = stride / 2;
+	uint64_t u_end, v_end;
+
+	if (format == WL_SHM_FORMAT_NV12)
+		return luma + (uint64_t) stride * (rows - 1) + 2 * cols;
+
+	u_end = luma + uv_stride * (rows - 1) + cols;
+	v_end = luma + uv_stride * (height / 2) + uv_stride * (rows - 1) + cols;
+
+	return MAX(u_end, v_end);
+}
+
+/* libwayland only guarantees stride * height bytes behind a buffer and
+ * does not tell the pool size, so make sure the chroma planes at least
+ * lie in mapped memory before reading them. */
+static bool
+yuv_buffer_is_mapped(struct wl_shm_buffer *shm_buffer)
+{
+	unsigned char vec[256];
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t) wl_shm_buffer_get_data(shm_buffer);
+	uint64_t size = yuv_buffer_size(wl_shm_buffer_get_format(shm_buffer),
+					wl_shm_buffer_get_width(shm_buffer),
+					wl_shm_buffer_get_height(shm_buffer),
+					wl_shm_buffer_get_stride(shm_buffer));
+	uintptr_t end;
+	size_t n;
+
+	if (size > UINTPTR_MAX - start)
+		return false;
+
+	end = start + size;
+	start &= ~(page - 1);
+	for (; start < end; start += n * page) {
+		n = MIN((end - start + page - 1) / page, sizeof vec);
+		if (mincore((void *) start, n * page, vec) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+convert_yuv_buffer(struct pixman_surface_state *ps,
+		   struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	int stride = wl_shm_buffer_get_stride(shm_buffer);
+	struct yuv_planes planes;
+	pixman_box32_t *rects;
+	pixman_box32_t r;
+	uint8_t *data;
+	int i, n;
+
+	data = wl_shm_buffer_get_data(shm_buffer);
+	planes.y = data;
+	planes.y_stride = stride;
+	planes.u = data + stride * buffer->height;
+
+	/* Plane layout as in the GL renderer. */
+	if (wl_shm_buffer_get_format(shm_buffer) == WL_SHM_FORMAT_NV12) {
+		planes.v = planes.u + 1;
+		planes.uv_stride = stride;
+		planes.uv_step = 2;
+	} else {
+		planes.v = planes.u + (stride / 2) * (buffer->height / 2);
+		planes.uv_stride = stride / 2;
+		planes.uv_step = 1;
+	}
+
+	if (ps->convert_full) {
+		r.x1 = 0;
+		r.y1 = 0;
+		r.x2 = buffer->width;
+		r.y2 = buffer->height;
+		rects = &r;
+		n = 1;
+	} else {
+		rects = pixman_region32_rectangles(&ps->convert_damage, &n);
+	}
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (i = 0; i < n; i++) {
+		if (ps->convert_full)
+			r = rects[i];
+		else
+			r = weston_surface_to_buffer_rect(ps->surface,
+							  rects[i]);
+
+		r.x1 = MAX(r.x1, 0);
+		r.y1 = MAX(r.y1, 0);
+		r.x2 = MIN(r.x2, buffer->width);
+		r.y2 = MIN(r.y2, buffer->height);
+		if (r.x1 >= r.x2 || r.y1 >= r.y2)
+			continue;
+
+		yuv_to_xrgb8888(pixman_image_get_data(ps->converted),
+				pixman_image_get_stride(ps->converted),
+				&planes, r.x1, r.y1, r.x2, r.y2);
+	}
+	wl_shm_buffer_end_access(shm_buffer);
+}
+
 static void
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	struct weston_buffer *buffer = ps->buffer_ref.buffer;
+	struct weston_view *view;
+	bool image_used = false;
+
+	/* Other buffers are composited straight from client memory. */
+	if (!ps->converted)
+		return;
+
+	pixman_region32_union(&ps->convert_damage,
+			      &ps->convert_damage, &surface->damage);
+
+	if (!buffer)
+		return;
+
+	/* Like texture uploads in the GL renderer, conversion waits until
+	 * the surface is shown again, keeping the buffer referenced. */
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (view->plane == &surface->compositor->primary_plane &&
+		    !view->occluded) {
+			image_used = true;
+			break;
+		}
+	}
+	if (!image_used)
+		return;
+
+	if (ps->convert_full || pixman_region32_not_empty(&ps->convert_damage))
+		convert_yuv_buffer(ps, buffer);
+
+	pixman_region32_clear(&ps->convert_damage);
+	ps->convert_full = false;
+
+	/* The converted image is all that is needed from now on. */
+	if (ps->buffer_destroy_listener.notify) {
+		wl_list_remove(&ps->buffer_destroy_listener.link);
+		ps->buffer_destroy_listener.notify = NULL;
+	}
+	weston_buffer_reference(&ps->buffer_ref, NULL);
 }
 
 static void
@@ -599,6 +1137,7 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	struct pixman_surface_state *ps = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
 	pixman_format_code_t pixman_format;
+	bool convert = false;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
 
@@ -612,8 +1151,13 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		ps->image = NULL;
 	}
 
-	if (!buffer)
+	if (!buffer) {
+		if (ps->converted) {
+			pixman_image_unref(ps->converted);
+			ps->converted = NULL;
+		}
 		return;
+	}
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
@@ -633,6 +1177,23 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	case WL_SHM_FORMAT_RGB565:
 		pixman_format = PIXMAN_r5g6b5;
 		break;
+	case WL_SHM_FORMAT_XRGB2101010:
+		pixman_format = PIXMAN_x2r10g10b10;
+		break;
+	case WL_SHM_FORMAT_ARGB2101010:
+		pixman_format = PIXMAN_a2r10g10b10;
+		break;
+	case WL_SHM_FORMAT_XBGR2101010:
+		pixman_format = PIXMAN_x2b10g10r10;
+		break;
+	case WL_SHM_FORMAT_ABGR2101010:
+		pixman_format = PIXMAN_a2b10g10r10;
+		break;
+	case WL_SHM_FORMAT_YUV420:
+	case WL_SHM_FORMAT_NV12:
+		pixman_format = PIXMAN_x8r8g8b8;
+		convert = true;
+		break;
 	default:
 		weston_log("Unsupported SHM buffer format\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
@@ -640,14 +1201,46 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	break;
 	}
 
+	if (convert && !yuv_buffer_is_mapped(shm_buffer)) {
+		wl_resource_post_error(buffer->resource, 0,
+				       "buffer too small for its YUV planes");
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
+
 	buffer->shm_buffer = shm_buffer;
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
-	ps->image = pixman_image_create_bits(pixman_format,
-		buffer->width, buffer->height,
-		wl_shm_buffer_get_data(shm_buffer),
-		wl_shm_buffer_get_stride(shm_buffer));
+	if (ps->converted &&
+	    (!convert ||
+	     pixman_image_get_width(ps->converted) != buffer->width ||
+	     pixman_image_get_height(ps->converted) != buffer->height)) {
+		pixman_image_unref(ps->converted);
+		ps->converted = NULL;
+	}
+
+	if (convert && !ps->converted) {
+		ps->converted = pixman_image_create_bits(pixman_format,
+							 buffer->width,
+							 buffer->height,
+							 NULL, 0);
+		ps->convert_full = true;
+	}
+
+	if (convert)
+		ps->image = ps->converted ? pixman_image_ref(ps->converted) : NULL;
+	else
+		ps->image = pixman_image_create_bits(pixman_format,
+			buffer->width, buffer->height,
+			wl_shm_buffer_get_data(shm_buffer),
+			wl_shm_buffer_get_stride(shm_buffer));
+
+	if (!ps->image) {
+		weston_log("Failed to create image for SHM buffer\n");
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
 
 	ps->buffer_destroy_listener.notify =
 		buffer_state_handle_buffer_destroy;
@@ -671,6 +1264,11 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	if (ps->converted) {
+		pixman_image_unref(ps->converted);
+		ps->converted = NULL;
+	}
+	pixman_region32_fini(&ps->convert_damage);
 	weston_buffer_reference(&ps->buffer_ref, NULL);
 	free(ps);
 }
@@ -710,6 +1308,7 @@ pixman_renderer_create_surface(struct weston_surface *surface)
 	surface->renderer_state = ps;
 
 	ps->surface = surface;
+	pixman_region32_init(&ps->convert_damage);
 
 	ps->surface_destroy_listener.notify =
 		surface_state_handle_surface_destroy;
@@ -735,6 +1334,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
+	ps->color = color;
 
 	if (ps->image) {
 		pixman_image_unref(ps->image);
@@ -744,11 +1344,85 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
+static void
+worker_pool_destroy(struct pixman_worker_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pixman_region32_fini(&pool->damage_output);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+/* The main thread renders too, so n_threads - 1 workers are started. */
+static struct pixman_worker_pool *
+worker_pool_create(int n_threads)
+{
+	struct pixman_worker_pool *pool;
+	sigset_t signals, old_signals;
+	int i;
+
+	pool = zalloc(sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->threads = calloc(n_threads - 1, sizeof *pool->threads);
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	pixman_region32_init(&pool->damage_output);
+
+	/* Leave signal handling to the main thread's event loop, but keep
+	 * SIGBUS deliverable for wl_shm_buffer_begin_access(). */
+	sigfillset(&signals);
+	sigdelset(&signals, SIGBUS);
+	sigdelset(&signals, SIGSEGV);
+	sigdelset(&signals, SIGFPE);
+	sigdelset(&signals, SIGILL);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+	for (i = 0; i < n_threads - 1; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   worker_thread, pool) != 0)
+			break;
+		pool->n_threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	if (pool->n_threads == 0) {
+		weston_log("Pixman renderer failed to start threads.\n");
+		worker_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
 	struct pixman_renderer *pr = get_renderer(ec);
 
+	if (pr->pool)
+		worker_pool_destroy(pr->pool);
+
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
 	free(pr);
@@ -813,11 +1487,7 @@ debug_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	pr->repaint_debug ^= 1;
 
 	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
+		pr->debug_color = create_debug_color();
 	} else {
 		pixman_image_unref(pr->debug_color);
 		weston_compositor_damage_all(ec);
@@ -855,56 +1525,217 @@ pixman_renderer_init(struct weston_compositor *ec)
 						    debug_binding, ec);
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_XRGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_ARGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_XBGR2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_ABGR2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUV420);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_NV12);
 
 	wl_signal_init(&renderer->destroy_signal);
 
+	if (ec->pixman_threads > 1) {
+		renderer->pool = worker_pool_create(ec->pixman_threads);
+		if (renderer->pool)
+			weston_log("Pixman renderer using %d threads.\n",
+				   renderer->pool->n_threads + 1);
+	}
+
 	return 0;
 }
 
+static int
+output_create_shadow(struct pixman_output_state *po)
+{
+	po->shadow_buffer = calloc(po->width * po->height, 4);
+	if (!po->shadow_buffer)
+		return -1;
+
+	po->shadow_image =
+		pixman_image_create_bits(PIXMAN_x8r8g8b8,
+					 po->width, po->height,
+					 po->shadow_buffer, po->width * 4);
+	if (!po->shadow_image) {
+		free(po->shadow_buffer);
+		po->shadow_buffer = NULL;
+		return -1;
+	}
+
+	po->shadow_new = true;
+
+	return 0;
+}
+
+static void
+output_destroy_shadow(struct pixman_output_state *po)
+{
+	if (po->shadow_image)
+		pixman_image_unref(po->shadow_image);
+	free(po->shadow_buffer);
+
+	po->shadow_buffer = NULL;
+	po->shadow_image = NULL;
+}
+
+/* Views can be drawn straight into the hardware buffer if the backend
+ * allows it, and the buffer looks exactly like the shadow would. Alpha
+ * formats are excluded, as the shadow copy makes the output opaque. */
+static bool
+output_can_render_direct(struct pixman_output_state *po,
+			 pixman_image_t *buffer)
+{
+	if (po->flags & PIXMAN_RENDERER_OUTPUT_USE_SHADOW)
+		return false;
+
+	return pixman_image_get_format(buffer) == PIXMAN_x8r8g8b8 &&
+	       pixman_image_get_width(buffer) == po->width &&
+	       pixman_image_get_height(buffer) == po->height;
+}
+
 WL_EXPORT void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	if (po->hw_buffer != buffer)
+		cursor_restore(po);
+
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 	po->hw_buffer = buffer;
 
-	if (po->hw_buffer) {
-		output->compositor->read_format = pixman_image_get_format(po->hw_buffer);
-		pixman_image_ref(po->hw_buffer);
+	if (!po->hw_buffer)
+		return;
+
+	output->compositor->read_format = pixman_image_get_format(po->hw_buffer);
+	pixman_image_ref(po->hw_buffer);
+
+	if (output_can_render_direct(po, po->hw_buffer)) {
+		output_destroy_shadow(po);
+	} else if (!po->shadow_image && output_create_shadow(po) < 0) {
+		weston_log("Pixman renderer failed to allocate a shadow "
+			   "buffer, output %s will not be repainted.\n",
+			   output->name);
+		pixman_image_unref(po->hw_buffer);
+		po->hw_buffer = NULL;
+	}
+}
+
+static bool
+view_can_use_cursor_plane(struct weston_view *ev, struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+
+	if (ev->layer_link.layer != &ec->cursor_layer)
+		return false;
+
+	if (!weston_output_mask_is_only(&ev->output_mask, output->id))
+		return false;
+
+	/* Only views blended with OVER, the save-under copy is opaque. */
+	if (pixman_region32_not_empty(&ev->transform.opaque))
+		return false;
+
+	/* Converted images are only updated for primary plane views. */
+	return ps->image && !ps->converted;
+}
+
+/** Put the software cursor of an output on its own plane
+ *
+ * \param output The output, created with PIXMAN_RENDERER_OUTPUT_SW_CURSOR.
+ *
+ * To be used as the assign_planes hook of outputs rendered with pixman.
+ * The topmost cursor view of the output goes on the cursor plane, unless
+ * other views are stacked above it, everything else on the output goes on
+ * the primary plane. Views not on the output are not touched. Moving the
+ * cursor then no longer damages the views below it.
+ */
+WL_EXPORT void
+pixman_renderer_output_assign_planes(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_view *ev;
+	pixman_region32_t overlap;
+	bool use_cursor_plane;
+
+	po->cursor_view = NULL;
+	pixman_region32_init(&overlap);
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		/* Leave views of other outputs alone, their own
+		 * assign_planes pass places them. */
+		if (!weston_output_mask_test(&ev->output_mask, output->id))
+			continue;
+
+		use_cursor_plane =
+			(po->flags & PIXMAN_RENDERER_OUTPUT_SW_CURSOR) &&
+			!po->cursor_view &&
+			view_can_use_cursor_plane(ev, output);
+
+		if (use_cursor_plane) {
+			pixman_region32_t above;
+
+			pixman_region32_init(&above);
+			pixman_region32_intersect(&above, &overlap,
+						  &ev->transform.boundingbox);
+			use_cursor_plane = !pixman_region32_not_empty(&above);
+			pixman_region32_fini(&above);
+		}
+
+		if (use_cursor_plane) {
+			weston_view_move_to_plane(ev, &po->cursor_plane);
+			po->cursor_view = ev;
+		} else {
+			weston_view_move_to_plane(ev, &ec->primary_plane);
+		}
+
+		ev->psf_flags = 0;
+		pixman_region32_union(&overlap, &overlap,
+				      &ev->transform.boundingbox);
 	}
+
+	pixman_region32_fini(&overlap);
 }
 
+/** Create the pixman renderer state of an output
+ *
+ * \param output The output.
+ * \param flags A bitmask of enum pixman_renderer_output_flags.
+ * \return 0 on success, -1 on failure.
+ *
+ * Unless PIXMAN_RENDERER_OUTPUT_USE_SHADOW is given, the renderer may
+ * draw directly into the buffers passed to
+ * pixman_renderer_output_set_buffer(), so they must keep their contents
+ * from one frame to the next.
+ */
 WL_EXPORT int
-pixman_renderer_output_create(struct weston_output *output)
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags)
 {
 	struct pixman_output_state *po;
-	int w, h;
 
 	po = zalloc(sizeof *po);
 	if (po == NULL)
 		return -1;
 
-	/* set shadow image transformation */
-	w = output->current_mode->width;
-	h = output->current_mode->height;
+	po->flags = flags;
+	po->width = output->current_mode->width;
+	po->height = output->current_mode->height;
 
-	po->shadow_buffer = malloc(w * h * 4);
-
-	if (!po->shadow_buffer) {
+	/* Without a buffer yet, decide in set_buffer whether direct
+	 * rendering is possible. */
+	if ((flags & PIXMAN_RENDERER_OUTPUT_USE_SHADOW) &&
+	    output_create_shadow(po) < 0) {
 		free(po);
 		return -1;
 	}
 
-	po->shadow_image =
-		pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h,
-					 po->shadow_buffer, w * 4);
-
-	if (!po->shadow_image) {
-		free(po->shadow_buffer);
-		free(po);
-		return -1;
+	pixman_region32_init(&po->cursor_region);
+	if (flags & PIXMAN_RENDERER_OUTPUT_SW_CURSOR) {
+		weston_plane_init(&po->cursor_plane, output->compositor, 0, 0);
+		weston_compositor_stack_plane(output->compositor,
+					      &po->cursor_plane, NULL);
 	}
 
 	output->renderer_state = po;
@@ -917,15 +1748,17 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
-	pixman_image_unref(po->shadow_image);
+	if (po->flags & PIXMAN_RENDERER_OUTPUT_SW_CURSOR)
+		weston_plane_release(&po->cursor_plane);
+	pixman_region32_fini(&po->cursor_region);
+	if (po->cursor_save)
+		pixman_image_unref(po->cursor_save);
+
+	output_destroy_shadow(po);
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 
-	free(po->shadow_buffer);
-
-	po->shadow_buffer = NULL;
-	po->shadow_image = NULL;
 	po->hw_buffer = NULL;
 
 	free(po);
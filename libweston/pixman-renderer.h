@@ -30,11 +30,25 @@
 int
 pixman_renderer_init(struct weston_compositor *ec);
 
+enum pixman_renderer_output_flags {
+	/* Render into a shadow image in system memory and copy the damage
+	 * to the hardware buffer, for buffers that are slow to read from
+	 * or do not keep their contents. */
+	PIXMAN_RENDERER_OUTPUT_USE_SHADOW = (1 << 0),
+	/* Keep the cursor on a plane of its own and draw it last, saving
+	 * the pixels below it. Requires pixman_renderer_output_assign_planes
+	 * as the assign_planes hook of the output. */
+	PIXMAN_RENDERER_OUTPUT_SW_CURSOR = (1 << 1),
+};
+
 int
-pixman_renderer_output_create(struct weston_output *output);
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags);
 
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
 
 void
 pixman_renderer_output_destroy(struct weston_output *output);
+
+void
+pixman_renderer_output_assign_planes(struct weston_output *output);
@@ -32,81 +32,312 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/uio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "compositor.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 
 #include "wcap/wcap-decode.h"
+#include "wcap/wcap-rle.h"
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
+	struct wl_listener buffer_destroy_listener;
 	struct weston_buffer *buffer;
 	weston_screenshooter_done_func_t done;
 	void *data;
+
+	/* Output contents being read back */
+	struct weston_compositor *compositor;
+	uint8_t *pixels;
+	bool scratch;
+	int32_t width, height;
+	bool yflip, swap_rb;
+	bool copied;
+	struct timespec start, read_end, copy_end;
 };
 
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_row_swap_RB(void *vdst, const void *vsrc, int bytes)
 {
-	uint8_t *end;
+	uint32_t *dst = vdst;
+	const uint32_t *src = vsrc;
+	uint32_t *end = dst + bytes / 4;
+
+#ifdef __SSE2__
+	const __m128i ag = _mm_set1_epi32(0xff00ff00);
+	const __m128i rb = _mm_set1_epi32(0x00ff00ff);
+	__m128i pixels, t;
+
+	/* Works in place, each group is loaded before it is stored. */
+	while (dst + 4 <= end) {
+		pixels = _mm_loadu_si128((const __m128i *) src);
+		t = _mm_and_si128(pixels, rb);
+		t = _mm_or_si128(_mm_slli_epi32(t, 16), _mm_srli_epi32(t, 16));
+		pixels = _mm_or_si128(_mm_and_si128(pixels, ag), t);
+		_mm_storeu_si128((__m128i *) dst, pixels);
+		dst += 4;
+		src += 4;
+	}
+#endif
 
-	end = dst + height * stride;
 	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
+		uint32_t v = *src++;
+		/*                    A R G B */
+		uint32_t tmp = v & 0xff00ff00;
+		tmp |= (v >> 16) & 0x000000ff;
+		tmp |= (v << 16) & 0x00ff0000;
+		*dst++ = tmp;
 	}
 }
 
 static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_row(uint8_t *dst, const uint8_t *src, int bytes, bool swap_rb)
 {
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
+	if (swap_rb)
+		copy_row_swap_RB(dst, src, bytes);
+	else
+		memcpy(dst, src, bytes);
 }
 
+/* Copies read back pixels into the client buffer, flipping them when
+ * the renderer reads bottom to top. */
 static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
+copy_pixels(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+	    int width, int height, bool yflip, bool swap_rb)
 {
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
+	int y;
 
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
+	if (yflip) {
+		src += src_stride * (height - 1);
+		src_stride = -src_stride;
+	}
+
+	for (y = 0; y < height; y++) {
+		copy_row(dst, src, width * 4, swap_rb);
+		dst += dst_stride;
+		src += src_stride;
 	}
 }
 
+/* The same for pixels read back into the client buffer itself */
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+fixup_pixels(uint8_t *pixels, int stride, int width, int height,
+	     bool yflip, bool swap_rb)
 {
-	uint8_t *end;
+	uint8_t tmp[1024], *top, *bottom;
+	int x, n, bytes = width * 4;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	if (!yflip) {
+		if (swap_rb)
+			copy_pixels(pixels, stride, pixels, stride,
+				    width, height, false, true);
+		return;
+	}
+
+	top = pixels;
+	bottom = pixels + stride * (height - 1);
+	for (; top < bottom; top += stride, bottom -= stride) {
+		for (x = 0; x < bytes; x += n) {
+			n = MIN(bytes - x, (int) sizeof tmp);
+			memcpy(tmp, top + x, n);
+			copy_row(top + x, bottom + x, n, swap_rb);
+			copy_row(bottom + x, tmp, n, swap_rb);
+		}
+	}
+
+	if (top == bottom && swap_rb)
+		copy_row_swap_RB(top, top, bytes);
+}
+
+/* Returns whether red and blue need to be swapped to get the
+ * WL_SHM_FORMAT_ARGB8888 the client buffer has, or -1 if the read back
+ * format cannot be converted. */
+static int
+read_format_swaps_rb(pixman_format_code_t format)
+{
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		return 0;
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_a8b8g8r8:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+static double
+elapsed_ms(const struct timespec *begin, const struct timespec *end)
+{
+	struct timespec d;
+
+	timespec_sub(&d, end, begin);
+	return timespec_to_nsec(&d) / 1e6;
+}
+
+/* One buffer is kept around for screenshots, further concurrent ones
+ * get their own. */
+static uint8_t *
+screenshooter_get_scratch(struct weston_compositor *compositor,
+			  size_t size, bool *scratch)
+{
+	*scratch = false;
+	if (compositor->screenshot_scratch_busy)
+		return malloc(size);
+
+	if (compositor->screenshot_scratch_size < size) {
+		free(compositor->screenshot_scratch);
+		compositor->screenshot_scratch_size = 0;
+		compositor->screenshot_scratch = malloc(size);
+		if (!compositor->screenshot_scratch)
+			return NULL;
+		compositor->screenshot_scratch_size = size;
 	}
+
+	compositor->screenshot_scratch_busy = true;
+	*scratch = true;
+
+	return compositor->screenshot_scratch;
 }
 
 static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_put_scratch(struct weston_compositor *compositor,
+			  uint8_t *pixels, bool scratch)
 {
-	uint8_t *end;
+	if (scratch)
+		compositor->screenshot_scratch_busy = false;
+	else
+		free(pixels);
+}
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
+static void
+screenshooter_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
+
+	wl_list_remove(&listener->link);
+	l->buffer = NULL;
+}
+
+/* Converts the read back pixels into the client buffer. Renderers that
+ * read back asynchronously call this straight with their own mapping of
+ * the pixels, otherwise it copies from the scratch buffer. */
+static void
+screenshooter_copy_pixels(void *data, const void *pixels)
+{
+	struct screenshooter_frame_listener *l = data;
+	struct wl_shm_buffer *shm_buffer;
+
+	/* Destroyed while being read back, reported once done. */
+	if (!l->buffer)
+		return;
+
+	shm_buffer = l->buffer->shm_buffer;
+
+	clock_gettime(CLOCK_MONOTONIC, &l->read_end);
+	wl_shm_buffer_begin_access(shm_buffer);
+	copy_pixels(wl_shm_buffer_get_data(shm_buffer),
+		    wl_shm_buffer_get_stride(shm_buffer),
+		    pixels, l->width * 4, l->width, l->height,
+		    l->yflip, l->swap_rb);
+	wl_shm_buffer_end_access(shm_buffer);
+	clock_gettime(CLOCK_MONOTONIC, &l->copy_end);
+
+	l->copied = true;
+}
+
+static void
+screenshooter_read_done(void *data, bool success)
+{
+	struct screenshooter_frame_listener *l = data;
+
+	if (!l->buffer) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		goto out;
 	}
+
+	wl_list_remove(&l->buffer_destroy_listener.link);
+
+	if (!success) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		goto out;
+	}
+
+	if (!l->copied)
+		screenshooter_copy_pixels(l, l->pixels);
+
+	weston_log("screenshot %dx%d: read back in %.2f ms, "
+		   "copied in %.2f ms\n", l->width, l->height,
+		   elapsed_ms(&l->start, &l->read_end),
+		   elapsed_ms(&l->read_end, &l->copy_end));
+
+	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+out:
+	screenshooter_put_scratch(l->compositor, l->pixels, l->scratch);
+	free(l);
+}
+
+/* Renderers that may complete the read back later hand the pixels to
+ * screenshooter_copy_pixels() once they arrive, as the client buffer can
+ * go away meanwhile.  The others write straight into the client buffer if
+ * its rows are packed like the read back pixels, or into a scratch
+ * buffer. */
+static bool
+screenshooter_can_read_in_place(struct weston_compositor *compositor,
+				struct weston_buffer *buffer, int32_t width)
+{
+	return !compositor->renderer->read_pixels_async &&
+	       wl_shm_buffer_get_stride(buffer->shm_buffer) == width * 4;
+}
+
+static void
+screenshooter_read_in_place(struct screenshooter_frame_listener *l,
+			    struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct wl_shm_buffer *shm_buffer = l->buffer->shm_buffer;
+	struct timespec start, read_end, fixup_end;
+	uint8_t *d;
+	int ret;
+
+	d = wl_shm_buffer_get_data(shm_buffer);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	wl_shm_buffer_begin_access(shm_buffer);
+	ret = compositor->renderer->read_pixels(output,
+						compositor->read_format, d,
+						0, 0, l->width, l->height);
+	clock_gettime(CLOCK_MONOTONIC, &read_end);
+	if (ret == 0)
+		fixup_pixels(d, l->width * 4, l->width, l->height,
+			     l->yflip, l->swap_rb);
+	wl_shm_buffer_end_access(shm_buffer);
+	clock_gettime(CLOCK_MONOTONIC, &fixup_end);
+
+	wl_list_remove(&l->buffer_destroy_listener.link);
+
+	if (ret < 0) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		return;
+	}
+
+	weston_log("screenshot %dx%d: read back in place in %.2f ms, "
+		   "converted in %.2f ms\n", l->width, l->height,
+		   elapsed_ms(&start, &read_end),
+		   elapsed_ms(&read_end, &fixup_end));
+
+	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
 }
 
 static void
@@ -117,56 +348,65 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 			     struct screenshooter_frame_listener, listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	int swap_rb;
 
 	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
 
-	if (pixels == NULL) {
-		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+	if (!l->buffer) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		free(l);
 		return;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
-
-	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
+	l->compositor = compositor;
+	l->width = output->current_mode->width;
+	l->height = output->current_mode->height;
 
-	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	swap_rb = read_format_swaps_rb(compositor->read_format);
+	if (swap_rb < 0) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		free(l);
+		return;
+	}
+	l->swap_rb = swap_rb;
+	l->yflip = compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP;
 
-	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
+	if (screenshooter_can_read_in_place(compositor, l->buffer, l->width)) {
+		screenshooter_read_in_place(l, output);
+		free(l);
+		return;
+	}
 
-	switch (compositor->read_format) {
-	case PIXMAN_a8r8g8b8:
-	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
-		break;
-	case PIXMAN_x8b8g8r8:
-	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
-		break;
-	default:
-		break;
+	if (compositor->renderer->read_pixels_async) {
+		clock_gettime(CLOCK_MONOTONIC, &l->start);
+		weston_output_read_pixels_copy_async(output,
+						     compositor->read_format,
+						     0, 0,
+						     l->width, l->height,
+						     screenshooter_copy_pixels,
+						     screenshooter_read_done,
+						     l);
+		return;
 	}
 
-	wl_shm_buffer_end_access(l->buffer->shm_buffer);
+	l->pixels = screenshooter_get_scratch(compositor,
+					      (size_t) l->width * 4 * l->height,
+					      &l->scratch);
+	if (l->pixels == NULL) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+		free(l);
+		return;
+	}
 
-	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
-	free(pixels);
-	free(l);
+	/* The client buffer rows are padded, read into the scratch buffer
+	 * and copy from there. */
+	clock_gettime(CLOCK_MONOTONIC, &l->start);
+	weston_output_read_pixels_async(output, compositor->read_format,
+					l->pixels, 0, 0, l->width, l->height,
+					screenshooter_read_done, l);
 }
 
 WL_EXPORT int
@@ -191,7 +431,7 @@ weston_screenshooter_shoot(struct weston_output *output,
 		return -1;
 	}
 
-	l = malloc(sizeof *l);
+	l = zalloc(sizeof *l);
 	if (l == NULL) {
 		done(data, WESTON_SCREENSHOOTER_NO_MEMORY);
 		return -1;
@@ -200,6 +440,8 @@ weston_screenshooter_shoot(struct weston_output *output,
 	l->buffer = buffer;
 	l->done = done;
 	l->data = data;
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &l->buffer_destroy_listener);
 	l->listener.notify = screenshooter_frame_notify;
 	wl_signal_add(&output->frame_signal, &l->listener);
 	output->disable_planes++;
@@ -208,45 +450,429 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+/* Frames being read back or waiting for the encoder.  When the encoder
+ * falls this far behind, new frames are dropped instead of stalling the
+ * compositor. */
+#define RECORDER_QUEUE_LENGTH 6
+
+/* Encoded frames are collected and written out in chunks of this size. */
+#define RECORDER_BATCH_SIZE (1024 * 1024)
+
+/* Milliseconds between key frames, which capture the whole output so
+ * decoding can start there. */
+#define RECORDER_KEYFRAME_INTERVAL 5000
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
+	uint32_t *frame;
 	uint32_t *tmpbuf;
-	uint32_t total;
+	const struct wcap_rle_kernels *rle;
+	uint64_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	int width, height, do_yflip;
+
+	/* Frames still being read back, written out before closing */
+	int pending;
+	int finished;
+
+	/* Damage of dropped frames, carried over to the next captured
+	 * frame so the delta stream stays complete */
+	pixman_region32_t missed;
+	int dropped;
+
+	bool keyframe_due;
+	uint32_t keyframe_msecs;
+
+	/* The encoder thread owns frame, tmpbuf, batch, fd and total
+	 * while it runs.  The queue is protected by the mutex. */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct wl_list queue;
+	int queued;
+	bool quit;
+
+	uint8_t *batch;
+	size_t batch_len;
+	/* struct wcap_index_entry for every frame written */
+	struct wl_array index;
 };
 
+/* The damage of one repaint, encoded once all of it has been read back */
+struct weston_recorder_frame {
+	struct weston_recorder *recorder;
+	struct wl_list link;
+	uint32_t msecs;
+	bool keyframe;
+	struct wcap_rectangle_v2 *rects;
+	int nrects;
+	uint32_t *pixels;
+	int remaining;
+	bool failed;
+};
+
+static void
+weston_recorder_flush(struct weston_recorder *recorder)
+{
+	ssize_t len;
+
+	if (recorder->batch_len == 0)
+		return;
+
+	len = write(recorder->fd, recorder->batch, recorder->batch_len);
+	if (len > 0)
+		recorder->total += len;
+	recorder->batch_len = 0;
+}
+
+static void
+weston_recorder_write(struct weston_recorder *recorder,
+		      const void *data, size_t size)
+{
+	ssize_t len;
+
+	if (recorder->batch_len + size > RECORDER_BATCH_SIZE)
+		weston_recorder_flush(recorder);
+
+	if (size > RECORDER_BATCH_SIZE) {
+		len = write(recorder->fd, data, size);
+		if (len > 0)
+			recorder->total += len;
+		return;
+	}
+
+	memcpy(recorder->batch + recorder->batch_len, data, size);
+	recorder->batch_len += size;
+}
+
 static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+weston_recorder_encode_rectangle(struct weston_recorder *recorder,
+				 struct wcap_rectangle_v2 *r,
+				 uint32_t *pixels, uint32_t *p)
 {
-	int i;
+	struct wcap_rle_encoder encoder;
+	int j, width, height, stride, y_orig;
+	uint32_t *d, *s;
+
+	width = r->x2 - r->x1;
+	height = r->y2 - r->y1;
+	stride = recorder->width;
+
+	wcap_rle_encoder_init(&encoder, p);
+	for (j = 0; j < height; j++) {
+		if (recorder->do_yflip)
+			s = pixels + width * j;
+		else
+			s = pixels + width * (height - j - 1);
+		y_orig = r->y2 - j - 1;
+		d = recorder->frame + stride * y_orig + r->x1;
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
+		recorder->rle->encode_row(&encoder, s, d, width);
+	}
+
+	return wcap_rle_encoder_finish(&encoder);
+}
+
+static void
+weston_recorder_encode(struct weston_recorder *recorder,
+		       struct weston_recorder_frame *frame)
+{
+	struct wcap_rectangle_v2 *r = frame->rects;
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	uint32_t *pixels = frame->pixels;
+	uint32_t *outbuf = recorder->tmpbuf;
+	uint32_t *p, *start;
+	int i, j, n = frame->nrects, width, height;
+	size_t area;
+
+	/* Key frames are encoded against a black frame. */
+	if (frame->keyframe)
+		memset(recorder->frame, 0,
+		       recorder->width * recorder->height * 4);
+
+	/* The damage rectangles do not overlap, so all of them fit in
+	 * tmpbuf.  The run length encoding never takes more words than
+	 * there are pixels. */
+	p = outbuf;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+		area = (size_t) width * height;
+
+		start = p;
+		p = weston_recorder_encode_rectangle(recorder, &r[i],
+						     pixels, p);
+		r[i].flags = 0;
+
+		/* Noise does not compress, store it as is. */
+		if ((size_t) (p - start) >= area) {
+			for (j = 0; j < height; j++)
+				memcpy(start + j * width,
+				       recorder->frame +
+				       (r[i].y1 + j) * recorder->width +
+				       r[i].x1, width * 4);
+			p = start + area;
+			r[i].flags = WCAP_RECTANGLE_RAW;
 		}
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+		r[i].size = (p - start) * 4;
+		pixels += area;
+
+#if 0
+		fprintf(stderr,
+			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
+			width, height, r[i].x1, r[i].y1,
+			width * height * 4, (int) (p - start) * 4,
+			(float) (p - start) / (width * height),
+			(int) (recorder->total / 1024 / 1024));
+#endif
+	}
+
+	header.msecs = frame->msecs;
+	header.nrects = n;
+	header.flags = frame->keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	header.size = n * sizeof *r + (p - outbuf) * 4;
+
+	entry = wl_array_add(&recorder->index, sizeof *entry);
+	if (entry) {
+		entry->offset = recorder->total + recorder->batch_len;
+		entry->msecs = header.msecs;
+		entry->flags = header.flags;
+	}
+
+	weston_recorder_write(recorder, &header, sizeof header);
+	p = outbuf;
+	for (i = 0; i < n; i++) {
+		weston_recorder_write(recorder, &r[i], sizeof r[i]);
+		weston_recorder_write(recorder, p, r[i].size);
+		p += r[i].size / 4;
+	}
+}
+
+static void
+weston_recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_trailer trailer;
+
+	trailer.index_offset = recorder->total + recorder->batch_len;
+	trailer.count = recorder->index.size / sizeof(struct wcap_index_entry);
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	header.msecs = 0;
+	header.nrects = 0;
+	header.flags = WCAP_FRAME_INDEX;
+	header.size = recorder->index.size;
+
+	weston_recorder_write(recorder, &header, sizeof header);
+	weston_recorder_write(recorder, recorder->index.data,
+			      recorder->index.size);
+	weston_recorder_write(recorder, &trailer, sizeof trailer);
+}
+
+static void
+weston_recorder_frame_free(struct weston_recorder_frame *frame)
+{
+	free(frame->pixels);
+	free(frame->rects);
+	free(frame);
+}
+
+static void *
+weston_recorder_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_frame *frame;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (wl_list_empty(&recorder->queue) && !recorder->quit)
+			pthread_cond_wait(&recorder->cond, &recorder->mutex);
+
+		/* Everything queued before quitting is still written. */
+		if (wl_list_empty(&recorder->queue))
+			break;
+
+		frame = container_of(recorder->queue.next,
+				     struct weston_recorder_frame, link);
+		wl_list_remove(&frame->link);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		weston_recorder_encode(recorder, frame);
+		weston_recorder_frame_free(frame);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->queued--;
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	weston_recorder_write_index(recorder);
+	weston_recorder_flush(recorder);
+
+	return NULL;
+}
+
+static int
+weston_recorder_start_thread(struct weston_recorder *recorder)
+{
+	sigset_t signals, old_signals;
+	int ret;
+
+	/* Signals are handled by the main loop only. */
+	sigfillset(&signals);
+	sigdelset(&signals, SIGBUS);
+	sigdelset(&signals, SIGSEGV);
+	sigdelset(&signals, SIGFPE);
+	sigdelset(&signals, SIGILL);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+	ret = pthread_create(&recorder->thread, NULL,
+			     weston_recorder_thread, recorder);
+
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	return ret == 0 ? 0 : -1;
+}
+
+static void
+weston_recorder_free(struct weston_recorder *recorder);
+
+/* Waits for the encoder to write out all queued frames. */
+static void
+weston_recorder_close(struct weston_recorder *recorder)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->quit = true;
+	pthread_cond_signal(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	pthread_join(recorder->thread, NULL);
+
+	weston_log("recorder stopped, total file size %dM, %d frames, "
+		   "%d dropped\n", (int) (recorder->total / (1024 * 1024)),
+		   recorder->count, recorder->dropped);
+
+	weston_recorder_free(recorder);
+}
+
+static void
+weston_recorder_drop(struct weston_recorder *recorder,
+		     struct wcap_rectangle_v2 *r, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		pixman_region32_union_rect(&recorder->missed,
+					   &recorder->missed,
+					   r[i].x1, r[i].y1,
+					   r[i].x2 - r[i].x1,
+					   r[i].y2 - r[i].y1);
+	recorder->dropped++;
+}
+
+static void
+weston_recorder_frame_read_done(void *data, bool success)
+{
+	struct weston_recorder_frame *frame = data;
+	struct weston_recorder *recorder = frame->recorder;
+
+	if (!success)
+		frame->failed = true;
+
+	if (--frame->remaining > 0)
+		return;
+
+	/* Read backs complete in order, so frames are queued in order. */
+	if (frame->failed) {
+		weston_recorder_drop(recorder, frame->rects, frame->nrects);
+		if (frame->keyframe)
+			recorder->keyframe_due = true;
+		weston_recorder_frame_free(frame);
+	} else {
+		pthread_mutex_lock(&recorder->mutex);
+		wl_list_insert(recorder->queue.prev, &frame->link);
+		recorder->queued++;
+		pthread_cond_signal(&recorder->cond);
+		pthread_mutex_unlock(&recorder->mutex);
 	}
 
-	return p;
+	if (--recorder->pending == 0 && recorder->finished)
+		weston_recorder_close(recorder);
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+static int
+weston_recorder_capture(struct weston_recorder *recorder,
+			struct weston_output *output,
+			pixman_box32_t *r, int n, bool keyframe)
 {
-	unsigned char dr, dg, db;
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_recorder_frame *frame;
+	uint32_t *pixels;
+	size_t area = 0;
+	int i, width, height, y_orig, queued;
+
+	pthread_mutex_lock(&recorder->mutex);
+	queued = recorder->queued;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	if (queued + recorder->pending >= RECORDER_QUEUE_LENGTH)
+		return -1;
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	for (i = 0; i < n; i++)
+		area += (size_t) (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	frame = zalloc(sizeof *frame);
+	if (frame) {
+		frame->rects = calloc(n, sizeof *frame->rects);
+		frame->pixels = malloc(area * 4);
+	}
+	if (!frame || !frame->rects || !frame->pixels) {
+		weston_log("%s: out of memory, frame dropped\n", __func__);
+		if (frame)
+			weston_recorder_frame_free(frame);
+		return -1;
+	}
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	for (i = 0; i < n; i++) {
+		frame->rects[i].x1 = r[i].x1;
+		frame->rects[i].y1 = r[i].y1;
+		frame->rects[i].x2 = r[i].x2;
+		frame->rects[i].y2 = r[i].y2;
+	}
+	frame->nrects = n;
+	frame->msecs = output->frame_time;
+	frame->keyframe = keyframe;
+	frame->recorder = recorder;
+	/* One extra reference, so synchronous read backs cannot finish
+	 * the frame before all rectangles are queued. */
+	frame->remaining = n + 1;
+	recorder->pending++;
+
+	pixels = frame->pixels;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (recorder->do_yflip)
+			y_orig = output->current_mode->height - r[i].y2;
+		else
+			y_orig = r[i].y1;
+
+		weston_output_read_pixels_async(output,
+						compositor->read_format,
+						pixels, r[i].x1, y_orig,
+						width, height,
+						weston_recorder_frame_read_done,
+						frame);
+		pixels += width * height;
+	}
+
+	weston_recorder_frame_read_done(frame, true);
+
+	return 0;
 }
 
 static void
@@ -258,26 +884,10 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	struct weston_recorder *recorder =
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
 	pixman_box32_t *r;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	bool keyframe;
+	int n;
 
 	pixman_region32_init(&damage);
 	pixman_region32_init(&transformed_damage);
@@ -289,75 +899,38 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 				 &damage, &transformed_damage);
 	pixman_region32_fini(&damage);
 
+	pixman_region32_union(&transformed_damage, &transformed_damage,
+			      &recorder->missed);
+
+	keyframe = recorder->keyframe_due ||
+		   output->frame_time - recorder->keyframe_msecs >=
+		   RECORDER_KEYFRAME_INTERVAL;
+	if (keyframe) {
+		pixman_region32_fini(&transformed_damage);
+		pixman_region32_init_rect(&transformed_damage, 0, 0,
+					  recorder->width, recorder->height);
+	}
+
 	r = pixman_region32_rectangles(&transformed_damage, &n);
 	if (n == 0) {
 		pixman_region32_fini(&transformed_damage);
 		return;
 	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
-
-	for (i = 0; i < n; i++) {
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
-
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
-		else
-			y_orig = r[i].y1;
-
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				s = recorder->rect + width * j;
-			else
-				s = recorder->rect + width * (height - j - 1);
-			y_orig = r[i].y2 - j - 1;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
+	if (weston_recorder_capture(recorder, output, r, n, keyframe) == 0) {
+		pixman_region32_fini(&recorder->missed);
+		pixman_region32_init(&recorder->missed);
+		recorder->count++;
+		if (keyframe) {
+			recorder->keyframe_due = false;
+			recorder->keyframe_msecs = output->frame_time;
 		}
-
-		p = output_run(p, prev, run);
-
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
-
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+	} else {
+		pixman_region32_copy(&recorder->missed, &transformed_damage);
+		recorder->dropped++;
 	}
 
 	pixman_region32_fini(&transformed_damage);
-	recorder->count++;
 
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
@@ -369,8 +942,14 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
+	if (recorder->fd >= 0)
+		close(recorder->fd);
+	pthread_cond_destroy(&recorder->cond);
+	pthread_mutex_destroy(&recorder->mutex);
+	pixman_region32_fini(&recorder->missed);
+	wl_array_release(&recorder->index);
+	free(recorder->batch);
 	free(recorder->tmpbuf);
-	free(recorder->rect);
 	free(recorder->frame);
 	free(recorder);
 }
@@ -381,10 +960,7 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
 	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	struct wcap_header_v2 header;
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
@@ -392,26 +968,36 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
+	recorder->fd = -1;
+	pixman_region32_init(&recorder->missed);
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->cond, NULL);
+	wl_list_init(&recorder->queue);
+	wl_array_init(&recorder->index);
+	recorder->keyframe_due = true;
+
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	recorder->width = output->current_mode->width;
+	recorder->height = output->current_mode->height;
+	recorder->rle = wcap_rle_kernels_best();
+
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
+	recorder->tmpbuf = malloc(size);
+	recorder->batch = malloc(RECORDER_BATCH_SIZE);
 	recorder->output = output;
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) || (recorder->tmpbuf == NULL) ||
+	    (recorder->batch == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err_recorder;
-		}
-	}
-
-	header.magic = WCAP_HEADER_MAGIC;
+	header.magic = WCAP_HEADER_MAGIC_V2;
+	header.version = WCAP_VERSION;
+	header.flags = 0;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -436,7 +1022,12 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	header.width = output->current_mode->width;
 	header.height = output->current_mode->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
+	weston_recorder_write(recorder, &header, sizeof header);
+
+	if (weston_recorder_start_thread(recorder) < 0) {
+		weston_log("%s: failed to start encoder thread\n", __func__);
+		goto err_recorder;
+	}
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
@@ -454,9 +1045,14 @@ static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
-	close(recorder->fd);
 	recorder->output->disable_planes--;
-	weston_recorder_free(recorder);
+
+	/* Frames still being read back close the file when done. */
+	recorder->finished = 1;
+	if (recorder->pending > 0)
+		return;
+
+	weston_recorder_close(recorder);
 }
 
 WL_EXPORT struct weston_recorder *
@@ -480,8 +1076,8 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
-	weston_log("stopping recorder, total file size %dM, %d frames\n",
-		   recorder->total / (1024 * 1024), recorder->count);
+	weston_log("stopping recorder, %d frames captured\n",
+		   recorder->count);
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_TIMELINE_FORMAT_H
+#define WESTON_TIMELINE_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Binary timeline log format, as written by libweston/timeline.c and
+ * read by weston-timeline-convert.
+ *
+ * The file starts with a struct weston_timeline_file_header, followed
+ * by a sequence of records. Every record starts with a
+ * struct weston_timeline_record and its size is a multiple of 4 bytes.
+ * All fields are CPU endian.
+ *
+ * Point names and object descriptions are written once per log as
+ * STRING and OBJECT records, and referred to by id from POINT records.
+ */
+
+#define WESTON_TIMELINE_MAGIC 0x4c545457	/* "WTTL" */
+#define WESTON_TIMELINE_VERSION 1
+
+struct weston_timeline_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t clock_id;
+	uint32_t reserved;
+};
+
+enum weston_timeline_record_type {
+	WESTON_TIMELINE_RECORD_STRING = 1,
+	WESTON_TIMELINE_RECORD_OBJECT = 2,
+	WESTON_TIMELINE_RECORD_POINT = 3,
+};
+
+struct weston_timeline_record {
+	uint16_t type;
+	uint16_t size;	/* in bytes, including this header */
+};
+
+/* An interned timeline point name. */
+struct weston_timeline_string {
+	struct weston_timeline_record rec;
+	uint32_t id;
+	char str[];	/* NUL terminated, padded */
+};
+
+enum weston_timeline_object_type {
+	WESTON_TIMELINE_OBJECT_OUTPUT = 1,
+	WESTON_TIMELINE_OBJECT_SURFACE = 2,
+};
+
+/* Description of a weston_output or weston_surface. */
+struct weston_timeline_object_desc {
+	struct weston_timeline_record rec;
+	uint32_t id;
+	uint32_t type;
+	uint32_t main_surface;	/* surfaces only, 0 if none */
+	uint32_t has_desc;
+	char desc[];		/* NUL terminated, padded */
+};
+
+enum weston_timeline_arg_type {
+	WESTON_TIMELINE_ARG_OUTPUT = 1,		/* v[0]: object id */
+	WESTON_TIMELINE_ARG_SURFACE = 2,	/* v[0]: object id */
+	WESTON_TIMELINE_ARG_VBLANK = 3,		/* v[0..1]: sec, v[2]: nsec */
+	WESTON_TIMELINE_ARG_REPAINT_TIMING = 4,	/* v[0]: delay_us,
+						 * v[1]: predicted_us,
+						 * v[2]: frames, v[3]: missed */
+};
+
+struct weston_timeline_arg {
+	uint32_t type;
+	uint32_t v[4];
+};
+
+#define WESTON_TIMELINE_MAX_ARGS 8
+
+struct weston_timeline_point {
+	struct weston_timeline_record rec;
+	uint32_t name;
+	uint32_t tv_sec_lo;
+	uint32_t tv_sec_hi;
+	uint32_t tv_nsec;
+	uint32_t n_args;
+	struct weston_timeline_arg args[];
+};
+
+#endif /* WESTON_TIMELINE_FORMAT_H */
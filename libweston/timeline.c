@@ -27,31 +27,146 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "timeline.h"
+#include "timeline-format.h"
 #include "compositor.h"
 #include "file-util.h"
 
+/* Must be a power of two. */
+#define TIMELINE_RING_SIZE (4 * 1024 * 1024)
+#define TIMELINE_FLUSH_INTERVAL_NSEC (100 * 1000 * 1000)
+
+/*
+ * Single producer, single consumer byte ring. The compositor thread
+ * appends records and advances head, the flush thread writes them to
+ * the file and advances tail. Neither side ever waits for the other:
+ * when the ring is full, records are dropped and counted.
+ */
+struct timeline_ring {
+	char *data;
+	uint64_t head;
+	uint64_t tail;
+};
+
 struct timeline_log {
 	clock_t clk_id;
 	FILE *file;
 	unsigned series;
 	struct wl_listener compositor_destroy_listener;
+
+	struct timeline_ring ring;
+	uint64_t dropped;
+	/* const char *, a name's id is its index + 1 */
+	struct wl_array names;
+
+	pthread_t flush_thread;
+	sem_t flush_sem;
+	int flush_quit;
+	int write_error;
 };
 
 WL_EXPORT int weston_timeline_enabled_;
 static struct timeline_log timeline_ = { CLOCK_MONOTONIC, NULL, 0 };
 
+static void
+timeline_ring_flush(void)
+{
+	struct timeline_ring *ring = &timeline_.ring;
+	uint64_t head, tail;
+	size_t off, len;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = ring->tail;
+
+	while (tail != head) {
+		off = tail & (TIMELINE_RING_SIZE - 1);
+		len = head - tail;
+		if (len > TIMELINE_RING_SIZE - off)
+			len = TIMELINE_RING_SIZE - off;
+
+		if (fwrite(ring->data + off, 1, len, timeline_.file) != len)
+			timeline_.write_error = 1;
+
+		tail += len;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	fflush(timeline_.file);
+}
+
+static void *
+timeline_flush_thread(void *data)
+{
+	struct timespec deadline;
+
+	while (!__atomic_load_n(&timeline_.flush_quit, __ATOMIC_ACQUIRE)) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += TIMELINE_FLUSH_INTERVAL_NSEC;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		sem_timedwait(&timeline_.flush_sem, &deadline);
+		timeline_ring_flush();
+	}
+
+	timeline_ring_flush();
+
+	return NULL;
+}
+
+static bool
+timeline_ring_write(const void *rec, size_t size)
+{
+	struct timeline_ring *ring = &timeline_.ring;
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	size_t off, first;
+
+	if (head - tail + size > TIMELINE_RING_SIZE) {
+		timeline_.dropped++;
+		return false;
+	}
+
+	off = head & (TIMELINE_RING_SIZE - 1);
+	first = TIMELINE_RING_SIZE - off;
+	if (first > size)
+		first = size;
+
+	memcpy(ring->data + off, rec, first);
+	memcpy(ring->data, (const char *)rec + first, size - first);
+
+	__atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+
+	/* Wake up the flush thread early when crossing half full. */
+	if (head - tail <= TIMELINE_RING_SIZE / 2 &&
+	    head - tail + size > TIMELINE_RING_SIZE / 2)
+		sem_post(&timeline_.flush_sem);
+
+	return true;
+}
+
 static int
 weston_timeline_do_open(void)
 {
 	const char *prefix = "weston-timeline-";
-	const char *suffix = ".log";
+	const char *suffix = ".wtl";
 	char fname[1000];
+	struct weston_timeline_file_header header = {
+		.magic = WESTON_TIMELINE_MAGIC,
+		.version = WESTON_TIMELINE_VERSION,
+		.clock_id = timeline_.clk_id,
+	};
 
 	timeline_.file = file_create_dated(prefix, suffix,
 					   fname, sizeof(fname));
@@ -71,9 +186,40 @@ weston_timeline_do_open(void)
 		return -1;
 	}
 
+	if (fwrite(&header, sizeof header, 1, timeline_.file) != 1)
+		goto err_file;
+
+	timeline_.ring.data = malloc(TIMELINE_RING_SIZE);
+	if (!timeline_.ring.data)
+		goto err_file;
+	timeline_.ring.head = 0;
+	timeline_.ring.tail = 0;
+	timeline_.dropped = 0;
+	timeline_.write_error = 0;
+	timeline_.flush_quit = 0;
+	wl_array_init(&timeline_.names);
+
+	if (sem_init(&timeline_.flush_sem, 0, 0) < 0)
+		goto err_ring;
+
+	if (pthread_create(&timeline_.flush_thread, NULL,
+			   timeline_flush_thread, NULL) != 0)
+		goto err_sem;
+
 	weston_log("Opened timeline file '%s'\n", fname);
 
 	return 0;
+
+err_sem:
+	sem_destroy(&timeline_.flush_sem);
+err_ring:
+	free(timeline_.ring.data);
+	timeline_.ring.data = NULL;
+err_file:
+	weston_log("Cannot set up timeline log '%s'\n", fname);
+	fclose(timeline_.file);
+	timeline_.file = NULL;
+	return -1;
 }
 
 static void
@@ -111,17 +257,26 @@ weston_timeline_close(void)
 
 	wl_list_remove(&timeline_.compositor_destroy_listener.link);
 
+	__atomic_store_n(&timeline_.flush_quit, 1, __ATOMIC_RELEASE);
+	sem_post(&timeline_.flush_sem);
+	pthread_join(timeline_.flush_thread, NULL);
+	sem_destroy(&timeline_.flush_sem);
+
+	if (timeline_.dropped)
+		weston_log("Timeline ring overflowed, %" PRIu64
+			   " records dropped.\n", timeline_.dropped);
+	if (timeline_.write_error)
+		weston_log("Timeline error writing the log file.\n");
+
+	free(timeline_.ring.data);
+	timeline_.ring.data = NULL;
+	wl_array_release(&timeline_.names);
+
 	fclose(timeline_.file);
 	timeline_.file = NULL;
 	weston_log("Timeline log file closed.\n");
 }
 
-struct timeline_emit_context {
-	FILE *cur;
-	FILE *out;
-	unsigned series;
-};
-
 static unsigned
 timeline_new_id(void)
 {
@@ -133,137 +288,211 @@ timeline_new_id(void)
 	return idc;
 }
 
+/* Returns 1 if the object description needs to be written. The object
+ * is only marked as emitted by mark_series() once its record made it into
+ * the ring, so a dropped record gets written again on the next use. */
 static int
-check_series(struct timeline_emit_context *ctx,
-	     struct weston_timeline_object *to)
+check_series(struct weston_timeline_object *to)
 {
-	if (to->series == 0 || to->series != ctx->series) {
-		to->series = ctx->series;
+	if (to->series == 0 || to->series != timeline_.series) {
 		to->id = timeline_new_id();
 		return 1;
 	}
 
-	if (to->force_refresh) {
-		to->force_refresh = 0;
-		return 1;
-	}
-
-	return 0;
+	return to->force_refresh;
 }
 
 static void
-fprint_quoted_string(FILE *fp, const char *str)
+mark_series(struct weston_timeline_object *to)
 {
-	if (!str) {
-		fprintf(fp, "null");
-		return;
+	to->series = timeline_.series;
+	to->force_refresh = 0;
+}
+
+/* Appends str to a record of fixed_size bytes in buf, pads it and fills
+ * in the record header. Returns the total record size. */
+static size_t
+timeline_record_finish(void *buf, size_t buf_size, size_t fixed_size,
+		       uint16_t type, const char *str)
+{
+	struct weston_timeline_record *rec = buf;
+	size_t len = str ? strlen(str) : 0;
+	size_t size;
+
+	if (fixed_size + len + 1 > buf_size)
+		len = buf_size - fixed_size - 1;
+
+	if (len)
+		memcpy((char *)buf + fixed_size, str, len);
+	size = fixed_size + len;
+	do
+		((char *)buf)[size++] = '\0';
+	while (size % 4);
+
+	rec->type = type;
+	rec->size = size;
+
+	return size;
+}
+
+static uint32_t
+timeline_intern_name(const char *name)
+{
+	uint32_t buf[(sizeof(struct weston_timeline_string) + 128) / 4];
+	struct weston_timeline_string *rec = (void *)buf;
+	const char **p;
+	uint32_t id = 1;
+	size_t size;
+
+	/* Names are string literals, compare by address. */
+	wl_array_for_each(p, &timeline_.names) {
+		if (*p == name)
+			return id;
+		id++;
 	}
 
-	fprintf(fp, "\"%s\"", str);
+	/* Only remember the name once its record is in the ring, otherwise
+	 * it would never be written again. */
+	rec->id = id;
+	size = timeline_record_finish(buf, sizeof buf, sizeof *rec,
+				      WESTON_TIMELINE_RECORD_STRING, name);
+	if (!timeline_ring_write(buf, size))
+		return 0;
+
+	p = wl_array_add(&timeline_.names, sizeof *p);
+	if (!p)
+		return 0;
+	*p = name;
+
+	return id;
+}
+
+static bool
+timeline_write_object(uint32_t id, uint32_t type, uint32_t main_surface,
+		      const char *desc)
+{
+	uint32_t buf[(sizeof(struct weston_timeline_object_desc) + 512) / 4];
+	struct weston_timeline_object_desc *rec = (void *)buf;
+	size_t size;
+
+	rec->id = id;
+	rec->type = type;
+	rec->main_surface = main_surface;
+	rec->has_desc = desc != NULL;
+	size = timeline_record_finish(buf, sizeof buf, sizeof *rec,
+				      WESTON_TIMELINE_RECORD_OBJECT, desc);
+
+	return timeline_ring_write(buf, size);
 }
 
 static int
-emit_weston_output(struct timeline_emit_context *ctx, void *obj)
+emit_weston_output(struct weston_timeline_arg *arg, void *obj)
 {
 	struct weston_output *o = obj;
 
-	if (check_series(ctx, &o->timeline)) {
-		fprintf(ctx->out, "{ \"id\":%u, "
-			"\"type\":\"weston_output\", \"name\":",
-			o->timeline.id);
-		fprint_quoted_string(ctx->out, o->name);
-		fprintf(ctx->out, " }\n");
-	}
+	if (check_series(&o->timeline) &&
+	    timeline_write_object(o->timeline.id,
+				  WESTON_TIMELINE_OBJECT_OUTPUT, 0, o->name))
+		mark_series(&o->timeline);
 
-	fprintf(ctx->cur, "\"wo\":%u", o->timeline.id);
+	arg->type = WESTON_TIMELINE_ARG_OUTPUT;
+	arg->v[0] = o->timeline.id;
 
 	return 1;
 }
 
 static void
-check_weston_surface_description(struct timeline_emit_context *ctx,
-				 struct weston_surface *s)
+check_weston_surface_description(struct weston_surface *s)
 {
 	struct weston_surface *mains;
+	uint32_t main_id = 0;
 	char d[512];
-	char mainstr[32];
 
-	if (!check_series(ctx, &s->timeline))
+	if (!check_series(&s->timeline))
 		return;
 
 	mains = weston_surface_get_main_surface(s);
 	if (mains != s) {
-		check_weston_surface_description(ctx, mains);
-		if (snprintf(mainstr, sizeof(mainstr),
-			     ", \"main_surface\":%u", mains->timeline.id) < 0)
-			mainstr[0] = '\0';
-	} else {
-		mainstr[0] = '\0';
+		check_weston_surface_description(mains);
+		main_id = mains->timeline.id;
 	}
 
 	if (!s->get_label || s->get_label(s, d, sizeof(d)) < 0)
 		d[0] = '\0';
 
-	fprintf(ctx->out, "{ \"id\":%u, "
-		"\"type\":\"weston_surface\", \"desc\":", s->timeline.id);
-	fprint_quoted_string(ctx->out, d[0] ? d : NULL);
-	fprintf(ctx->out, "%s }\n", mainstr);
+	if (timeline_write_object(s->timeline.id,
+				  WESTON_TIMELINE_OBJECT_SURFACE,
+				  main_id, d[0] ? d : NULL))
+		mark_series(&s->timeline);
 }
 
 static int
-emit_weston_surface(struct timeline_emit_context *ctx, void *obj)
+emit_weston_surface(struct weston_timeline_arg *arg, void *obj)
 {
 	struct weston_surface *s = obj;
 
-	check_weston_surface_description(ctx, s);
-	fprintf(ctx->cur, "\"ws\":%u", s->timeline.id);
+	check_weston_surface_description(s);
+	arg->type = WESTON_TIMELINE_ARG_SURFACE;
+	arg->v[0] = s->timeline.id;
 
 	return 1;
 }
 
 static int
-emit_vblank_timestamp(struct timeline_emit_context *ctx, void *obj)
+emit_vblank_timestamp(struct weston_timeline_arg *arg, void *obj)
 {
 	struct timespec *ts = obj;
 
-	fprintf(ctx->cur, "\"vblank\":[%" PRId64 ", %ld]",
-		(int64_t)ts->tv_sec, ts->tv_nsec);
+	arg->type = WESTON_TIMELINE_ARG_VBLANK;
+	arg->v[0] = (uint64_t)ts->tv_sec;
+	arg->v[1] = (uint64_t)ts->tv_sec >> 32;
+	arg->v[2] = ts->tv_nsec;
+
+	return 1;
+}
+
+static int
+emit_repaint_timing(struct weston_timeline_arg *arg, void *obj)
+{
+	struct weston_repaint_timing *timing = obj;
+
+	arg->type = WESTON_TIMELINE_ARG_REPAINT_TIMING;
+	arg->v[0] = timing->delay_usec;
+	arg->v[1] = timing->predicted_usec;
+	arg->v[2] = timing->frames;
+	arg->v[3] = timing->misses;
 
 	return 1;
 }
 
-typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
+typedef int (*type_func)(struct weston_timeline_arg *arg, void *obj);
 
 static const type_func type_dispatch[] = {
 	[TLT_OUTPUT] = emit_weston_output,
 	[TLT_SURFACE] = emit_weston_surface,
 	[TLT_VBLANK] = emit_vblank_timestamp,
+	[TLT_REPAINT_TIMING] = emit_repaint_timing,
 };
 
 WL_EXPORT void
 weston_timeline_point(const char *name, ...)
 {
+	uint32_t buf[(sizeof(struct weston_timeline_point) +
+		      WESTON_TIMELINE_MAX_ARGS *
+		      sizeof(struct weston_timeline_arg)) / 4];
+	struct weston_timeline_point *point = (void *)buf;
 	va_list argp;
 	struct timespec ts;
 	enum timeline_type otype;
 	void *obj;
-	char buf[512];
-	struct timeline_emit_context ctx;
 
 	clock_gettime(timeline_.clk_id, &ts);
 
-	ctx.out = timeline_.file;
-	ctx.cur = fmemopen(buf, sizeof(buf), "w");
-	ctx.series = timeline_.series;
-
-	if (!ctx.cur) {
-		weston_log("Timeline error in fmemopen, closing.\n");
-		weston_timeline_close();
-		return;
-	}
-
-	fprintf(ctx.cur, "{ \"T\":[%" PRId64 ", %ld], \"N\":\"%s\"",
-		(int64_t)ts.tv_sec, ts.tv_nsec, name);
+	point->name = timeline_intern_name(name);
+	point->tv_sec_lo = (uint64_t)ts.tv_sec;
+	point->tv_sec_hi = (uint64_t)ts.tv_sec >> 32;
+	point->tv_nsec = ts.tv_nsec;
+	point->n_args = 0;
 
 	va_start(argp, name);
 	while (1) {
@@ -272,21 +501,15 @@ weston_timeline_point(const char *name, ...)
 			break;
 
 		obj = va_arg(argp, void *);
-		if (type_dispatch[otype]) {
-			fprintf(ctx.cur, ", ");
-			type_dispatch[otype](&ctx, obj);
-		}
+		assert(point->n_args < WESTON_TIMELINE_MAX_ARGS);
+		if (type_dispatch[otype] &&
+		    type_dispatch[otype](&point->args[point->n_args], obj))
+			point->n_args++;
 	}
 	va_end(argp);
 
-	fprintf(ctx.cur, " }\n");
-	fflush(ctx.cur);
-	if (ferror(ctx.cur)) {
-		weston_log("Timeline error in constructing entry, closing.\n");
-		weston_timeline_close();
-	} else {
-		fprintf(ctx.out, "%s", buf);
-	}
-
-	fclose(ctx.cur);
+	point->rec.type = WESTON_TIMELINE_RECORD_POINT;
+	point->rec.size = sizeof *point +
+			  point->n_args * sizeof(struct weston_timeline_arg);
+	timeline_ring_write(point, point->rec.size);
 }
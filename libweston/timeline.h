@@ -30,6 +30,7 @@
 extern int weston_timeline_enabled_;
 
 struct weston_compositor;
+struct weston_repaint_timing;
 
 void
 weston_timeline_open(struct weston_compositor *compositor);
@@ -42,6 +43,7 @@ enum timeline_type {
 	TLT_OUTPUT,
 	TLT_SURFACE,
 	TLT_VBLANK,
+	TLT_REPAINT_TIMING,
 };
 
 #define TYPEVERIFY(type, arg) ({			\
@@ -53,6 +55,8 @@ enum timeline_type {
 #define TLP_OUTPUT(o) TLT_OUTPUT, TYPEVERIFY(struct weston_output *, (o))
 #define TLP_SURFACE(s) TLT_SURFACE, TYPEVERIFY(struct weston_surface *, (s))
 #define TLP_VBLANK(t) TLT_VBLANK, TYPEVERIFY(const struct timespec *, (t))
+#define TLP_REPAINT_TIMING(t) TLT_REPAINT_TIMING, \
+	TYPEVERIFY(struct weston_repaint_timing *, (t))
 
 #define TL_POINT(...) do { \
 	if (weston_timeline_enabled_) \
@@ -26,6 +26,7 @@
 #include <float.h>
 #include <math.h>
 
+#include "shared/matrix.h"
 #include "vertex-clipping.h"
 
 float
@@ -328,3 +329,99 @@ clip_transformed(struct clip_context *ctx,
 
 	return n;
 }
+
+/** Prepare a transformed surface rectangle for clip_quad()
+ *
+ * \param quad The quad to initialize.
+ * \param polygon The four corners in global coordinates, clockwise.
+ * \param axis_aligned Whether the edges are parallel to the axes, so
+ * clipping reduces to clamping the corners.
+ */
+void
+clip_quad_init(struct clip_quad *quad,
+	       const struct polygon8 *polygon,
+	       bool axis_aligned)
+{
+	int i;
+
+	quad->polygon = *polygon;
+	quad->axis_aligned = axis_aligned;
+
+	quad->bbox.x1 = quad->bbox.x2 = polygon->x[0];
+	quad->bbox.y1 = quad->bbox.y2 = polygon->y[0];
+	for (i = 1; i < polygon->n; i++) {
+		quad->bbox.x1 = fminf(quad->bbox.x1, polygon->x[i]);
+		quad->bbox.x2 = fmaxf(quad->bbox.x2, polygon->x[i]);
+		quad->bbox.y1 = fminf(quad->bbox.y1, polygon->y[i]);
+		quad->bbox.y2 = fmaxf(quad->bbox.y2, polygon->y[i]);
+	}
+}
+
+/** Clip a quad to the clip rectangle of the context
+ *
+ * \return The number of vertices written to ex and ey, either zero or
+ * 3 to 8 forming a polygon with non-zero area.
+ */
+int
+clip_quad(struct clip_context *ctx,
+	  const struct clip_quad *quad,
+	  float *ex,
+	  float *ey)
+{
+	struct polygon8 polygon;
+	int n;
+
+	if (quad->bbox.x1 >= ctx->clip.x2 || quad->bbox.x2 <= ctx->clip.x1 ||
+	    quad->bbox.y1 >= ctx->clip.y2 || quad->bbox.y2 <= ctx->clip.y1)
+		return 0;
+
+	/* clip_transformed() works in place. */
+	polygon = quad->polygon;
+
+	if (quad->axis_aligned)
+		return clip_simple(ctx, &polygon, ex, ey);
+
+	n = clip_transformed(ctx, &polygon, ex, ey);
+	if (n < 3)
+		return 0;
+
+	return n;
+}
+
+/** Append the mapping from buffer to normalized texture coordinates
+ *
+ * \param m A matrix to buffer coordinates, from global coordinates for
+ * texcoord_from_global().
+ * \param layout Where the buffer lies in its texture.
+ */
+void
+texcoord_matrix_append(struct weston_matrix *m,
+		       const struct texcoord_layout *layout)
+{
+	if (!layout->y_inverted) {
+		weston_matrix_scale(m, 1, -1, 1);
+		weston_matrix_translate(m, 0, layout->height, 0);
+	}
+	weston_matrix_translate(m, layout->x, layout->y, 0);
+	weston_matrix_scale(m, layout->inv_width, layout->inv_height, 1);
+}
+
+/** Map a vertex in global coordinates to texture coordinates
+ *
+ * Only the x, y and w rows of the matrix are used, z is not needed.
+ */
+void
+texcoord_from_global(const struct weston_matrix *m, float x, float y,
+		     float *s, float *t)
+{
+	float w = m->d[3] * x + m->d[7] * y + m->d[15];
+
+	if (fabsf(w) < 1e-6) {
+		*s = 0;
+		*t = 0;
+		return;
+	}
+
+	*s = (m->d[0] * x + m->d[4] * y + m->d[12]) / w;
+	*t = (m->d[1] * x + m->d[5] * y + m->d[13]) / w;
+}
@@ -25,6 +25,10 @@
 #ifndef _WESTON_VERTEX_CLIPPING_H
 #define _WESTON_VERTEX_CLIPPING_H
 
+#include <stdbool.h>
+
+struct weston_matrix;
+
 struct polygon8 {
 	float x[8];
 	float y[8];
@@ -63,4 +67,42 @@ clip_transformed(struct clip_context *ctx,
 		 float *ex,
 		 float *ey);\
 
+/* A surface rectangle in global coordinates, with its bounding box, which
+ * can be clipped again and again without transforming it each time. */
+struct clip_quad {
+	struct polygon8 polygon;
+	struct {
+		float x1, y1;
+		float x2, y2;
+	} bbox;
+	bool axis_aligned;
+};
+
+void
+clip_quad_init(struct clip_quad *quad,
+	       const struct polygon8 *polygon,
+	       bool axis_aligned);
+
+int
+clip_quad(struct clip_context *ctx,
+	  const struct clip_quad *quad,
+	  float *ex,
+	  float *ey);
+
+/* Where a buffer lies in its texture */
+struct texcoord_layout {
+	bool y_inverted;		/* rows are stored top to bottom */
+	float height;			/* buffer height, for flipping */
+	float x, y;			/* offset in the texture, in texels */
+	float inv_width, inv_height;	/* 1 / texture size in texels */
+};
+
+void
+texcoord_matrix_append(struct weston_matrix *m,
+		       const struct texcoord_layout *layout);
+
+void
+texcoord_from_global(const struct weston_matrix *m, float x, float y,
+		     float *s, float *t);
+
 #endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * BT.601 limited range YUV to RGB, the same conversion the GL renderer
+ * does in its shaders, in 8 bit fixed point:
+ *
+ *   R = (298 (Y - 16) + 409 (V - 128) + 128) >> 8
+ *   G = (298 (Y - 16) - 100 (U - 128) - 208 (V - 128) + 128) >> 8
+ *   B = (298 (Y - 16) + 516 (U - 128) + 128) >> 8
+ *
+ * clamped to [0, 255]. The SSE2 path produces exactly the same values.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "yuv-convert.h"
+
+static inline uint32_t
+clamp_u8(int32_t v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint32_t
+yuv_pixel(int32_t y, int32_t u, int32_t v)
+{
+	int32_t c = 298 * (y - 16) + 128;
+	int32_t d = u - 128;
+	int32_t e = v - 128;
+
+	return 0xff000000 |
+	       clamp_u8((c + 409 * e) >> 8) << 16 |
+	       clamp_u8((c - 100 * d - 208 * e) >> 8) << 8 |
+	       clamp_u8((c + 516 * d) >> 8);
+}
+
+/* Converts pixels [x, x2) of one row, x must be even. */
+static int
+convert_row_c(uint32_t *dst, const uint8_t *y, const uint8_t *u,
+	      const uint8_t *v, int uv_step, int x, int x2)
+{
+	for (; x < x2; x++) {
+		int c = (x / 2) * uv_step;
+
+		dst[x] = yuv_pixel(y[x], u[c], v[c]);
+	}
+
+	return x;
+}
+
+#ifdef __SSE2__
+
+/* Converts 8 pixels from Y values and (U, V) pairs, one pair per two
+ * pixels and given twice, for pixels 0-3 in uv_lo and 4-7 in uv_hi. */
+static inline void
+convert_8_sse2(uint32_t *dst, __m128i y, __m128i uv_lo, __m128i uv_hi)
+{
+	const __m128i zero = _mm_setzero_si128();
+	/* Multiplied pairwise with (Y, 1) and (U, V) */
+	const __m128i k_y = _mm_set_epi16(128, 298, 128, 298,
+					  128, 298, 128, 298);
+	const __m128i k_r = _mm_set_epi16(409, 0, 409, 0, 409, 0, 409, 0);
+	const __m128i k_g = _mm_set_epi16(-208, -100, -208, -100,
+					  -208, -100, -208, -100);
+	const __m128i k_b = _mm_set_epi16(0, 516, 0, 516, 0, 516, 0, 516);
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i c_lo, c_hi, r, g, b, bg, ra;
+
+	y = _mm_sub_epi16(_mm_unpacklo_epi8(y, zero), _mm_set1_epi16(16));
+
+	/* 298 (Y - 16) + 128 for each pixel, in 32 bits */
+	c_lo = _mm_madd_epi16(_mm_unpacklo_epi16(y, one), k_y);
+	c_hi = _mm_madd_epi16(_mm_unpackhi_epi16(y, one), k_y);
+
+	r = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(c_lo, _mm_madd_epi16(uv_lo, k_r)), 8),
+		_mm_srai_epi32(_mm_add_epi32(c_hi, _mm_madd_epi16(uv_hi, k_r)), 8));
+	g = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(c_lo, _mm_madd_epi16(uv_lo, k_g)), 8),
+		_mm_srai_epi32(_mm_add_epi32(c_hi, _mm_madd_epi16(uv_hi, k_g)), 8));
+	b = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(c_lo, _mm_madd_epi16(uv_lo, k_b)), 8),
+		_mm_srai_epi32(_mm_add_epi32(c_hi, _mm_madd_epi16(uv_hi, k_b)), 8));
+
+	/* Saturating to [0, 255] is the clamp. */
+	r = _mm_packus_epi16(r, r);
+	g = _mm_packus_epi16(g, g);
+	b = _mm_packus_epi16(b, b);
+
+	bg = _mm_unpacklo_epi8(b, g);
+	ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+	_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+static int
+convert_row_planar_sse2(uint32_t *dst, const uint8_t *y, const uint8_t *u,
+			const uint8_t *v, int x, int x2)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	__m128i u8, v8, uv;
+	int32_t u4, v4;
+
+	for (; x + 8 <= x2; x += 8) {
+		memcpy(&u4, u + x / 2, sizeof u4);
+		memcpy(&v4, v + x / 2, sizeof v4);
+
+		u8 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(u4),
+						     zero), bias);
+		v8 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v4),
+						     zero), bias);
+		/* (U0 V0 U1 V1 U2 V2 U3 V3), each pair used by two pixels */
+		uv = _mm_unpacklo_epi16(u8, v8);
+
+		convert_8_sse2(dst + x,
+			       _mm_loadl_epi64((const __m128i *) (y + x)),
+			       _mm_unpacklo_epi32(uv, uv),
+			       _mm_unpackhi_epi32(uv, uv));
+	}
+
+	return x;
+}
+
+static int
+convert_row_interleaved_sse2(uint32_t *dst, const uint8_t *y,
+			     const uint8_t *uv, int x, int x2)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	__m128i uv8;
+
+	for (; x + 8 <= x2; x += 8) {
+		uv8 = _mm_loadl_epi64((const __m128i *) (uv + x));
+		uv8 = _mm_sub_epi16(_mm_unpacklo_epi8(uv8, zero), bias);
+
+		convert_8_sse2(dst + x,
+			       _mm_loadl_epi64((const __m128i *) (y + x)),
+			       _mm_unpacklo_epi32(uv8, uv8),
+			       _mm_unpackhi_epi32(uv8, uv8));
+	}
+
+	return x;
+}
+
+#endif
+
+/** Convert a rectangle of a 4:2:0 YUV image to x8r8g8b8
+ *
+ * \param dst The destination image, the same size as the source.
+ * \param dst_stride Destination stride in bytes.
+ * \param src The source planes.
+ * \param x1 Left edge of the rectangle to convert, inclusive.
+ * \param y1 Top edge of the rectangle to convert, inclusive.
+ * \param x2 Right edge of the rectangle to convert, exclusive.
+ * \param y2 Bottom edge of the rectangle to convert, exclusive.
+ *
+ * The rectangle must lie within the image. Pixels left of it may be
+ * written as well, when x1 is odd.
+ */
+void
+yuv_to_xrgb8888(uint32_t *dst, int dst_stride,
+		const struct yuv_planes *src,
+		int x1, int y1, int x2, int y2)
+{
+	const uint8_t *y, *u, *v;
+	uint32_t *d;
+	int row, x;
+
+	/* Chroma is shared by pixel pairs, start on a pair. */
+	x1 &= ~1;
+
+	for (row = y1; row < y2; row++) {
+		d = (uint32_t *) ((uint8_t *) dst + row * dst_stride);
+		y = src->y + row * src->y_stride;
+		u = src->u + (row / 2) * src->uv_stride;
+		v = src->v + (row / 2) * src->uv_stride;
+		x = x1;
+
+#ifdef __SSE2__
+		if (src->uv_step == 1)
+			x = convert_row_planar_sse2(d, y, u, v, x, x2);
+		else if (src->uv_step == 2 && v == u + 1)
+			x = convert_row_interleaved_sse2(d, y, u, x, x2);
+#endif
+
+		convert_row_c(d, y, u, v, src->uv_step, x, x2);
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_YUV_CONVERT_H
+#define _WESTON_YUV_CONVERT_H
+
+#include <stdint.h>
+
+/* 8 bit 4:2:0 YUV, where the chroma samples of a pixel are at
+ * u[(y / 2) * uv_stride + (x / 2) * uv_step] and likewise for v: uv_step
+ * is 1 for planar formats and 2 for semi-planar ones like NV12. */
+struct yuv_planes {
+	const uint8_t *y;
+	const uint8_t *u;
+	const uint8_t *v;
+	int y_stride;
+	int uv_stride;
+	int uv_step;
+};
+
+void
+yuv_to_xrgb8888(uint32_t *dst, int dst_stride,
+		const struct yuv_planes *src,
+		int x1, int y1, int x2, int y2);
+
+#endif
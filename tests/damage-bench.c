@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares damage regions before and after weston_region_simplify():
+ * the number of rectangles, the area that gets repainted, and the time
+ * it takes to composite the region rectangle by rectangle, which is how
+ * the renderers consume damage.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "damage-simplify.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define ROUNDS 50
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+/* Lots of small updates, like a terminal or a busy web page. */
+static void
+make_damage(pixman_region32_t *region, int n)
+{
+	int i;
+
+	pixman_region32_init(region);
+	for (i = 0; i < n; i++)
+		pixman_region32_union_rect(region, region,
+					   rand() % WIDTH, rand() % HEIGHT,
+					   2 + rand() % 24, 2 + rand() % 16);
+	pixman_region32_intersect_rect(region, region, 0, 0, WIDTH, HEIGHT);
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int n, i;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static void
+composite_region(pixman_image_t *src, pixman_image_t *dst,
+		 pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	int n, i;
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		pixman_image_composite32(PIXMAN_OP_OVER, src, NULL, dst,
+					 rects[i].x1, rects[i].y1, 0, 0,
+					 rects[i].x1, rects[i].y1,
+					 rects[i].x2 - rects[i].x1,
+					 rects[i].y2 - rects[i].y1);
+}
+
+static void
+run(pixman_image_t *src, pixman_image_t *dst, int n_updates, int max_rects)
+{
+	pixman_region32_t damage;
+	double simplify_time = 0.0, render_time = 0.0;
+	uint64_t rects = 0, area = 0;
+	int i;
+
+	srand(n_updates);
+
+	for (i = 0; i < ROUNDS; i++) {
+		make_damage(&damage, n_updates);
+
+		reset_timer();
+		if (max_rects > 0)
+			weston_region_simplify(&damage, max_rects,
+					       WESTON_DAMAGE_TILE_SIZE);
+		simplify_time += read_timer();
+
+		rects += pixman_region32_n_rects(&damage);
+		area += region_area(&damage);
+
+		reset_timer();
+		composite_region(src, dst, &damage);
+		render_time += read_timer();
+
+		pixman_region32_fini(&damage);
+	}
+
+	printf("%8d %10d %10.1f %9.1f%% %12.1f %12.1f\n",
+	       n_updates, max_rects, (double)rects / ROUNDS,
+	       100.0 * area / ROUNDS / (WIDTH * HEIGHT),
+	       1e6 * simplify_time / ROUNDS, 1e6 * render_time / ROUNDS);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int updates[] = { 100, 1000, 5000 };
+	static const int max_rects[] = { 0, 256, 64, 16 };
+	pixman_image_t *src, *dst;
+	unsigned i, j;
+
+	src = pixman_image_create_bits(PIXMAN_a8r8g8b8, WIDTH, HEIGHT,
+				       NULL, 0);
+	dst = pixman_image_create_bits(PIXMAN_x8r8g8b8, WIDTH, HEIGHT,
+				       NULL, 0);
+	if (!src || !dst) {
+		fprintf(stderr, "failed to allocate images\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("Averages over %d frames of %dx%d, max rects 0 is "
+	       "unsimplified damage.\n\n", ROUNDS, WIDTH, HEIGHT);
+	printf("%8s %10s %10s %10s %12s %12s\n", "updates", "max rects",
+	       "rects", "area", "simplify us", "render us");
+
+	for (i = 0; i < sizeof updates / sizeof updates[0]; i++)
+		for (j = 0; j < sizeof max_rects / sizeof max_rects[0]; j++)
+			run(src, dst, updates[i], max_rects[j]);
+
+	pixman_image_unref(src);
+	pixman_image_unref(dst);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "damage-simplify.h"
+
+static void
+make_scattered_region(pixman_region32_t *region, int n, int size)
+{
+	int i;
+
+	pixman_region32_init(region);
+
+	srand(n);
+	for (i = 0; i < n; i++)
+		pixman_region32_union_rect(region, region,
+					   rand() % size, rand() % size,
+					   1 + rand() % 8, 1 + rand() % 8);
+}
+
+/* simplified must contain orig, and stay inside the extents of orig. */
+static void
+assert_covers(pixman_region32_t *simplified, pixman_region32_t *orig)
+{
+	pixman_box32_t *box = pixman_region32_extents(simplified);
+	pixman_box32_t *ext = pixman_region32_extents(orig);
+	pixman_region32_t tmp;
+
+	pixman_region32_init(&tmp);
+	pixman_region32_subtract(&tmp, orig, simplified);
+	assert(!pixman_region32_not_empty(&tmp));
+	pixman_region32_fini(&tmp);
+
+	assert(box->x1 >= ext->x1 && box->y1 >= ext->y1);
+	assert(box->x2 <= ext->x2 && box->y2 <= ext->y2);
+}
+
+TEST(small_region_untouched)
+{
+	pixman_region32_t region;
+
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 100, 100, 10, 10);
+
+	assert(!weston_region_simplify(&region, 2, WESTON_DAMAGE_TILE_SIZE));
+	assert(pixman_region32_n_rects(&region) == 2);
+
+	pixman_region32_fini(&region);
+}
+
+static const int max_rects[] = { 1, 4, 16, 64, 256 };
+
+TEST_P(scattered_region_bounded, max_rects)
+{
+	const int *max = data;
+	pixman_region32_t region, orig;
+
+	make_scattered_region(&orig, 2000, 1000);
+	assert(pixman_region32_n_rects(&orig) > *max);
+
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, &orig);
+
+	assert(weston_region_simplify(&region, *max, WESTON_DAMAGE_TILE_SIZE));
+	assert(pixman_region32_n_rects(&region) <= *max);
+	assert_covers(&region, &orig);
+
+	pixman_region32_fini(&region);
+	pixman_region32_fini(&orig);
+}
+
+TEST(single_rect_is_extents)
+{
+	pixman_region32_t region, orig;
+	pixman_box32_t *box, *ext;
+
+	make_scattered_region(&orig, 100, 300);
+
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, &orig);
+	assert(weston_region_simplify(&region, 1, WESTON_DAMAGE_TILE_SIZE));
+
+	assert(pixman_region32_n_rects(&region) == 1);
+	box = pixman_region32_extents(&region);
+	ext = pixman_region32_extents(&orig);
+	assert(box->x1 == ext->x1 && box->y1 == ext->y1 &&
+	       box->x2 == ext->x2 && box->y2 == ext->y2);
+
+	pixman_region32_fini(&region);
+	pixman_region32_fini(&orig);
+}
+
+/* Planes above the primary one, like a cursor and a video overlay */
+TEST_P(clipped_damage_bounded, max_rects)
+{
+	const int *max = data;
+	pixman_region32_t damage, output, clip, result, expected, tmp;
+
+	make_scattered_region(&damage, 2000, 1000);
+	pixman_region32_init_rect(&output, 0, 0, 800, 1000);
+	pixman_region32_init_rect(&clip, 100, 100, 64, 64);
+	pixman_region32_union_rect(&clip, &clip, 301, 257, 300, 211);
+	pixman_region32_union_rect(&clip, &clip, 650, 3, 17, 900);
+
+	pixman_region32_init(&result);
+	weston_damage_clip_and_simplify(&result, &damage, &output, &clip,
+					*max);
+	assert(pixman_region32_n_rects(&result) <= *max);
+
+	/* All damage outside the clip is still repainted. */
+	pixman_region32_init(&expected);
+	pixman_region32_intersect(&expected, &damage, &output);
+	pixman_region32_subtract(&expected, &expected, &clip);
+	pixman_region32_init(&tmp);
+	pixman_region32_subtract(&tmp, &expected, &result);
+	assert(!pixman_region32_not_empty(&tmp));
+
+	pixman_region32_fini(&tmp);
+	pixman_region32_fini(&expected);
+	pixman_region32_fini(&result);
+	pixman_region32_fini(&clip);
+	pixman_region32_fini(&output);
+	pixman_region32_fini(&damage);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include "weston-test-client-helper.h"
+#include "shared/timespec-util.h"
+
+/* Runs with hidden-frame-rate=10, see hidden-frames-rate.ini: frame
+ * callbacks of surfaces that are fully covered must arrive from the
+ * compositor's hidden frame timer, no more often than every 100 ms. */
+
+#define HIDDEN_FRAME_INTERVAL_MS 100
+
+struct timed_frame {
+	int done;
+	struct timespec time;
+};
+
+static void
+timed_frame_handler(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct timed_frame *frame = data;
+
+	clock_gettime(CLOCK_MONOTONIC, &frame->time);
+	frame->done = 1;
+
+	wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener timed_frame_listener = {
+	timed_frame_handler
+};
+
+static void
+commit_with_timed_frame(struct client *client, struct timed_frame *frame)
+{
+	struct surface *surface = client->surface;
+	struct wl_callback *callback;
+
+	frame->done = 0;
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0,
+			  surface->width, surface->height);
+	callback = wl_surface_frame(surface->wl_surface);
+	wl_callback_add_listener(callback, &timed_frame_listener, frame);
+	wl_surface_commit(surface->wl_surface);
+}
+
+static int64_t
+msec_between(const struct timespec *a, const struct timespec *b)
+{
+	struct timespec d;
+
+	timespec_sub(&d, b, a);
+
+	return timespec_to_nsec(&d) / 1000000;
+}
+
+TEST(hidden_surface_frame_callbacks_limited)
+{
+	struct client *back, *front;
+	struct timed_frame frame;
+	struct timespec begin;
+	int front_frame;
+	int64_t elapsed;
+	int i;
+
+	back = create_client_and_test_surface(100, 100, 100, 100);
+	assert(back);
+	assert(back->output);
+
+	/* An opaque surface covering the whole output. */
+	front = create_client_and_test_surface(0, 0, back->output->width,
+					       back->output->height);
+	assert(front);
+	set_opaque(front);
+	commit_with_frame(front, &front_frame);
+	frame_callback_wait(front, &front_frame);
+
+	/* The front surface stays idle, so nothing else makes the output
+	 * repaint: every frame event of the covered surface comes from the
+	 * hidden frame timer, one interval after the repaint its commit
+	 * caused. */
+	for (i = 0; i < 5; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		commit_with_timed_frame(back, &frame);
+		frame_callback_wait(back, &frame.done);
+
+		elapsed = msec_between(&begin, &frame.time);
+		assert(elapsed >= HIDDEN_FRAME_INTERVAL_MS);
+		assert(elapsed < 10 * HIDDEN_FRAME_INTERVAL_MS);
+	}
+
+	/* Uncovering it goes back to the output refresh rate. */
+	move_client(front, 300, 0);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	commit_with_timed_frame(back, &frame);
+	frame_callback_wait(back, &frame.done);
+	assert(msec_between(&begin, &frame.time) < HIDDEN_FRAME_INTERVAL_MS);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "weston-test-client-helper.h"
+
+/* Runs with hidden-frame-rate=0, see hidden-frames.ini: frame callbacks
+ * of surfaces that are fully covered must be held back, and sent as
+ * soon as the surface is uncovered. */
+
+TEST(hidden_surface_frame_callbacks_paused)
+{
+	struct client *back, *front;
+	int back_frame, front_frame;
+	int i;
+
+	back = create_client_and_test_surface(100, 100, 100, 100);
+	assert(back);
+	assert(back->output);
+
+	/* An opaque surface covering the whole output. */
+	front = create_client_and_test_surface(0, 0, back->output->width,
+					       back->output->height);
+	assert(front);
+	set_opaque(front);
+	commit_with_frame(front, &front_frame);
+	frame_callback_wait(front, &front_frame);
+
+	/* The covered surface keeps committing but gets no frame events,
+	 * even after the compositor has repainted a few times. */
+	commit_with_frame(back, &back_frame);
+	wl_display_roundtrip(back->wl_display);
+
+	for (i = 0; i < 5; i++) {
+		commit_with_frame(front, &front_frame);
+		frame_callback_wait(front, &front_frame);
+
+		wl_display_roundtrip(back->wl_display);
+		assert(!back_frame);
+	}
+
+	/* Uncovering it resumes frame events right away. */
+	move_client(front, 300, 0);
+	frame_callback_wait(back, &back_frame);
+
+	/* And they keep coming while visible. */
+	commit_with_frame(back, &back_frame);
+	frame_callback_wait(back, &back_frame);
+}
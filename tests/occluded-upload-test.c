@@ -0,0 +1,184 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shared/os-compatibility.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+
+char *server_parameters="--use-pixman --width=320 --height=240";
+
+/* Updates of a covered surface must not be uploaded, and must show up
+ * once it is uncovered. The test runs on the pixman renderer, which
+ * holds back the conversion of YUV buffers like the GL renderer holds
+ * back texture uploads: the buffer stays referenced until it has been
+ * converted, so its release tells whether that happened. */
+
+#define SURFACE_SIZE 64
+
+struct yuv_buffer {
+	struct wl_buffer *proxy;
+	void *data;
+	size_t len;
+	int released;
+};
+
+static void
+yuv_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct yuv_buffer *buf = data;
+
+	buf->released = 1;
+}
+
+static const struct wl_buffer_listener yuv_buffer_listener = {
+	yuv_buffer_release
+};
+
+/* A YUV420 buffer of a single grey level. */
+static struct yuv_buffer *
+create_yuv_buffer(struct client *client, int size, uint8_t luma)
+{
+	struct yuv_buffer *buf;
+	struct wl_shm_pool *pool;
+	size_t luma_len = size * size;
+	int fd;
+
+	buf = xzalloc(sizeof *buf);
+	buf->len = luma_len + 2 * (luma_len / 4);
+
+	fd = os_create_anonymous_file(buf->len);
+	assert(fd >= 0);
+
+	buf->data = mmap(NULL, buf->len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+	assert(buf->data != MAP_FAILED);
+
+	memset(buf->data, luma, luma_len);
+	memset((uint8_t *) buf->data + luma_len, 128, buf->len - luma_len);
+
+	pool = wl_shm_create_pool(client->wl_shm, fd, buf->len);
+	buf->proxy = wl_shm_pool_create_buffer(pool, 0, size, size, size,
+					       WL_SHM_FORMAT_YUV420);
+	wl_buffer_add_listener(buf->proxy, &yuv_buffer_listener, buf);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return buf;
+}
+
+static void
+yuv_buffer_destroy(struct yuv_buffer *buf)
+{
+	wl_buffer_destroy(buf->proxy);
+	assert(munmap(buf->data, buf->len) == 0);
+	free(buf);
+}
+
+static void
+attach_yuv_buffer(struct client *client, struct yuv_buffer *buf)
+{
+	struct wl_surface *surface = client->surface->wl_surface;
+
+	buf->released = 0;
+	wl_surface_attach(surface, buf->proxy, 0, 0);
+	wl_surface_damage(surface, 0, 0, SURFACE_SIZE, SURFACE_SIZE);
+	wl_surface_commit(surface);
+}
+
+/* The red channel of an output pixel, as the compositor shows it. */
+static uint8_t
+output_red_at(struct client *client, int x, int y)
+{
+	struct buffer *shot;
+	uint32_t *pixels;
+	uint8_t red;
+
+	shot = capture_screenshot_of_output(client);
+	pixels = pixman_image_get_data(shot->image);
+	red = pixels[y * pixman_image_get_stride(shot->image) / 4 + x] >> 16;
+	buffer_destroy(shot);
+
+	return red;
+}
+
+TEST(occluded_surface_upload_deferred)
+{
+	struct client *back, *front;
+	struct yuv_buffer *dark, *bright;
+	int frame;
+	int i;
+
+	back = create_client_and_test_surface(100, 100, SURFACE_SIZE,
+					      SURFACE_SIZE);
+	assert(back);
+	assert(back->output);
+
+	dark = create_yuv_buffer(back, SURFACE_SIZE, 16);
+	bright = create_yuv_buffer(back, SURFACE_SIZE, 235);
+
+	/* While visible, a new buffer is converted in the next repaint. */
+	attach_yuv_buffer(back, dark);
+	client_roundtrip(back);
+	assert(output_red_at(back, 110, 110) == 0);
+	client_roundtrip(back);
+	assert(dark->released);
+
+	/* An opaque surface covering the whole output. */
+	front = create_client_and_test_surface(0, 0, back->output->width,
+					       back->output->height);
+	assert(front);
+	set_opaque(front);
+	commit_with_frame(front, &frame);
+	frame_callback_wait(front, &frame);
+
+	/* New content of the covered surface is held back, however many
+	 * times the output repaints. */
+	attach_yuv_buffer(back, bright);
+	client_roundtrip(back);
+
+	for (i = 0; i < 5; i++) {
+		commit_with_frame(front, &frame);
+		frame_callback_wait(front, &frame);
+
+		client_roundtrip(back);
+		assert(!bright->released);
+	}
+
+	/* Uncovering it converts the held back content, and shows it. */
+	move_client(front, 300, 0);
+	client_roundtrip(back);
+	assert(bright->released);
+	assert(output_red_at(back, 110, 110) == 255);
+
+	yuv_buffer_destroy(dark);
+	yuv_buffer_destroy(bright);
+}
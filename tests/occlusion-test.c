@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* A small surface, standing in for a weston-simple-shm window, sits
+ * behind an opaque surface covering the whole output. After a repaint
+ * its view must be marked occluded, so the renderer defers its texture
+ * uploads, and it must become visible again once uncovered. */
+
+#define STEP_INTERVAL_MS 100
+
+struct occlusion_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct weston_surface *back_surface, *front_surface;
+	struct weston_view *back, *front;
+	struct wl_event_source *timer;
+	int step;
+};
+
+static struct weston_view *
+create_view(struct occlusion_test *test, int32_t x, int32_t y,
+	    int32_t width, int32_t height, bool opaque,
+	    struct weston_surface **surface_out)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(test->compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+
+	surface->width = width;
+	surface->height = height;
+	if (opaque)
+		pixman_region32_union_rect(&surface->opaque,
+					   &surface->opaque, 0, 0,
+					   width, height);
+	surface->is_mapped = true;
+	view->is_mapped = true;
+
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&test->layer.view_list, &view->layer_link);
+	weston_view_update_transform(view);
+	weston_surface_damage(surface);
+
+	*surface_out = surface;
+
+	return view;
+}
+
+static void
+repaint_and_wait(struct occlusion_test *test)
+{
+	weston_compositor_schedule_repaint(test->compositor);
+	wl_event_source_timer_update(test->timer, STEP_INTERVAL_MS);
+}
+
+static int
+occlusion_step(void *data)
+{
+	struct occlusion_test *test = data;
+	struct weston_output *output = test->output;
+
+	switch (test->step++) {
+	case 0:
+		/* Fully covered by the opaque front surface. */
+		assert(!test->front->occluded);
+		assert(test->back->occluded);
+
+		/* Damage keeps coming in while covered. */
+		weston_surface_damage(test->back_surface);
+		repaint_and_wait(test);
+		break;
+	case 1:
+		assert(test->back->occluded);
+
+		/* Move the cover partly away, exposing the back surface. */
+		weston_view_set_position(test->front,
+					 output->x + 50, output->y);
+		weston_view_update_transform(test->front);
+		repaint_and_wait(test);
+		break;
+	case 2:
+		assert(!test->back->occluded);
+		assert(!test->front->occluded);
+
+		/* Moved off all outputs, nothing is visible either. */
+		weston_view_set_position(test->back, output->x,
+					 output->y - 1000);
+		weston_view_update_transform(test->back);
+		repaint_and_wait(test);
+		break;
+	case 3:
+		assert(test->back->occluded);
+
+		weston_view_destroy(test->back);
+		weston_surface_destroy(test->back_surface);
+		weston_view_destroy(test->front);
+		weston_surface_destroy(test->front_surface);
+		wl_event_source_remove(test->timer);
+		wl_list_remove(&test->layer.link);
+		free(test);
+
+		wl_display_terminate(output->compositor->wl_display);
+		break;
+	}
+
+	return 0;
+}
+
+static void
+occlusion_test(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct occlusion_test *test;
+	struct wl_event_loop *loop;
+	struct weston_output *output;
+
+	assert(!wl_list_empty(&compositor->output_list));
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+
+	test = zalloc(sizeof *test);
+	assert(test);
+	test->compositor = compositor;
+	test->output = output;
+
+	/* Above everything else, including the shell's fade layer. */
+	weston_layer_init(&test->layer, &compositor->layer_list);
+
+	test->back = create_view(test, output->x + 10, output->y + 10,
+				 100, 100, false, &test->back_surface);
+	test->front = create_view(test, output->x, output->y,
+				  output->width, output->height, true,
+				  &test->front_surface);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	test->timer = wl_event_loop_add_timer(loop, occlusion_step, test);
+	assert(test->timer);
+
+	repaint_and_wait(test);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, occlusion_test, compositor);
+
+	return 0;
+}
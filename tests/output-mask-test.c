@@ -0,0 +1,159 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "windowed-output-api.h"
+#include "shared/timespec-util.h"
+
+/* Runs on the headless backend: creates enough outputs to need output
+ * ids beyond the inline part of struct weston_output_mask, checks the
+ * masks assigned to a view moving across them, and reports the cost of
+ * weston_view_assign_output(). */
+
+#define NUM_OUTPUTS 128
+#define NUM_ASSIGNS 2000
+
+static void
+check_view_mask(struct weston_compositor *compositor, struct weston_view *view)
+{
+	struct weston_output *output;
+	pixman_region32_t region;
+	bool expected;
+
+	pixman_region32_init(&region);
+	wl_list_for_each(output, &compositor->output_list, link) {
+		pixman_region32_intersect(&region,
+					  &view->transform.boundingbox,
+					  &output->region);
+		expected = pixman_region32_not_empty(&region);
+		assert(weston_output_mask_test(&view->output_mask,
+					       output->id) == expected);
+	}
+	pixman_region32_fini(&region);
+
+	assert(weston_output_mask_equal(&view->output_mask,
+					&view->surface->output_mask));
+}
+
+static void
+output_mask_test(void *data)
+{
+	struct weston_compositor *compositor = data;
+	const struct weston_windowed_output_api *api;
+	struct weston_output *output, *last = NULL;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct weston_output_mask ids;
+	struct timespec begin, end;
+	char name[32];
+	int n = 0, i;
+
+	api = weston_windowed_output_get_api(compositor);
+	assert(api);
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		n++;
+
+	while (n < NUM_OUTPUTS) {
+		snprintf(name, sizeof name, "headless-%d", n);
+		assert(api->output_create(compositor, name) == 0);
+		n++;
+	}
+
+	/* Every output got enabled, with a unique id. */
+	n = 0;
+	weston_output_mask_init(&ids);
+	wl_list_for_each(output, &compositor->output_list, link) {
+		assert(!weston_output_mask_test(&ids, output->id));
+		assert(weston_output_mask_set(&ids, output->id) == 0);
+		last = output;
+		n++;
+	}
+	assert(n == NUM_OUTPUTS);
+	assert(weston_output_mask_first_unset(&ids) == NUM_OUTPUTS);
+	weston_output_mask_fini(&ids);
+
+	/* A view straddling the two last outputs. */
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+	surface->width = 200;
+	surface->height = 200;
+	weston_view_set_position(view, last->x - 100, last->y);
+	weston_view_update_transform(view);
+	check_view_mask(compositor, view);
+	assert(weston_output_mask_test(&view->output_mask, last->id));
+	assert(!weston_output_mask_is_only(&view->output_mask, last->id));
+
+	weston_view_set_position(view, last->x + 10, last->y);
+	weston_view_update_transform(view);
+	check_view_mask(compositor, view);
+	assert(weston_output_mask_is_only(&view->output_mask, last->id));
+
+	/* Off all outputs. */
+	weston_view_set_position(view, last->x, last->y - 1000);
+	weston_view_update_transform(view);
+	check_view_mask(compositor, view);
+	assert(weston_output_mask_is_empty(&view->output_mask));
+
+	/* Sweep the view across all outputs. */
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < NUM_ASSIGNS; i++) {
+		weston_view_set_position(view,
+					 (int64_t) i * (last->x + last->width) /
+					 NUM_ASSIGNS - 100, last->y);
+		weston_view_update_transform(view);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	check_view_mask(compositor, view);
+
+	timespec_sub(&end, &end, &begin);
+	fprintf(stderr, "%d outputs: %lld ns per weston_view_assign_output\n",
+		NUM_OUTPUTS, (long long) timespec_to_nsec(&end) / NUM_ASSIGNS);
+
+	weston_view_destroy(view);
+	weston_surface_destroy(surface);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, output_mask_test, compositor);
+
+	return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/* Checks weston_compositor_pick_view() against a plain walk of the view
+ * list, and reports how long both take per pick. */
+
+#define NUM_VIEWS 500
+#define NUM_PICKS 20000
+
+struct pick_test {
+	struct weston_compositor *compositor;
+	struct weston_layer layer;
+	struct weston_view *views[NUM_VIEWS];
+	struct wl_event_source *timer;
+	struct weston_output *output;
+	pixman_box32_t area;
+};
+
+static struct weston_view *
+linear_pick_view(struct weston_compositor *compositor,
+		 wl_fixed_t x, wl_fixed_t y, wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_view *view;
+	wl_fixed_t view_x, view_y;
+	int view_ix, view_iy;
+	int ix = wl_fixed_to_int(x);
+	int iy = wl_fixed_to_int(y);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!pixman_region32_contains_point(
+				&view->transform.boundingbox, ix, iy, NULL))
+			continue;
+
+		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+		view_ix = wl_fixed_to_int(view_x);
+		view_iy = wl_fixed_to_int(view_y);
+
+		if (!pixman_region32_contains_point(&view->surface->input,
+						    view_ix, view_iy, NULL))
+			continue;
+
+		if (view->geometry.scissor_enabled &&
+		    !pixman_region32_contains_point(&view->geometry.scissor,
+						    view_ix, view_iy, NULL))
+			continue;
+
+		*vx = view_x;
+		*vy = view_y;
+		return view;
+	}
+
+	return NULL;
+}
+
+static int
+random_in(int min, int max)
+{
+	return min + rand() % (max - min);
+}
+
+static void
+random_point(struct pick_test *pt, wl_fixed_t *x, wl_fixed_t *y)
+{
+	*x = wl_fixed_from_int(random_in(pt->area.x1, pt->area.x2));
+	*y = wl_fixed_from_int(random_in(pt->area.y1, pt->area.y2));
+}
+
+static void
+check_picks(struct pick_test *pt)
+{
+	struct weston_view *a, *b;
+	wl_fixed_t x, y, ax, ay, bx, by;
+	int i;
+
+	for (i = 0; i < NUM_PICKS / 10; i++) {
+		random_point(pt, &x, &y);
+		a = weston_compositor_pick_view(pt->compositor, x, y, &ax, &ay);
+		b = linear_pick_view(pt->compositor, x, y, &bx, &by);
+		assert(a == b);
+		if (a)
+			assert(ax == bx && ay == by);
+	}
+}
+
+static int64_t
+time_picks(struct pick_test *pt, bool linear)
+{
+	struct timespec begin, end;
+	wl_fixed_t x, y, vx, vy;
+	int i;
+
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < NUM_PICKS; i++) {
+		random_point(pt, &x, &y);
+		if (linear)
+			linear_pick_view(pt->compositor, x, y, &vx, &vy);
+		else
+			weston_compositor_pick_view(pt->compositor,
+						    x, y, &vx, &vy);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	timespec_sub(&end, &end, &begin);
+
+	return timespec_to_nsec(&end) / NUM_PICKS;
+}
+
+static int
+run_checks(void *data)
+{
+	struct pick_test *pt = data;
+	int i;
+
+	/* Wait for a repaint to pull our views into the view list. */
+	if (wl_list_empty(&pt->views[0]->link)) {
+		wl_event_source_timer_update(pt->timer, 16);
+		return 0;
+	}
+
+	check_picks(pt);
+
+	fprintf(stderr, "%d views: grid %lld ns/pick, linear %lld ns/pick\n",
+		NUM_VIEWS,
+		(long long) time_picks(pt, false),
+		(long long) time_picks(pt, true));
+
+	/* Moving views must be reflected right after the transform
+	 * update. */
+	for (i = 0; i < NUM_VIEWS; i += 7) {
+		weston_view_set_position(pt->views[i],
+					 random_in(pt->area.x1, pt->area.x2),
+					 random_in(pt->area.y1, pt->area.y2));
+		weston_view_update_transform(pt->views[i]);
+	}
+	check_picks(pt);
+
+	/* So must unmapping them. */
+	for (i = 0; i < NUM_VIEWS; i += 5)
+		weston_view_unmap(pt->views[i]);
+	check_picks(pt);
+
+	/* Views moving partly or fully out of the output area and back
+	 * only update the cells they touch. */
+	for (i = 1; i < NUM_VIEWS; i += 3) {
+		weston_view_set_position(pt->views[i],
+					 pt->area.x2 - 10, pt->area.y1 - 10);
+		weston_view_update_transform(pt->views[i]);
+	}
+	check_picks(pt);
+
+	for (i = 1; i < NUM_VIEWS; i += 6) {
+		weston_view_set_position(pt->views[i],
+					 random_in(pt->area.x1, pt->area.x2),
+					 random_in(pt->area.y1, pt->area.y2));
+		weston_view_update_transform(pt->views[i]);
+	}
+	check_picks(pt);
+
+	/* Moving the output changes the grid area. */
+	weston_output_move(pt->output, pt->area.x1 + 200, pt->area.y1);
+	check_picks(pt);
+	weston_output_move(pt->output, pt->area.x1, pt->area.y1);
+	check_picks(pt);
+
+	wl_event_source_remove(pt->timer);
+	wl_display_terminate(pt->compositor->wl_display);
+
+	return 0;
+}
+
+static void
+pick_view_setup(void *data)
+{
+	struct pick_test *pt = data;
+	struct weston_compositor *compositor = pt->compositor;
+	struct weston_output *output;
+	struct weston_surface *surface;
+	struct wl_event_loop *loop;
+	int i;
+
+	output = container_of(compositor->output_list.next,
+			      struct weston_output, link);
+	pt->output = output;
+	pt->area = *pixman_region32_extents(&output->region);
+
+	weston_layer_init(&pt->layer, &compositor->cursor_layer.link);
+
+	srand(0);
+	for (i = 0; i < NUM_VIEWS; i++) {
+		surface = weston_surface_create(compositor);
+		assert(surface);
+		surface->width = random_in(8, 300);
+		surface->height = random_in(8, 300);
+
+		pt->views[i] = weston_view_create(surface);
+		assert(pt->views[i]);
+		weston_view_set_position(pt->views[i],
+					 random_in(pt->area.x1 - 100,
+						   pt->area.x2),
+					 random_in(pt->area.y1 - 100,
+						   pt->area.y2));
+		weston_layer_entry_insert(&pt->layer.view_list,
+					  &pt->views[i]->layer_link);
+		weston_view_update_transform(pt->views[i]);
+	}
+
+	/* Some views have holes in their input region. */
+	for (i = 0; i < NUM_VIEWS; i += 3) {
+		surface = pt->views[i]->surface;
+		pixman_region32_fini(&surface->input);
+		pixman_region32_init_rect(&surface->input, 0, 0,
+					  surface->width / 2,
+					  surface->height);
+	}
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	pt->timer = wl_event_loop_add_timer(loop, run_checks, pt);
+	wl_event_source_timer_update(pt->timer, 16);
+
+	weston_compositor_schedule_repaint(compositor);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	static struct pick_test pt;
+	struct wl_event_loop *loop;
+
+	pt.compositor = compositor;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, pick_view_setup, &pt);
+
+	return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures what the pixman renderer's shadow buffer costs: the same
+ * scene is repainted on a pixman output created with and without
+ * PIXMAN_RENDERER_OUTPUT_USE_SHADOW, through the compositor's repaint
+ * loop, timing pixman_renderer_repaint_output() itself. Views are solid
+ * colors, as there are no clients to attach buffers.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "pixman-renderer.h"
+#include "presentation-time-server-protocol.h"
+#include "shared/helpers.h"
+#include "shared/zalloc.h"
+
+#define ROUNDS 20
+
+struct bench_output {
+	struct weston_output base;
+	struct weston_mode mode;
+	uint32_t flags;
+	pixman_image_t *hw_buffer;
+	struct wl_event_source *finish_frame_timer;
+
+	int frames;
+	double render_time;
+};
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static inline struct bench_output *
+to_bench_output(struct weston_output *base)
+{
+	return container_of(base, struct bench_output, base);
+}
+
+static void
+bench_output_start_repaint_loop(struct weston_output *output)
+{
+	struct timespec ts;
+
+	weston_compositor_read_presentation_clock(output->compositor, &ts);
+	weston_output_finish_frame(output, &ts,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
+}
+
+/* Every frame repaints the whole output. */
+static int
+finish_frame_handler(void *data)
+{
+	struct bench_output *output = data;
+	struct timespec ts;
+
+	if (output->frames < ROUNDS)
+		weston_output_damage(&output->base);
+
+	weston_compositor_read_presentation_clock(output->base.compositor,
+						  &ts);
+	weston_output_finish_frame(&output->base, &ts, 0);
+
+	return 1;
+}
+
+static int
+bench_output_repaint(struct weston_output *base, pixman_region32_t *damage)
+{
+	struct bench_output *output = to_bench_output(base);
+	struct weston_compositor *ec = base->compositor;
+
+	reset_timer();
+	ec->renderer->repaint_output(base, damage);
+	output->render_time += read_timer();
+	output->frames++;
+
+	pixman_region32_subtract(&ec->primary_plane.damage,
+				 &ec->primary_plane.damage, damage);
+
+	wl_event_source_timer_update(output->finish_frame_timer, 1);
+
+	return 0;
+}
+
+static int
+bench_output_enable(struct weston_output *base)
+{
+	struct bench_output *output = to_bench_output(base);
+	struct wl_event_loop *loop;
+
+	if (pixman_renderer_output_create(base, output->flags) < 0)
+		return -1;
+
+	pixman_renderer_output_set_buffer(base, output->hw_buffer);
+
+	loop = wl_display_get_event_loop(base->compositor->wl_display);
+	output->finish_frame_timer =
+		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+
+	return 0;
+}
+
+static void
+bench_output_destroy(struct weston_output *base)
+{
+	struct bench_output *output = to_bench_output(base);
+
+	if (base->enabled) {
+		wl_event_source_remove(output->finish_frame_timer);
+		pixman_renderer_output_destroy(base);
+	}
+	weston_output_destroy(base);
+}
+
+static void
+bench_backend_destroy(struct weston_compositor *ec)
+{
+	weston_compositor_shutdown(ec);
+}
+
+static struct weston_backend bench_backend = {
+	.destroy = bench_backend_destroy,
+};
+
+static struct weston_surface *
+add_view(struct weston_compositor *ec, struct weston_layer *layer,
+	 int x, int y, int width, int height, float alpha)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(ec);
+	view = weston_view_create(surface);
+
+	weston_surface_set_color(surface, 0.25, 0.5, 0.75, alpha);
+	surface->width = width;
+	surface->height = height;
+	if (alpha == 1.0)
+		pixman_region32_union_rect(&surface->opaque, &surface->opaque,
+					   0, 0, width, height);
+	surface->is_mapped = true;
+	view->is_mapped = true;
+
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&layer->view_list, &view->layer_link);
+	weston_surface_damage(surface);
+
+	return surface;
+}
+
+/* An opaque background and a few translucent windows on top. */
+static double
+run(int width, int height, uint32_t flags)
+{
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct weston_compositor *ec;
+	struct bench_output *output;
+	struct weston_layer layer;
+	struct weston_surface *surfaces[5];
+	double t;
+	int i;
+
+	display = wl_display_create();
+	ec = weston_compositor_create(display, NULL);
+	if (!ec || weston_compositor_set_presentation_clock_software(ec) < 0 ||
+	    pixman_renderer_init(ec) < 0) {
+		fprintf(stderr, "failed to set up the compositor\n");
+		exit(EXIT_FAILURE);
+	}
+	ec->backend = &bench_backend;
+
+	output = zalloc(sizeof *output);
+	output->flags = flags;
+	output->hw_buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						     width, height, NULL, 0);
+
+	output->mode.flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
+	output->mode.width = width;
+	output->mode.height = height;
+	output->mode.refresh = 60000;
+	output->base.name = strdup("bench");
+	output->base.destroy = bench_output_destroy;
+	output->base.enable = bench_output_enable;
+	output->base.start_repaint_loop = bench_output_start_repaint_loop;
+	output->base.repaint = bench_output_repaint;
+
+	weston_output_init(&output->base, ec);
+	wl_list_init(&output->base.mode_list);
+	wl_list_insert(&output->base.mode_list, &output->mode.link);
+	output->base.current_mode = &output->mode;
+	weston_output_set_scale(&output->base, 1);
+	weston_output_set_transform(&output->base, WL_OUTPUT_TRANSFORM_NORMAL);
+	weston_compositor_add_pending_output(&output->base, ec);
+	if (weston_output_enable(&output->base) < 0) {
+		fprintf(stderr, "failed to enable the output\n");
+		exit(EXIT_FAILURE);
+	}
+
+	weston_layer_init(&layer, &ec->cursor_layer.link);
+	surfaces[0] = add_view(ec, &layer, 0, 0, width, height, 1.0);
+	for (i = 0; i < 4; i++)
+		surfaces[i + 1] = add_view(ec, &layer,
+					   i * width / 8, i * height / 8,
+					   width / 2, height / 2, 0.5);
+
+	loop = wl_display_get_event_loop(display);
+	while (output->frames < ROUNDS)
+		wl_event_loop_dispatch(loop, -1);
+	t = output->render_time / output->frames;
+
+	for (i = 0; i < 5; i++)
+		weston_surface_destroy(surfaces[i]);
+	wl_list_remove(&layer.link);
+
+	pixman_image_unref(output->hw_buffer);
+	weston_compositor_destroy(ec);
+	free(output);
+	wl_display_destroy(display);
+
+	return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct {
+		int width, height;
+	} sizes[] = {
+		{ 1280, 720 },
+		{ 1920, 1080 },
+		{ 3840, 2160 },
+	};
+	unsigned i;
+
+	printf("Full frame repaints, averages over %d frames.\n\n", ROUNDS);
+	printf("%11s %12s %12s %8s %14s\n", "size", "shadow ms", "direct ms",
+	       "saved", "copy MiB/frame");
+
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		int w = sizes[i].width, h = sizes[i].height;
+		double shadow = run(w, h, PIXMAN_RENDERER_OUTPUT_USE_SHADOW);
+		double direct = run(w, h, 0);
+
+		/* The copy reads the shadow and writes the hw buffer. */
+		printf("%5dx%-5d %12.2f %12.2f %7.1f%% %14.1f\n", w, h,
+		       1e3 * shadow, 1e3 * direct,
+		       100.0 * (shadow - direct) / shadow,
+		       2.0 * w * h * 4 / (1024 * 1024));
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -26,11 +26,13 @@
 #include "config.h"
 
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #include "weston-test-runner.h"
 
 #include "shared/helpers.h"
+#include "shared/matrix.h"
 #include "vertex-clipping.h"
 
 #define BOUNDING_BOX_TOP_Y 100.0f
@@ -221,3 +223,171 @@ TEST(float_difference_same)
 	assert(float_difference(1.0f, 1.0f) == 0.0f);
 }
 
+
+TEST_P(clip_quad_expected_vertices, test_data)
+{
+	struct vertex_clip_test_data *tdata = data;
+	struct clip_context ctx;
+	struct clip_quad quad;
+	float vertices_x[8];
+	float vertices_y[8];
+	int emitted, i, round;
+
+	populate_clip_context(&ctx);
+	clip_quad_init(&quad, &tdata->surface, false);
+
+	/* The quad stays intact, so clipping it again gives the same. */
+	for (round = 0; round < 2; round++) {
+		emitted = clip_quad(&ctx, &quad, vertices_x, vertices_y);
+		assert(emitted == tdata->expected.n);
+
+		for (i = 0; i < emitted; i++) {
+			assert(vertices_x[i] == tdata->expected.x[i]);
+			assert(vertices_y[i] == tdata->expected.y[i]);
+		}
+	}
+}
+
+TEST(clip_quad_outside_bounding_box)
+{
+	struct polygon8 polygon = {
+		{ OUTSIDE_X2, OUTSIDE_X2 + 10.0f,
+		  OUTSIDE_X2 + 10.0f, OUTSIDE_X2 },
+		{ INSIDE_Y1, INSIDE_Y1, INSIDE_Y2, INSIDE_Y2 },
+		4
+	};
+	struct clip_context ctx;
+	struct clip_quad quad;
+	float vertices_x[8];
+	float vertices_y[8];
+
+	populate_clip_context(&ctx);
+	clip_quad_init(&quad, &polygon, true);
+
+	assert(quad.bbox.x1 == OUTSIDE_X2);
+	assert(quad.bbox.x2 == OUTSIDE_X2 + 10.0f);
+	assert(clip_quad(&ctx, &quad, vertices_x, vertices_y) == 0);
+}
+
+static void
+transform_point(struct weston_matrix *m, float x, float y,
+		float *tx, float *ty)
+{
+	struct weston_vector v = { { x, y, 0.0f, 1.0f } };
+
+	weston_matrix_transform(m, &v);
+	*tx = v.f[0] / v.f[3];
+	*ty = v.f[1] / v.f[3];
+}
+
+static void
+surface_polygon(struct weston_matrix *view, const float *r,
+		struct polygon8 *surf)
+{
+	float x[4] = { r[0], r[2], r[2], r[0] };
+	float y[4] = { r[1], r[1], r[3], r[3] };
+	int i;
+
+	surf->n = 4;
+	for (i = 0; i < 4; i++)
+		transform_point(view, x[i], y[i], &surf->x[i], &surf->y[i]);
+}
+
+/* The GL renderer caches the surface rectangles of a view as quads in
+ * global coordinates, and maps the clipped vertices to texture
+ * coordinates with a single matrix. Compare that with clipping fresh
+ * polygons and mapping every vertex back through the view and buffer
+ * transformations, as it did before. */
+static void
+check_cached_geometry(const struct texcoord_layout *layout)
+{
+	static const float surf_rects[][4] = {
+		{ 0, 0, 200, 20 },
+		{ 0, 20, 200, 150 },
+	};
+	struct weston_matrix view, inverse, surface_to_buffer, texcoord;
+	struct clip_quad quads[ARRAY_LENGTH(surf_rects)];
+	struct clip_context ctx;
+	struct polygon8 surf;
+	float ex[8], ey[8], cx[8], cy[8];
+	float sx, sy, bx, by, s, t;
+	int j, k, n, nc, x, y;
+
+	weston_matrix_init(&view);
+	weston_matrix_translate(&view, -100, -75, 0);
+	weston_matrix_rotate_xy(&view, cosf(M_PI / 7), sinf(M_PI / 7));
+	weston_matrix_translate(&view, 160, 120, 0);
+	assert(weston_matrix_invert(&inverse, &view) == 0);
+
+	/* A scale 2 buffer */
+	weston_matrix_init(&surface_to_buffer);
+	weston_matrix_scale(&surface_to_buffer, 2, 2, 1);
+
+	texcoord = inverse;
+	weston_matrix_multiply(&texcoord, &surface_to_buffer);
+	texcoord_matrix_append(&texcoord, layout);
+
+	for (j = 0; j < (int) ARRAY_LENGTH(surf_rects); j++) {
+		surface_polygon(&view, surf_rects[j], &surf);
+		clip_quad_init(&quads[j], &surf, false);
+	}
+
+	/* Damage rectangles all over the view and its surroundings */
+	for (y = 0; y < 260; y += 23) {
+		for (x = 0; x < 340; x += 29) {
+			ctx.clip.x1 = x;
+			ctx.clip.y1 = y;
+			ctx.clip.x2 = x + 41;
+			ctx.clip.y2 = y + 17;
+
+			for (j = 0; j < (int) ARRAY_LENGTH(surf_rects); j++) {
+				surface_polygon(&view, surf_rects[j], &surf);
+				n = clip_transformed(&ctx, &surf, ex, ey);
+				if (n < 3)
+					n = 0;
+
+				nc = clip_quad(&ctx, &quads[j], cx, cy);
+				assert(nc == n);
+
+				for (k = 0; k < n; k++) {
+					assert(cx[k] == ex[k]);
+					assert(cy[k] == ey[k]);
+
+					transform_point(&inverse, ex[k], ey[k],
+							&sx, &sy);
+					transform_point(&surface_to_buffer,
+							sx, sy, &bx, &by);
+					if (!layout->y_inverted)
+						by = layout->height - by;
+
+					texcoord_from_global(&texcoord,
+							     cx[k], cy[k],
+							     &s, &t);
+					assert(fabsf(s - (layout->x + bx) *
+						     layout->inv_width) < 1e-5);
+					assert(fabsf(t - (layout->y + by) *
+						     layout->inv_height) < 1e-5);
+				}
+			}
+		}
+	}
+}
+
+TEST(cached_geometry_matches_recomputed)
+{
+	/* A texture of its own */
+	struct texcoord_layout plain = {
+		true, 300, 0, 0, 1.0f / 400, 1.0f / 300
+	};
+	/* An entry in an atlas, and one stored bottom up */
+	struct texcoord_layout atlas = {
+		true, 300, 17, 33, 1.0f / 1024, 1.0f / 1024
+	};
+	struct texcoord_layout flipped = {
+		false, 300, 17, 33, 1.0f / 1024, 1.0f / 1024
+	};
+
+	check_cached_geometry(&plain);
+	check_cached_geometry(&atlas);
+	check_cached_geometry(&flipped);
+}
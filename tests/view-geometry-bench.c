@@ -0,0 +1,305 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares two ways the GL renderer can produce the vertices of rotated
+ * views for a frame: transforming the surface rectangles and every vertex
+ * again for each damage rectangle, and clipping surface quads cached in
+ * global coordinates with a single global to texture coordinate matrix.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared/matrix.h"
+#include "vertex-clipping.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define ROUNDS 200
+
+#define VIEW_WIDTH 480
+#define VIEW_HEIGHT 360
+#define N_VIEWS 12
+
+struct box {
+	float x1, y1, x2, y2;
+};
+
+struct view {
+	struct weston_matrix matrix;		/* surface to global */
+	struct weston_matrix inverse;
+	struct weston_matrix surface_to_buffer;
+	struct weston_matrix texcoord;		/* global to texture */
+	struct clip_quad quads[2];
+};
+
+/* The title bar and the body, like an opaque and a translucent part */
+static const struct box surf_rects[] = {
+	{ 0, 0, VIEW_WIDTH, 32 },
+	{ 0, 32, VIEW_WIDTH, VIEW_HEIGHT },
+};
+#define N_SURF_RECTS (sizeof surf_rects / sizeof surf_rects[0])
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static void
+transform(const struct weston_matrix *m, float x, float y,
+	  float *tx, float *ty)
+{
+	struct weston_vector v = { { x, y, 0.0f, 1.0f } };
+
+	weston_matrix_transform((struct weston_matrix *) m, &v);
+	*tx = v.f[0] / v.f[3];
+	*ty = v.f[1] / v.f[3];
+}
+
+static void
+surface_polygon(const struct view *view, const struct box *r,
+		struct polygon8 *surf)
+{
+	float x[4] = { r->x1, r->x2, r->x2, r->x1 };
+	float y[4] = { r->y1, r->y1, r->y2, r->y2 };
+	int i;
+
+	surf->n = 4;
+	for (i = 0; i < 4; i++)
+		transform(&view->matrix, x[i], y[i], &surf->x[i], &surf->y[i]);
+}
+
+static void
+init_view(struct view *view, int i)
+{
+	float angle = (5.0f + 30.0f * i) * M_PI / 180.0f;
+	struct texcoord_layout layout = {
+		true, 2 * VIEW_HEIGHT, 0, 0,
+		1.0f / (2 * VIEW_WIDTH), 1.0f / (2 * VIEW_HEIGHT)
+	};
+	struct polygon8 surf;
+	unsigned j;
+
+	weston_matrix_init(&view->matrix);
+	weston_matrix_translate(&view->matrix,
+				-VIEW_WIDTH / 2.0f, -VIEW_HEIGHT / 2.0f, 0);
+	weston_matrix_rotate_xy(&view->matrix, cosf(angle), sinf(angle));
+	weston_matrix_translate(&view->matrix,
+				240 + (i % 4) * 480, 180 + (i / 4) * 360, 0);
+	weston_matrix_invert(&view->inverse, &view->matrix);
+
+	/* A scale 2 buffer */
+	weston_matrix_init(&view->surface_to_buffer);
+	weston_matrix_scale(&view->surface_to_buffer, 2, 2, 1);
+
+	view->texcoord = view->inverse;
+	weston_matrix_multiply(&view->texcoord, &view->surface_to_buffer);
+	texcoord_matrix_append(&view->texcoord, &layout);
+
+	for (j = 0; j < N_SURF_RECTS; j++) {
+		surface_polygon(view, &surf_rects[j], &surf);
+		clip_quad_init(&view->quads[j], &surf, false);
+	}
+}
+
+/* Lots of small updates, like video and blinking cursors. */
+static int
+make_damage(struct box *damage, int n)
+{
+	int i, w, h;
+
+	for (i = 0; i < n; i++) {
+		w = 8 + rand() % 120;
+		h = 8 + rand() % 60;
+		damage[i].x1 = rand() % (WIDTH - w);
+		damage[i].y1 = rand() % (HEIGHT - h);
+		damage[i].x2 = damage[i].x1 + w;
+		damage[i].y2 = damage[i].y1 + h;
+	}
+
+	return n;
+}
+
+/* What texture_region() did for every vertex before the cache */
+static int
+emit_uncached(struct view *view, const struct box *damage, int n,
+	      float *out)
+{
+	struct clip_context ctx;
+	struct clip_quad quad;
+	struct polygon8 surf;
+	float ex[8], ey[8], sx, sy, bx, by;
+	int i, j, k, nv, count = 0;
+
+	for (i = 0; i < n; i++) {
+		ctx.clip.x1 = damage[i].x1;
+		ctx.clip.y1 = damage[i].y1;
+		ctx.clip.x2 = damage[i].x2;
+		ctx.clip.y2 = damage[i].y2;
+
+		for (j = 0; j < (int) N_SURF_RECTS; j++) {
+			surface_polygon(view, &surf_rects[j], &surf);
+			clip_quad_init(&quad, &surf, false);
+			nv = clip_quad(&ctx, &quad, ex, ey);
+
+			for (k = 0; k < nv; k++) {
+				transform(&view->inverse, ex[k], ey[k],
+					  &sx, &sy);
+				transform(&view->surface_to_buffer, sx, sy,
+					  &bx, &by);
+				*out++ = ex[k];
+				*out++ = ey[k];
+				*out++ = bx / (2 * VIEW_WIDTH);
+				*out++ = by / (2 * VIEW_HEIGHT);
+			}
+			count += nv;
+		}
+	}
+
+	return count;
+}
+
+static int
+emit_cached(struct view *view, const struct box *damage, int n, float *out)
+{
+	struct clip_context ctx;
+	float ex[8], ey[8];
+	int i, j, k, nv, count = 0;
+
+	for (i = 0; i < n; i++) {
+		ctx.clip.x1 = damage[i].x1;
+		ctx.clip.y1 = damage[i].y1;
+		ctx.clip.x2 = damage[i].x2;
+		ctx.clip.y2 = damage[i].y2;
+
+		for (j = 0; j < (int) N_SURF_RECTS; j++) {
+			nv = clip_quad(&ctx, &view->quads[j], ex, ey);
+
+			for (k = 0; k < nv; k++) {
+				*out++ = ex[k];
+				*out++ = ey[k];
+				texcoord_from_global(&view->texcoord,
+						     ex[k], ey[k],
+						     &out[0], &out[1]);
+				out += 2;
+			}
+			count += nv;
+		}
+	}
+
+	return count;
+}
+
+static void
+run(struct view *views, int n_damage)
+{
+	struct box *damage = malloc(n_damage * sizeof *damage);
+	size_t size = (size_t) n_damage * N_SURF_RECTS * 8 * 4;
+	float *a = malloc(size * sizeof *a);
+	float *b = malloc(size * sizeof *b);
+	double uncached_time = 0.0, cached_time = 0.0, error = 0.0;
+	long vertices = 0;
+	int i, j, v, n, na, nb;
+
+	if (!damage || !a || !b) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	srand(n_damage);
+
+	for (i = 0; i < ROUNDS; i++) {
+		n = make_damage(damage, n_damage);
+
+		for (v = 0; v < N_VIEWS; v++) {
+			reset_timer();
+			na = emit_uncached(&views[v], damage, n, a);
+			uncached_time += read_timer();
+
+			reset_timer();
+			nb = emit_cached(&views[v], damage, n, b);
+			cached_time += read_timer();
+
+			if (na != nb) {
+				fprintf(stderr, "vertex count mismatch\n");
+				exit(EXIT_FAILURE);
+			}
+			for (j = 0; j < na * 4; j++)
+				error = fmax(error, fabs(a[j] - b[j]));
+			vertices += na;
+		}
+	}
+
+	printf("%8d %10.1f %12.1f %12.1f %12.2g\n",
+	       n_damage, (double) vertices / ROUNDS,
+	       1e6 * uncached_time / ROUNDS, 1e6 * cached_time / ROUNDS,
+	       error);
+
+	free(damage);
+	free(a);
+	free(b);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int n_damage[] = { 16, 64, 256, 1024 };
+	struct view views[N_VIEWS];
+	unsigned i;
+
+	for (i = 0; i < N_VIEWS; i++)
+		init_view(&views[i], i);
+
+	printf("Averages over %d frames of %d rotated %dx%d views on "
+	       "%dx%d.\n\n", ROUNDS, N_VIEWS, VIEW_WIDTH, VIEW_HEIGHT,
+	       WIDTH, HEIGHT);
+	printf("%8s %10s %12s %12s %12s\n", "damage", "vertices",
+	       "uncached us", "cached us", "max error");
+
+	for (i = 0; i < sizeof n_damage / sizeof n_damage[0]; i++)
+		run(views, n_damage[i]);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures the wcap delta/RLE kernels on a 4K output: encoding full
+ * frames the way the recorder does, and decoding them with the wcap
+ * decoder, for every set of kernels the CPU supports.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wcap/wcap-decode.h"
+#include "wcap/wcap-rle.h"
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define N_FRAMES 8
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+enum content {
+	CONTENT_DESKTOP,	/* flat areas with some changes */
+	CONTENT_GRADIENT,	/* smooth shading, runs of equal deltas */
+	CONTENT_NOISE,		/* nothing to compress */
+};
+
+static const char * const content_names[] = {
+	"desktop", "gradient", "noise"
+};
+
+static void
+next_frame(uint32_t *frame, enum content content, int n)
+{
+	int x, y, i;
+
+	switch (content) {
+	case CONTENT_DESKTOP:
+		for (i = 0; i < 64; i++) {
+			x = rand() % (WIDTH - 200);
+			y = rand() % (HEIGHT - 40);
+			for (; y % 40 < 39; y++)
+				memset(frame + y * WIDTH + x, rand(), 200 * 4);
+		}
+		break;
+	case CONTENT_GRADIENT:
+		for (y = 0; y < HEIGHT; y++)
+			for (x = 0; x < WIDTH; x++)
+				frame[y * WIDTH + x] =
+					((x + n) / 15 * 0x010101) +
+					(y / 9 * 0x000100);
+		break;
+	case CONTENT_NOISE:
+		for (i = 0; i < WIDTH * HEIGHT; i++)
+			frame[i] = rand();
+		break;
+	}
+}
+
+static int
+encode(const struct wcap_rle_kernels *kernels, uint32_t *ref,
+       const uint32_t *src, uint32_t *out)
+{
+	struct wcap_rle_encoder encoder;
+	int j;
+
+	wcap_rle_encoder_init(&encoder, out);
+	for (j = HEIGHT - 1; j >= 0; j--)
+		kernels->encode_row(&encoder, src + j * WIDTH,
+				    ref + j * WIDTH, WIDTH);
+
+	return wcap_rle_encoder_finish(&encoder) - out;
+}
+
+static void
+write_all(int fd, const void *data, size_t size)
+{
+	if (write(fd, data, size) != (ssize_t) size) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Encodes the frames with every set of kernels and writes the output
+ * of the last one to fd. */
+static void
+run_encode(uint32_t **frames, int fd)
+{
+	struct wcap_header_v2 header = {
+		WCAP_HEADER_MAGIC_V2, WCAP_FORMAT_XRGB8888, WIDTH, HEIGHT,
+		WCAP_VERSION, 0
+	};
+	struct wcap_frame_header_v2 frame_header;
+	struct wcap_rectangle_v2 rect = { 0, 0, WIDTH, HEIGHT, 0, 0 };
+	const struct wcap_rle_kernels *kernels;
+	uint32_t *ref, *out;
+	int i, n, len;
+	double t;
+
+	ref = malloc(WIDTH * HEIGHT * 4);
+	out = malloc(WIDTH * HEIGHT * 4);
+	if (!ref || !out)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; (kernels = wcap_rle_kernels_get(i)); i++) {
+		memset(ref, 0, WIDTH * HEIGHT * 4);
+		lseek(fd, 0, SEEK_SET);
+		if (ftruncate(fd, 0) < 0)
+			exit(EXIT_FAILURE);
+		write_all(fd, &header, sizeof header);
+
+		t = 0;
+		for (n = 0; n < N_FRAMES; n++) {
+			reset_timer();
+			len = encode(kernels, ref, frames[n], out);
+			t += read_timer();
+
+			rect.size = len * 4;
+			frame_header.msecs = n * 16;
+			frame_header.nrects = 1;
+			frame_header.flags = 0;
+			frame_header.size = sizeof rect + rect.size;
+			write_all(fd, &frame_header, sizeof frame_header);
+			write_all(fd, &rect, sizeof rect);
+			write_all(fd, out, rect.size);
+		}
+
+		printf("  encode %-6s %10.1f Mpixels/s\n", kernels->name,
+		       (double) WIDTH * HEIGHT * N_FRAMES / t / 1e6);
+	}
+
+	free(ref);
+	free(out);
+}
+
+static void
+run_decode(const char *file)
+{
+	const struct wcap_rle_kernels *kernels;
+	struct wcap_decoder *decoder;
+	int i;
+	double t;
+
+	for (i = 0; (kernels = wcap_rle_kernels_get(i)); i++) {
+		decoder = wcap_decoder_create(file);
+		if (!decoder)
+			exit(EXIT_FAILURE);
+		decoder->rle = kernels;
+
+		reset_timer();
+		while (wcap_decoder_get_frame(decoder))
+			;
+		t = read_timer();
+
+		printf("  decode %-6s %10.1f Mpixels/s\n", kernels->name,
+		       (double) WIDTH * HEIGHT * decoder->count / t / 1e6);
+		wcap_decoder_destroy(decoder);
+	}
+}
+
+static void
+run(enum content content)
+{
+	char file[] = "/tmp/weston-wcap-rle-bench-XXXXXX";
+	uint32_t *frames[N_FRAMES];
+	int fd, n;
+
+	srand(1);
+	for (n = 0; n < N_FRAMES; n++) {
+		frames[n] = malloc(WIDTH * HEIGHT * 4);
+		if (!frames[n])
+			exit(EXIT_FAILURE);
+		if (n == 0)
+			memset(frames[n], 0x20, WIDTH * HEIGHT * 4);
+		else
+			memcpy(frames[n], frames[n - 1], WIDTH * HEIGHT * 4);
+		next_frame(frames[n], content, n);
+	}
+
+	fd = mkstemp(file);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%s:\n", content_names[content]);
+	run_encode(frames, fd);
+	close(fd);
+	run_decode(file);
+	unlink(file);
+
+	for (n = 0; n < N_FRAMES; n++)
+		free(frames[n]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	printf("%d frames of %dx%d, fastest kernels: %s\n\n",
+	       N_FRAMES, WIDTH, HEIGHT, wcap_rle_kernels_best()->name);
+
+	run(CONTENT_DESKTOP);
+	run(CONTENT_GRADIENT);
+	run(CONTENT_NOISE);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,432 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "wcap/wcap-decode.h"
+#include "wcap/wcap-rle.h"
+
+#define WIDTH 61
+#define HEIGHT 23
+#define N_FRAMES 16
+
+/* The scalar encoder from before the kernels, which defines the
+ * bitstream. */
+static uint32_t *
+reference_output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t
+reference_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+/* Rows go from bottom to top, like in the recorder. */
+static int
+reference_encode(uint32_t *ref, const uint32_t *src,
+		 int width, int height, uint32_t *out)
+{
+	uint32_t *p = out, *d, delta, prev = 0;
+	const uint32_t *s;
+	int j, k, run = 0;
+
+	for (j = height - 1; j >= 0; j--) {
+		s = src + j * width;
+		d = ref + j * width;
+		for (k = 0; k < width; k++) {
+			delta = reference_delta(s[k], d[k]);
+			d[k] = s[k];
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = reference_output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+	}
+
+	return reference_output_run(p, prev, run) - out;
+}
+
+static int
+kernel_encode(const struct wcap_rle_kernels *kernels, uint32_t *ref,
+	      const uint32_t *src, int width, int height, uint32_t *out)
+{
+	struct wcap_rle_encoder encoder;
+	int j;
+
+	wcap_rle_encoder_init(&encoder, out);
+	for (j = height - 1; j >= 0; j--)
+		kernels->encode_row(&encoder, src + j * width,
+				    ref + j * width, width);
+
+	return wcap_rle_encoder_finish(&encoder) - out;
+}
+
+/* Unchanged frames, noise, gradients and small updates, with random
+ * bits in the X byte that must not matter. */
+static void
+next_frame(uint32_t *frame, int n, int width, int height)
+{
+	int i, count = width * height;
+
+	switch (n % 4) {
+	case 0:
+		break;
+	case 1:
+		for (i = 0; i < count; i++)
+			frame[i] = rand();
+		break;
+	case 2:
+		for (i = 0; i < count; i++)
+			frame[i] = (rand() & 0xff000000) |
+				   ((i / 37) * 0x010203);
+		break;
+	case 3:
+		for (i = 0; i < 20; i++)
+			frame[rand() % count] ^= rand();
+		break;
+	}
+}
+
+static void
+encode_frames(int width, int height)
+{
+	const struct wcap_rle_kernels *kernels;
+	int count = width * height;
+	uint32_t *frame, *ref, *ref_kernel, *out, *out_kernel;
+	int i, n, len, len_kernel;
+
+	frame = calloc(count, 4);
+	ref = calloc(count, 4);
+	ref_kernel = calloc(count, 4);
+	out = calloc(count, 4);
+	out_kernel = calloc(count, 4);
+	assert(frame && ref && ref_kernel && out && out_kernel);
+
+	for (i = 0; (kernels = wcap_rle_kernels_get(i)); i++) {
+		srand(1);
+		memset(frame, 0, count * 4);
+		memset(ref, 0, count * 4);
+		memset(ref_kernel, 0, count * 4);
+
+		for (n = 0; n < N_FRAMES; n++) {
+			next_frame(frame, n, width, height);
+			len = reference_encode(ref, frame, width, height, out);
+			len_kernel = kernel_encode(kernels, ref_kernel, frame,
+						   width, height, out_kernel);
+
+			assert(len <= count);
+			assert(len_kernel == len);
+			assert(memcmp(out, out_kernel, len * 4) == 0);
+			assert(memcmp(ref, ref_kernel, count * 4) == 0);
+		}
+	}
+
+	free(frame);
+	free(ref);
+	free(ref_kernel);
+	free(out);
+	free(out_kernel);
+}
+
+TEST(rle_kernels_match_reference)
+{
+	int width;
+
+	for (width = 1; width <= 40; width++)
+		encode_frames(width, 3);
+
+	encode_frames(WIDTH, HEIGHT);
+}
+
+/* Runs longer than 0xe0 pixels are split in power of two pieces. */
+TEST(rle_kernels_long_runs)
+{
+	encode_frames(4099, 5);
+}
+
+static void
+write_all(int fd, const void *data, size_t size)
+{
+	assert(write(fd, data, size) == (ssize_t) size);
+}
+
+/* Writes a version 2 file without an index, all frames covering the
+ * whole screen and run-length encoded, and keeps the expected frames. */
+static void
+write_capture(int fd, uint32_t *expected)
+{
+	struct wcap_header_v2 header = {
+		WCAP_HEADER_MAGIC_V2, WCAP_FORMAT_XRGB8888, WIDTH, HEIGHT,
+		WCAP_VERSION, 0
+	};
+	struct wcap_frame_header_v2 frame_header;
+	struct wcap_rectangle_v2 rect = { 0, 0, WIDTH, HEIGHT, 0, 0 };
+	uint32_t frame[WIDTH * HEIGHT], ref[WIDTH * HEIGHT];
+	uint32_t out[WIDTH * HEIGHT];
+	int i, n, len;
+
+	write_all(fd, &header, sizeof header);
+
+	srand(2);
+	memset(frame, 0, sizeof frame);
+	memset(ref, 0, sizeof ref);
+	for (n = 0; n < N_FRAMES; n++) {
+		next_frame(frame, n, WIDTH, HEIGHT);
+		len = reference_encode(ref, frame, WIDTH, HEIGHT, out);
+
+		rect.size = len * 4;
+		frame_header.msecs = n * 16;
+		frame_header.nrects = 1;
+		frame_header.flags = 0;
+		frame_header.size = sizeof rect + rect.size;
+		write_all(fd, &frame_header, sizeof frame_header);
+		write_all(fd, &rect, sizeof rect);
+		write_all(fd, out, rect.size);
+
+		for (i = 0; i < WIDTH * HEIGHT; i++)
+			expected[n * WIDTH * HEIGHT + i] =
+				0xff000000 | frame[i];
+	}
+}
+
+TEST(rle_round_trip)
+{
+	const struct wcap_rle_kernels *kernels;
+	struct wcap_decoder *decoder;
+	char file[] = "/tmp/weston-wcap-rle-test-XXXXXX";
+	uint32_t *expected;
+	int fd, i, n;
+
+	expected = calloc(N_FRAMES * WIDTH * HEIGHT, 4);
+	assert(expected);
+
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	write_capture(fd, expected);
+	close(fd);
+
+	for (i = 0; (kernels = wcap_rle_kernels_get(i)); i++) {
+		decoder = wcap_decoder_create(file);
+		assert(decoder);
+		assert(decoder->nframes == N_FRAMES);
+		decoder->rle = kernels;
+
+		for (n = 0; n < N_FRAMES; n++) {
+			assert(wcap_decoder_get_frame(decoder));
+			assert(memcmp(decoder->frame,
+				      expected + n * WIDTH * HEIGHT,
+				      WIDTH * HEIGHT * 4) == 0);
+		}
+		assert(!wcap_decoder_get_frame(decoder));
+
+		/* Going back decodes again from the start. */
+		assert(wcap_decoder_seek(decoder, 5) == 0);
+		assert(memcmp(decoder->frame, expected + 5 * WIDTH * HEIGHT,
+			      WIDTH * HEIGHT * 4) == 0);
+
+		wcap_decoder_destroy(decoder);
+	}
+
+	unlink(file);
+	free(expected);
+}
+
+#define KEY_FRAME_INTERVAL 4
+#define RAW_X 7
+#define RAW_Y 5
+#define RAW_WIDTH 11
+#define RAW_HEIGHT 9
+
+/* Writes a version 2 file like the recorder does: run-length encoded
+ * key frames, updates in raw rectangles in between, and the index at
+ * the end. Keeps the expected frames and the offset of the last one. */
+static off_t
+write_indexed_capture(int fd, uint32_t *expected)
+{
+	struct wcap_header_v2 header = {
+		WCAP_HEADER_MAGIC_V2, WCAP_FORMAT_XRGB8888, WIDTH, HEIGHT,
+		WCAP_VERSION, 0
+	};
+	struct wcap_frame_header_v2 frame_header;
+	struct wcap_rectangle_v2 rect;
+	struct wcap_index_entry index[N_FRAMES];
+	struct wcap_index_trailer trailer;
+	uint32_t frame[WIDTH * HEIGHT], ref[WIDTH * HEIGHT];
+	uint32_t out[WIDTH * HEIGHT];
+	int i, x, y, n, len;
+
+	write_all(fd, &header, sizeof header);
+
+	srand(3);
+	memset(frame, 0, sizeof frame);
+	for (n = 0; n < N_FRAMES; n++) {
+		index[n].offset = lseek(fd, 0, SEEK_CUR);
+		index[n].msecs = n * 16;
+
+		if (n % KEY_FRAME_INTERVAL == 0) {
+			next_frame(frame, n / KEY_FRAME_INTERVAL,
+				   WIDTH, HEIGHT);
+			memset(ref, 0, sizeof ref);
+			len = reference_encode(ref, frame, WIDTH, HEIGHT, out);
+			rect = (struct wcap_rectangle_v2) {
+				0, 0, WIDTH, HEIGHT, 0, len * 4
+			};
+			frame_header.flags = WCAP_FRAME_KEYFRAME;
+		} else {
+			len = 0;
+			for (y = RAW_Y; y < RAW_Y + RAW_HEIGHT; y++)
+				for (x = RAW_X; x < RAW_X + RAW_WIDTH; x++)
+					out[len++] = frame[y * WIDTH + x] =
+						rand();
+			rect = (struct wcap_rectangle_v2) {
+				RAW_X, RAW_Y, RAW_X + RAW_WIDTH,
+				RAW_Y + RAW_HEIGHT, WCAP_RECTANGLE_RAW, len * 4
+			};
+			frame_header.flags = 0;
+		}
+
+		index[n].flags = frame_header.flags;
+		frame_header.msecs = index[n].msecs;
+		frame_header.nrects = 1;
+		frame_header.size = sizeof rect + rect.size;
+		write_all(fd, &frame_header, sizeof frame_header);
+		write_all(fd, &rect, sizeof rect);
+		write_all(fd, out, rect.size);
+
+		for (i = 0; i < WIDTH * HEIGHT; i++)
+			expected[n * WIDTH * HEIGHT + i] =
+				0xff000000 | frame[i];
+	}
+
+	trailer.index_offset = lseek(fd, 0, SEEK_CUR);
+	trailer.count = N_FRAMES;
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	frame_header = (struct wcap_frame_header_v2) {
+		0, 0, WCAP_FRAME_INDEX, sizeof index
+	};
+	write_all(fd, &frame_header, sizeof frame_header);
+	write_all(fd, index, sizeof index);
+	write_all(fd, &trailer, sizeof trailer);
+
+	return index[N_FRAMES - 1].offset;
+}
+
+static void
+check_frames(struct wcap_decoder *decoder, const uint32_t *expected,
+	     int nframes)
+{
+	int n;
+
+	assert(decoder->nframes == (uint32_t) nframes);
+	for (n = 0; n < nframes; n++) {
+		assert(wcap_decoder_get_frame(decoder));
+		assert(decoder->msecs == (uint32_t) n * 16);
+		assert(memcmp(decoder->frame, expected + n * WIDTH * HEIGHT,
+			      WIDTH * HEIGHT * 4) == 0);
+	}
+	assert(!wcap_decoder_get_frame(decoder));
+
+	/* Straight to a key frame, then to a frame after one. */
+	for (n = KEY_FRAME_INTERVAL; n < nframes; n += KEY_FRAME_INTERVAL) {
+		assert(decoder->index[n].flags & WCAP_FRAME_KEYFRAME);
+		assert(wcap_decoder_seek(decoder, n) == 0);
+		assert(memcmp(decoder->frame, expected + n * WIDTH * HEIGHT,
+			      WIDTH * HEIGHT * 4) == 0);
+	}
+	assert(wcap_decoder_seek(decoder, KEY_FRAME_INTERVAL + 2) == 0);
+	assert(memcmp(decoder->frame,
+		      expected + (KEY_FRAME_INTERVAL + 2) * WIDTH * HEIGHT,
+		      WIDTH * HEIGHT * 4) == 0);
+	assert(wcap_decoder_seek(decoder, nframes) == -1);
+}
+
+TEST(indexed_round_trip)
+{
+	struct wcap_decoder *decoder;
+	char file[] = "/tmp/weston-wcap-index-test-XXXXXX";
+	uint32_t *expected;
+	off_t last;
+	int fd;
+
+	expected = calloc(N_FRAMES * WIDTH * HEIGHT, 4);
+	assert(expected);
+
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	last = write_indexed_capture(fd, expected);
+
+	decoder = wcap_decoder_create(file);
+	assert(decoder);
+	check_frames(decoder, expected, N_FRAMES);
+	wcap_decoder_destroy(decoder);
+
+	/* Cut short in the middle of the last frame, the index is gone
+	 * and has to be rebuilt from the remaining frames. */
+	assert(ftruncate(fd, last + 20) == 0);
+	close(fd);
+
+	decoder = wcap_decoder_create(file);
+	assert(decoder);
+	check_frames(decoder, expected, N_FRAMES - 1);
+	wcap_decoder_destroy(decoder);
+
+	unlink(file);
+	free(expected);
+}
@@ -115,6 +115,33 @@ move_client(struct client *client, int x, int y)
 	frame_callback_wait(client, &done);
 }
 
+/* Commits the surface's buffer again, fully damaged, with a frame
+ * callback setting *done. */
+void
+commit_with_frame(struct client *client, int *done)
+{
+	struct surface *surface = client->surface;
+
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0,
+			  surface->width, surface->height);
+	frame_callback_set(surface->wl_surface, done);
+	wl_surface_commit(surface->wl_surface);
+}
+
+/* Marks the whole surface opaque, from its next commit on. */
+void
+set_opaque(struct client *client)
+{
+	struct surface *surface = client->surface;
+	struct wl_region *region;
+
+	region = wl_compositor_create_region(client->wl_compositor);
+	wl_region_add(region, 0, 0, surface->width, surface->height);
+	wl_surface_set_opaque_region(surface->wl_surface, region);
+	wl_region_destroy(region);
+}
+
 int
 get_n_egl_buffers(struct client *client)
 {
@@ -170,6 +170,12 @@ surface_contains(struct surface *surface, int x, int y);
 void
 move_client(struct client *client, int x, int y);
 
+void
+commit_with_frame(struct client *client, int *done);
+
+void
+set_opaque(struct client *client);
+
 #define client_roundtrip(c) do { \
 	assert(wl_display_roundtrip((c)->wl_display) >= 0); \
 } while (0)
@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "yuv-convert.h"
+
+#define WIDTH 37
+#define HEIGHT 11
+#define GUARD 0xdeadbeef
+
+/* BT.601 limited range, in floating point. */
+static uint8_t
+reference_channel(double v)
+{
+	v = round(v);
+	return v < 0.0 ? 0 : v > 255.0 ? 255 : v;
+}
+
+static uint32_t
+reference_pixel(uint8_t y8, uint8_t u8, uint8_t v8)
+{
+	double y = 1.16438356 * (y8 - 16.0);
+	double u = u8 - 128.0;
+	double v = v8 - 128.0;
+
+	return 0xff000000 |
+	       reference_channel(y + 1.59602678 * v) << 16 |
+	       reference_channel(y - 0.39176229 * u - 0.81296764 * v) << 8 |
+	       reference_channel(y + 2.01723214 * u);
+}
+
+static int
+channel_diff(uint32_t a, uint32_t b, int shift)
+{
+	return abs((int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff));
+}
+
+static void
+assert_pixel_close(uint32_t pixel, uint32_t ref)
+{
+	assert((pixel >> 24) == 0xff);
+	assert(channel_diff(pixel, ref, 16) <= 1);
+	assert(channel_diff(pixel, ref, 8) <= 1);
+	assert(channel_diff(pixel, ref, 0) <= 1);
+}
+
+struct image {
+	uint8_t y[WIDTH * HEIGHT];
+	/* planar U and V, or interleaved UV */
+	uint8_t uv[2 * ((WIDTH + 1) / 2) * ((HEIGHT + 1) / 2)];
+	uint32_t rgb[WIDTH * HEIGHT];
+};
+
+static void
+fill_random(struct image *img, unsigned seed)
+{
+	unsigned i;
+
+	srand(seed);
+	for (i = 0; i < ARRAY_LENGTH(img->y); i++)
+		img->y[i] = rand();
+	for (i = 0; i < ARRAY_LENGTH(img->uv); i++)
+		img->uv[i] = rand();
+	for (i = 0; i < ARRAY_LENGTH(img->rgb); i++)
+		img->rgb[i] = GUARD;
+}
+
+static void
+planes_init(struct yuv_planes *planes, struct image *img, int uv_step)
+{
+	int uv_width = (WIDTH + 1) / 2;
+
+	planes->y = img->y;
+	planes->y_stride = WIDTH;
+	planes->uv_step = uv_step;
+	if (uv_step == 1) {
+		planes->u = img->uv;
+		planes->v = img->uv + uv_width * ((HEIGHT + 1) / 2);
+		planes->uv_stride = uv_width;
+	} else {
+		planes->u = img->uv;
+		planes->v = img->uv + 1;
+		planes->uv_stride = uv_width * 2;
+	}
+}
+
+/* Every combination, spread over one planar image row by row. */
+TEST(yuv_full_range)
+{
+	uint8_t y[256], u[128], v[128];
+	uint32_t rgb[256];
+	struct yuv_planes planes = {
+		.y = y, .u = u, .v = v,
+		.y_stride = 0, .uv_stride = 0, .uv_step = 1,
+	};
+	int i, j, k, x;
+
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 256; j += 2) {
+			for (x = 0; x < 256; x++)
+				y[x] = x;
+			for (k = 0; k < 128; k++) {
+				u[k] = i;
+				v[k] = (j + 2 * k) & 0xff;
+			}
+
+			yuv_to_xrgb8888(rgb, 0, &planes, 0, 0, 256, 1);
+
+			for (x = 0; x < 256; x++)
+				assert_pixel_close(rgb[x],
+						   reference_pixel(y[x],
+								   u[x / 2],
+								   v[x / 2]));
+		}
+	}
+}
+
+struct rect {
+	int x1, y1, x2, y2;
+};
+
+static const struct rect rects[] = {
+	{ 0, 0, WIDTH, HEIGHT },
+	{ 1, 1, WIDTH - 1, HEIGHT - 1 },
+	{ 3, 2, 4, 3 },
+	{ 8, 0, 25, 5 },
+	{ 17, 5, WIDTH, HEIGHT },
+};
+
+static void
+check_rect(int uv_step, const struct rect *r)
+{
+	struct image img;
+	struct yuv_planes planes;
+	int x, y, c;
+	uint32_t pixel;
+
+	fill_random(&img, r->x1 * 100 + r->y1);
+	planes_init(&planes, &img, uv_step);
+
+	yuv_to_xrgb8888(img.rgb, WIDTH * 4, &planes,
+			r->x1, r->y1, r->x2, r->y2);
+
+	for (y = 0; y < HEIGHT; y++) {
+		for (x = 0; x < WIDTH; x++) {
+			pixel = img.rgb[y * WIDTH + x];
+
+			/* Only the rectangle, or a pixel left of it, may be
+			 * written. */
+			if (y < r->y1 || y >= r->y2 || x >= r->x2 ||
+			    x < (r->x1 & ~1)) {
+				assert(pixel == GUARD);
+				continue;
+			}
+			if (x < r->x1 && pixel == GUARD)
+				continue;
+
+			c = (y / 2) * planes.uv_stride + (x / 2) * uv_step;
+			assert_pixel_close(pixel,
+					   reference_pixel(img.y[y * WIDTH + x],
+							   planes.u[c],
+							   planes.v[c]));
+		}
+	}
+}
+
+TEST_P(yuv420_rect, rects)
+{
+	check_rect(1, data);
+}
+
+TEST_P(nv12_rect, rects)
+{
+	check_rect(2, data);
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Converts a binary weston timeline log into the JSON format used by
+ * Wesgr, or into the Chrome trace event format that can be loaded in
+ * chrome://tracing and Perfetto.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "libweston/timeline-format.h"
+
+/* Upper bound for name and object ids, which index dense arrays. The
+ * compositor allocates them sequentially, so anything above this is a
+ * corrupt record rather than a long session. */
+#define MAX_RECORD_ID (1u << 24)
+
+enum output_format {
+	FORMAT_JSON,
+	FORMAT_CHROME,
+};
+
+struct timeline_object {
+	uint32_t type;
+	uint32_t main_surface;
+	char *desc;
+};
+
+struct converter {
+	enum output_format format;
+	FILE *out;
+
+	char **names;
+	uint32_t n_names;
+
+	struct timeline_object *objects;
+	uint32_t n_objects;
+
+	int first_event;
+};
+
+static void
+usage(int exit_code)
+{
+	fprintf(stderr, "usage: weston-timeline-convert "
+		"[--help] [--chrome] <timeline file>\n\n"
+		"\t--help\t\tthis help text\n"
+		"\t--chrome\twrite Chrome trace event format instead of "
+		"JSON\n\n"
+		"The result is written to stdout.\n");
+
+	exit(exit_code);
+}
+
+/* Returns NULL if index is out of the accepted range, in which case
+ * array is left untouched. */
+static void *
+grow_array(void *array, uint32_t *n, uint32_t index, size_t elem_size)
+{
+	uint32_t count = *n;
+	char *p;
+
+	if (index < count)
+		return array;
+
+	if (index >= MAX_RECORD_ID ||
+	    (size_t)index + 16 > SIZE_MAX / elem_size)
+		return NULL;
+
+	count = index + 16;
+	p = realloc(array, count * elem_size);
+	if (!p) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(p + *n * elem_size, 0, (count - *n) * elem_size);
+	*n = count;
+
+	return p;
+}
+
+static char *
+read_file(const char *filename, size_t *size)
+{
+	FILE *fp;
+	char *data = NULL, *p;
+	size_t alloc = 0, len = 0, n;
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		perror(filename);
+		return NULL;
+	}
+
+	do {
+		if (len == alloc) {
+			alloc = alloc ? alloc * 2 : 1 << 20;
+			p = realloc(data, alloc);
+			if (!p) {
+				free(data);
+				fclose(fp);
+				return NULL;
+			}
+			data = p;
+		}
+		n = fread(data + len, 1, alloc - len, fp);
+		len += n;
+	} while (n > 0);
+
+	fclose(fp);
+	*size = len;
+
+	return data;
+}
+
+static void
+print_string(FILE *fp, const char *str)
+{
+	if (!str) {
+		fprintf(fp, "null");
+		return;
+	}
+
+	fputc('"', fp);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(fp, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(fp, "\\u%04x", *str);
+		else
+			fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static const char *
+lookup_name(struct converter *conv, uint32_t id)
+{
+	if (id == 0 || id > conv->n_names || !conv->names[id - 1])
+		return "unknown";
+
+	return conv->names[id - 1];
+}
+
+static struct timeline_object *
+lookup_object(struct converter *conv, uint32_t id)
+{
+	if (id >= conv->n_objects)
+		return NULL;
+
+	return &conv->objects[id];
+}
+
+static int64_t
+arg_vblank_sec(const struct weston_timeline_arg *arg)
+{
+	return (int64_t)((uint64_t)arg->v[1] << 32 | arg->v[0]);
+}
+
+/* Checks that a record of at least fixed_size bytes ends in a NUL
+ * terminated string within rec->size. */
+static int
+record_string_valid(const struct weston_timeline_record *rec,
+		    size_t fixed_size)
+{
+	if (rec->size <= fixed_size)
+		return 0;
+
+	return memchr((const char *)rec + fixed_size, '\0',
+		      rec->size - fixed_size) != NULL;
+}
+
+static int
+handle_string(struct converter *conv,
+	      const struct weston_timeline_string *rec)
+{
+	char **names;
+
+	if (rec->id == 0 || !record_string_valid(&rec->rec, sizeof *rec))
+		return -1;
+
+	names = grow_array(conv->names, &conv->n_names,
+			   rec->id - 1, sizeof(char *));
+	if (!names)
+		return -1;
+
+	conv->names = names;
+	free(conv->names[rec->id - 1]);
+	conv->names[rec->id - 1] = strdup(rec->str);
+
+	return 0;
+}
+
+static void
+chrome_begin_event(struct converter *conv)
+{
+	if (!conv->first_event)
+		fprintf(conv->out, ",\n");
+	conv->first_event = 0;
+}
+
+static int
+handle_object(struct converter *conv,
+	      const struct weston_timeline_object_desc *rec)
+{
+	struct timeline_object *objects, *obj;
+	const char *desc;
+	FILE *out = conv->out;
+
+	if (rec->rec.size < sizeof *rec)
+		return -1;
+
+	if (rec->has_desc && !record_string_valid(&rec->rec, sizeof *rec))
+		return -1;
+
+	objects = grow_array(conv->objects, &conv->n_objects,
+			     rec->id, sizeof *conv->objects);
+	if (!objects)
+		return -1;
+
+	conv->objects = objects;
+	desc = rec->has_desc ? rec->desc : NULL;
+	obj = &conv->objects[rec->id];
+	free(obj->desc);
+	obj->type = rec->type;
+	obj->main_surface = rec->main_surface;
+	obj->desc = desc ? strdup(desc) : NULL;
+
+	switch (conv->format) {
+	case FORMAT_JSON:
+		if (rec->type == WESTON_TIMELINE_OBJECT_OUTPUT) {
+			fprintf(out, "{ \"id\":%u, "
+				"\"type\":\"weston_output\", \"name\":",
+				rec->id);
+			print_string(out, desc);
+			fprintf(out, " }\n");
+		} else {
+			fprintf(out, "{ \"id\":%u, "
+				"\"type\":\"weston_surface\", \"desc\":",
+				rec->id);
+			print_string(out, desc);
+			if (rec->main_surface)
+				fprintf(out, ", \"main_surface\":%u",
+					rec->main_surface);
+			fprintf(out, " }\n");
+		}
+		break;
+	case FORMAT_CHROME:
+		/* Each output gets its own track. */
+		if (rec->type != WESTON_TIMELINE_OBJECT_OUTPUT)
+			break;
+		chrome_begin_event(conv);
+		fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":1,\"tid\":%u,\"args\":{\"name\":", rec->id);
+		print_string(out, desc ? desc : "output");
+		fprintf(out, "}}");
+		break;
+	}
+
+	return 0;
+}
+
+static void
+print_json_point(struct converter *conv,
+		 const struct weston_timeline_point *rec, int64_t sec)
+{
+	const struct weston_timeline_arg *arg;
+	FILE *out = conv->out;
+	uint32_t i;
+
+	fprintf(out, "{ \"T\":[%" PRId64 ", %u], \"N\":\"%s\"",
+		sec, rec->tv_nsec, lookup_name(conv, rec->name));
+
+	for (i = 0; i < rec->n_args; i++) {
+		arg = &rec->args[i];
+
+		switch (arg->type) {
+		case WESTON_TIMELINE_ARG_OUTPUT:
+			fprintf(out, ", \"wo\":%u", arg->v[0]);
+			break;
+		case WESTON_TIMELINE_ARG_SURFACE:
+			fprintf(out, ", \"ws\":%u", arg->v[0]);
+			break;
+		case WESTON_TIMELINE_ARG_VBLANK:
+			fprintf(out, ", \"vblank\":[%" PRId64 ", %u]",
+				arg_vblank_sec(arg), arg->v[2]);
+			break;
+		case WESTON_TIMELINE_ARG_REPAINT_TIMING:
+			fprintf(out, ", \"delay_us\":%d, \"predicted_us\":%d, "
+				"\"frames\":%u, \"missed\":%u",
+				(int32_t)arg->v[0], (int32_t)arg->v[1],
+				arg->v[2], arg->v[3]);
+			break;
+		}
+	}
+
+	fprintf(out, " }\n");
+}
+
+static void
+print_chrome_point(struct converter *conv,
+		   const struct weston_timeline_point *rec, int64_t sec)
+{
+	const struct weston_timeline_arg *arg;
+	const struct weston_timeline_arg *timing = NULL;
+	struct timeline_object *obj;
+	const char *name = lookup_name(conv, rec->name);
+	const char *event_name = name;
+	const char *phase = "\"ph\":\"i\",\"s\":\"t\"";
+	FILE *out = conv->out;
+	uint32_t tid = 0;
+	uint32_t i;
+
+	for (i = 0; i < rec->n_args; i++) {
+		if (rec->args[i].type == WESTON_TIMELINE_ARG_OUTPUT)
+			tid = rec->args[i].v[0];
+		else if (rec->args[i].type ==
+			 WESTON_TIMELINE_ARG_REPAINT_TIMING)
+			timing = &rec->args[i];
+	}
+
+	/* Show the span from repaint start to the backend taking it as a
+	 * duration slice on the output track. */
+	if (strcmp(name, "core_repaint_begin") == 0) {
+		event_name = "repaint";
+		phase = "\"ph\":\"B\"";
+	} else if (strcmp(name, "core_repaint_posted") == 0) {
+		event_name = "repaint";
+		phase = "\"ph\":\"E\"";
+	}
+
+	chrome_begin_event(conv);
+	fprintf(out, "{\"name\":\"%s\",%s,\"pid\":1,\"tid\":%u,"
+		"\"ts\":%" PRId64 ".%03u,\"args\":{",
+		event_name, phase, tid,
+		sec * 1000000 + rec->tv_nsec / 1000, rec->tv_nsec % 1000);
+
+	for (i = 0; i < rec->n_args; i++) {
+		arg = &rec->args[i];
+
+		if (i > 0)
+			fputc(',', out);
+
+		switch (arg->type) {
+		case WESTON_TIMELINE_ARG_OUTPUT:
+			fprintf(out, "\"wo\":%u", arg->v[0]);
+			break;
+		case WESTON_TIMELINE_ARG_SURFACE:
+			fprintf(out, "\"ws\":%u,\"surface\":", arg->v[0]);
+			obj = lookup_object(conv, arg->v[0]);
+			print_string(out, obj ? obj->desc : NULL);
+			break;
+		case WESTON_TIMELINE_ARG_VBLANK:
+			fprintf(out, "\"vblank_us\":%" PRId64 ".%03u",
+				arg_vblank_sec(arg) * 1000000 +
+				arg->v[2] / 1000, arg->v[2] % 1000);
+			break;
+		case WESTON_TIMELINE_ARG_REPAINT_TIMING:
+			fprintf(out, "\"delay_us\":%d,\"predicted_us\":%d,"
+				"\"frames\":%u,\"missed\":%u",
+				(int32_t)arg->v[0], (int32_t)arg->v[1],
+				arg->v[2], arg->v[3]);
+			break;
+		default:
+			fprintf(out, "\"unknown\":%u", arg->type);
+			break;
+		}
+	}
+	fprintf(out, "}}");
+
+	if (!timing)
+		return;
+
+	chrome_begin_event(conv);
+	fprintf(out, "{\"name\":\"repaint delay %u\",\"ph\":\"C\","
+		"\"pid\":1,\"ts\":%" PRId64 ".%03u,"
+		"\"args\":{\"delay_us\":%d,\"predicted_us\":%d,"
+		"\"missed\":%u}}", tid,
+		sec * 1000000 + rec->tv_nsec / 1000, rec->tv_nsec % 1000,
+		(int32_t)timing->v[0], (int32_t)timing->v[1], timing->v[3]);
+}
+
+static int
+handle_point(struct converter *conv, const struct weston_timeline_point *rec)
+{
+	int64_t sec;
+
+	if (rec->rec.size < sizeof *rec ||
+	    rec->n_args > WESTON_TIMELINE_MAX_ARGS ||
+	    rec->n_args * sizeof(struct weston_timeline_arg) >
+	    rec->rec.size - sizeof *rec)
+		return -1;
+
+	sec = (int64_t)((uint64_t)rec->tv_sec_hi << 32 | rec->tv_sec_lo);
+
+	switch (conv->format) {
+	case FORMAT_JSON:
+		print_json_point(conv, rec, sec);
+		break;
+	case FORMAT_CHROME:
+		print_chrome_point(conv, rec, sec);
+		break;
+	}
+
+	return 0;
+}
+
+static int
+convert(struct converter *conv, const char *data, size_t size)
+{
+	const struct weston_timeline_file_header *header = (const void *)data;
+	const struct weston_timeline_record *rec;
+	size_t pos = sizeof *header;
+	int ret;
+
+	if (size < sizeof *header ||
+	    header->magic != WESTON_TIMELINE_MAGIC) {
+		fprintf(stderr, "not a weston timeline file\n");
+		return -1;
+	}
+
+	if (header->version != WESTON_TIMELINE_VERSION) {
+		fprintf(stderr, "unsupported timeline version %u\n",
+			header->version);
+		return -1;
+	}
+
+	if (conv->format == FORMAT_CHROME)
+		fprintf(conv->out, "{\"displayTimeUnit\":\"ms\","
+			"\"traceEvents\":[\n");
+
+	while (pos + sizeof *rec <= size) {
+		rec = (const void *)(data + pos);
+
+		if (rec->size < sizeof *rec || rec->size % 4 ||
+		    pos + rec->size > size) {
+			fprintf(stderr, "truncated or corrupt record at "
+				"offset %zu\n", pos);
+			break;
+		}
+
+		switch (rec->type) {
+		case WESTON_TIMELINE_RECORD_STRING:
+			ret = handle_string(conv, (const void *)rec);
+			break;
+		case WESTON_TIMELINE_RECORD_OBJECT:
+			ret = handle_object(conv, (const void *)rec);
+			break;
+		case WESTON_TIMELINE_RECORD_POINT:
+			ret = handle_point(conv, (const void *)rec);
+			break;
+		default:
+			/* Skip records we do not know about. */
+			ret = 0;
+			break;
+		}
+
+		if (ret < 0)
+			fprintf(stderr, "skipping invalid record of type %u "
+				"at offset %zu\n", rec->type, pos);
+
+		pos += rec->size;
+	}
+
+	if (conv->format == FORMAT_CHROME)
+		fprintf(conv->out, "\n]}\n");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct converter conv = {
+		.format = FORMAT_JSON,
+		.out = stdout,
+		.first_event = 1,
+	};
+	char *data;
+	size_t size;
+	uint32_t i;
+	int i_arg, j, ret;
+
+	for (i_arg = 1, j = 1; i_arg < argc; i_arg++) {
+		if (strcmp(argv[i_arg], "--chrome") == 0) {
+			conv.format = FORMAT_CHROME;
+		} else if (strcmp(argv[i_arg], "--help") == 0) {
+			usage(EXIT_SUCCESS);
+		} else if (strcmp(argv[i_arg], "--") == 0) {
+			break;
+		} else if (argv[i_arg][0] == '-') {
+			fprintf(stderr,
+				"unknown option or invalid argument: %s\n",
+				argv[i_arg]);
+			usage(EXIT_FAILURE);
+		} else {
+			argv[j++] = argv[i_arg];
+		}
+	}
+	argc = j;
+
+	if (argc != 2)
+		usage(EXIT_FAILURE);
+
+	data = read_file(argv[1], &size);
+	if (!data)
+		return EXIT_FAILURE;
+
+	ret = convert(&conv, data, size);
+
+	for (i = 0; i < conv.n_names; i++)
+		free(conv.names[i]);
+	free(conv.names);
+	for (i = 0; i < conv.n_objects; i++)
+		free(conv.objects[i].desc);
+	free(conv.objects);
+	free(data);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -36,17 +36,20 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
 static void
-write_png(struct wcap_decoder *decoder, const char *filename)
+write_png(struct wcap_decoder *decoder, uint32_t *frame, const char *filename)
 {
 	cairo_surface_t *surface;
 
-	surface = cairo_image_surface_create_for_data((unsigned char *) decoder->frame,
+	surface = cairo_image_surface_create_for_data((unsigned char *) frame,
 						      CAIRO_FORMAT_ARGB32,
 						      decoder->width,
 						      decoder->height,
@@ -99,7 +102,8 @@ int clamp_uv(int u)
 }
 
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, uint32_t *frame,
+		unsigned char *out)
 {
 	unsigned char *y1, *y2, *u, *v;
 	uint32_t *p1, *p2, *end;
@@ -113,7 +117,7 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
 		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
+		p1 = frame + decoder->width * i;
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
@@ -138,7 +142,8 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, uint32_t *frame,
+		  unsigned char *out)
 {
 
 	unsigned char *yp, *up, *vp;
@@ -153,7 +158,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
+		rp = frame + decoder->width * i;
 		end = rp + decoder->width;
 		while (rp < end) {
 			u = 0;
@@ -169,28 +174,233 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
+static size_t
+yuv_frame_size(struct wcap_decoder *decoder, int depth)
+{
+	if (depth == 444)
+		return decoder->width * decoder->height * 3;
+	else
+		return decoder->width * decoder->height * 3 / 2;
+}
+
+/* Frames are decoded on the main thread, converted by a pool of worker
+ * threads and written out in order on the main thread again. */
+struct job {
+	uint32_t *frame;
+	unsigned char *yuv;
+	int png;	/* number of the png file to write, or -1 */
+	bool done;
+};
+
+struct pipeline {
+	struct wcap_decoder *decoder;
+	int depth;	/* yuv4mpeg2 output, 420 or 444, or 0 */
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int nthreads;
+	bool quit;
+
+	/* Jobs are used round robin.  The counters only increase. */
+	struct job *jobs;
+	int njobs;
+	unsigned int submitted, started, written;
+};
+
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+run_job(struct pipeline *p, struct job *job)
 {
-	static unsigned char *out;
-	int size;
+	char filename[200];
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
+	if (job->png >= 0) {
+		snprintf(filename, sizeof filename,
+			 "wcap-frame-%d.png", job->png);
+		write_png(p->decoder, job->frame, filename);
 	}
-	if (out == NULL)
-		out = malloc(size);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
+	if (p->depth == 444)
+		convert_to_yuv444(p->decoder, job->frame, job->yuv);
+	else if (p->depth)
+		convert_to_yv12(p->decoder, job->frame, job->yuv);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pipeline *p = data;
+	struct job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		while (p->started == p->submitted && !p->quit)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->started == p->submitted)
+			break;
+
+		job = &p->jobs[p->started++ % p->njobs];
+		pthread_mutex_unlock(&p->mutex);
+
+		run_job(p, job);
+
+		pthread_mutex_lock(&p->mutex);
+		job->done = true;
+		pthread_cond_broadcast(&p->cond);
 	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+static void
+write_job(struct pipeline *p, struct job *job)
+{
+	if (job->png >= 0)
+		fprintf(stderr, "wrote wcap-frame-%d.png\n", job->png);
+
+	if (p->depth) {
+		printf("FRAME\n");
+		fwrite(job->yuv, 1, yuv_frame_size(p->decoder, p->depth),
+		       stdout);
+	}
+}
+
+/* Writes out finished jobs in order, waiting for them until no more
+ * than limit jobs are in flight. */
+static void
+pipeline_flush(struct pipeline *p, unsigned int limit)
+{
+	struct job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	while (p->written < p->submitted) {
+		job = &p->jobs[p->written % p->njobs];
+		if (!job->done && p->submitted - p->written <= limit)
+			break;
+		while (!job->done)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		pthread_mutex_unlock(&p->mutex);
+
+		write_job(p, job);
+
+		pthread_mutex_lock(&p->mutex);
+		job->done = false;
+		p->written++;
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static void
+pipeline_submit(struct pipeline *p, int png)
+{
+	struct wcap_decoder *decoder = p->decoder;
+	struct job *job;
+
+	pipeline_flush(p, p->njobs - 1);
+
+	job = &p->jobs[p->submitted % p->njobs];
+	memcpy(job->frame, decoder->frame,
+	       decoder->width * decoder->height * 4);
+	job->png = png;
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	pthread_mutex_lock(&p->mutex);
+	p->submitted++;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static void
+pipeline_fini(struct pipeline *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->mutex);
+	p->quit = true;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	for (i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	for (i = 0; p->jobs && i < p->njobs; i++) {
+		free(p->jobs[i].frame);
+		free(p->jobs[i].yuv);
+	}
+	free(p->jobs);
+	free(p->threads);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mutex);
+}
+
+static int
+pipeline_init(struct pipeline *p, struct wcap_decoder *decoder,
+	      int depth, int nthreads)
+{
+	size_t frame_size = decoder->width * decoder->height * 4;
+	int i;
+
+	memset(p, 0, sizeof *p);
+	p->decoder = decoder;
+	p->depth = depth;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	/* Two jobs per thread keep the workers busy while the main
+	 * thread decodes and writes. */
+	p->njobs = nthreads * 2;
+	p->jobs = calloc(p->njobs, sizeof *p->jobs);
+	p->threads = calloc(nthreads, sizeof *p->threads);
+	if (p->jobs == NULL || p->threads == NULL)
+		goto err;
+
+	for (i = 0; i < p->njobs; i++) {
+		p->jobs[i].frame = malloc(frame_size);
+		if (p->jobs[i].frame == NULL)
+			goto err;
+		if (depth) {
+			p->jobs[i].yuv = malloc(yuv_frame_size(decoder, depth));
+			if (p->jobs[i].yuv == NULL)
+				goto err;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&p->threads[i], NULL, worker_thread, p))
+			break;
+		p->nthreads++;
+	}
+	if (p->nthreads == 0)
+		goto err;
+
+	return 0;
+
+err:
+	pipeline_fini(p);
+	return -1;
+}
+
+/* Replaying at the given rate shows the first frame at or after each
+ * tick, see the main loop. */
+static int
+write_single_frame(struct wcap_decoder *decoder, int output_frame,
+		   uint32_t frame_time)
+{
+	char filename[200];
+	uint32_t msecs, i;
+
+	msecs = decoder->index[0].msecs + output_frame * frame_time;
+	for (i = 0; i < decoder->nframes; i++)
+		if (output_frame == 0 || decoder->index[i].msecs >= msecs)
+			break;
+
+	if (wcap_decoder_seek(decoder, i) < 0)
+		return -1;
+
+	snprintf(filename, sizeof filename, "wcap-frame-%d.png", output_frame);
+	write_png(decoder, decoder->frame, filename);
+	fprintf(stderr, "wrote %s\n", filename);
+
+	return 0;
 }
 
 static void
@@ -198,14 +408,16 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--rate=<num:denom>] [--threads=<n>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--threads=<n>\t\tconvert frames on n threads, defaults to\n"
+		"\t\t\t\tthe number of CPUs\n\n");
 
 	exit(exit_code);
 }
@@ -213,11 +425,14 @@ usage(int exit_code)
 int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
-	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
+	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame, ret;
 	int num = 30, denom = 1;
-	char filename[200];
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 	char *mode;
 	uint32_t msecs, frame_time;
+	struct pipeline pipeline;
+	struct timespec start, end;
+	double seconds;
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -234,6 +449,8 @@ int main(int argc, char *argv[])
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
 			;
+		} else if (sscanf(argv[i], "--threads=%d", &nthreads) == 1) {
+			;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
 		} else if (argv[i][0] == '-') {
@@ -252,6 +469,8 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
+	if (nthreads < 1)
+		nthreads = 1;
 
 	decoder = wcap_decoder_create(argv[1]);
 	if (decoder == NULL) {
@@ -279,27 +498,56 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
+	/* Version 2 files can be decoded from the closest key frame. */
+	if (output_frame >= 0 && !all && !yuv4mpeg2 &&
+	    decoder->index && decoder->nframes > 0) {
+		ret = write_single_frame(decoder, output_frame,
+					 1000 * denom / num);
+		if (ret < 0)
+			fprintf(stderr, "failed to decode frame %d\n",
+				output_frame);
+		fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
+			decoder->width, decoder->height, decoder->nframes);
+		wcap_decoder_destroy(decoder);
+
+		return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (pipeline_init(&pipeline, decoder, yuv4mpeg2, nthreads) < 0) {
+		fprintf(stderr, "failed to start conversion threads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	i = 0;
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
 	frame_time = 1000 * denom / num;
 	while (has_frame) {
-		if (all || i == output_frame) {
-			snprintf(filename, sizeof filename,
-				 "wcap-frame-%d.png", i);
-			write_png(decoder, filename);
-			fprintf(stderr, "wrote %s\n", filename);
-		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
+		if (all || i == output_frame || yuv4mpeg2)
+			pipeline_submit(&pipeline,
+					all || i == output_frame ? i : -1);
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
 			has_frame = wcap_decoder_get_frame(decoder);
 	}
 
+	pipeline_flush(&pipeline, 0);
+	pipeline_fini(&pipeline);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = end.tv_sec - start.tv_sec +
+		  (end.tv_nsec - start.tv_nsec) / 1e9;
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
+	fprintf(stderr, "decoded %u frames, wrote %u in %.2f s "
+		"(%.1f frames/s) on %d threads\n",
+		decoder->count, pipeline.written, seconds,
+		seconds > 0 ? pipeline.written / seconds : 0.0,
+		pipeline.nthreads);
 
 	wcap_decoder_destroy(decoder);
 
@@ -36,23 +36,24 @@
 #include <string.h>
 #include <fcntl.h>
 
-#include <cairo.h>
-
 #include "wcap-decode.h"
+#include "wcap-rle.h"
 
+/* Decodes the runs of a rectangle starting at decoder->p, reading no
+ * further than end. */
 static void
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      struct wcap_rectangle *rect,
+			      const uint32_t *end)
 {
 	uint32_t v, *p = decoder->p, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
+	int x, i, j, k, l, n, count = width * height;
 
 	d = decoder->frame + (rect->y2 - 1) * decoder->width;
 	x = rect->x1;
 	i = 0;
-	while (i < count) {
+	while (i < count && p < end) {
 		v = *p++;
 		l = v >> 24;
 		if (l < 0xe0) {
@@ -61,15 +62,22 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 			j = 1 << (l - 0xe0 + 7);
 		}
 
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
+		/* Runs wrap around to the row above at the rectangle edge. */
+		for (k = 0; k < j && i + k < count; k += n) {
+			n = rect->x2 - x;
+			if (n > j - k)
+				n = j - k;
+
+			/* Short runs are not worth a kernel call. */
+			if (n < 8) {
+				for (l = 0; l < n; l++)
+					d[x + l] = wcap_rle_apply_pixel(d[x + l],
+									v);
+			} else {
+				decoder->rle->apply_delta(d + x, v, n);
+			}
+
+			x += n;
 			if (x == rect->x2) {
 				x = rect->x1;
 				d -= decoder->width;
@@ -78,15 +86,33 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 		i += j;
 	}
 
-	if (i != count)
+	if (i < count)
+		printf("rle encoding shorter than expected (%d expected %d)\n",
+		       i, count);
+	else if (i != count)
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
 	decoder->p = p;
 }
 
-int
-wcap_decoder_get_frame(struct wcap_decoder *decoder)
+static void
+wcap_decoder_copy_rectangle(struct wcap_decoder *decoder,
+			    struct wcap_rectangle_v2 *rect, uint32_t *p)
+{
+	int width = rect->x2 - rect->x1, y, x;
+	uint32_t *d;
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		d = decoder->frame + y * decoder->width + rect->x1;
+		for (x = 0; x < width; x++)
+			d[x] = 0xff000000 | p[x];
+		p += width;
+	}
+}
+
+static int
+wcap_decoder_get_frame_v1(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
@@ -102,20 +128,255 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	rects = (void *) (header + 1);
 	decoder->p = (uint32_t *) (rects + header->nrects);
 	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+		wcap_decoder_decode_rectangle(decoder, &rects[i],
+					      decoder->end);
+
+	return 1;
+}
+
+static int
+wcap_rectangle_is_valid(struct wcap_decoder *decoder,
+			struct wcap_rectangle_v2 *rect, void *end)
+{
+	size_t area;
+
+	if (rect->x1 < 0 || rect->y1 < 0 ||
+	    rect->x2 > decoder->width || rect->y2 > decoder->height ||
+	    rect->x1 >= rect->x2 || rect->y1 >= rect->y2)
+		return 0;
+
+	area = (size_t) (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+	if ((rect->flags & WCAP_RECTANGLE_RAW) && rect->size != area * 4)
+		return 0;
+
+	if (rect->size % 4)
+		return 0;
+
+	return (void *) (rect + 1) + rect->size <= end;
+}
+
+static int
+wcap_decoder_get_frame_v2(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header;
+	struct wcap_rectangle_v2 *rect;
+	void *end;
+	uint32_t i;
+
+	if (decoder->p + sizeof *header > decoder->end)
+		return 0;
+
+	header = decoder->p;
+	end = (void *) (header + 1) + header->size;
+	if ((header->flags & WCAP_FRAME_INDEX) || end > decoder->end)
+		return 0;
+
+	/* Key frames are encoded against a black frame. */
+	if (header->flags & WCAP_FRAME_KEYFRAME)
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+
+	decoder->msecs = header->msecs;
+	decoder->count++;
+
+	decoder->p = header + 1;
+	for (i = 0; i < header->nrects; i++) {
+		rect = decoder->p;
+		if (decoder->p + sizeof *rect > end ||
+		    !wcap_rectangle_is_valid(decoder, rect, end))
+			break;
+
+		if (rect->flags & WCAP_RECTANGLE_RAW) {
+			wcap_decoder_copy_rectangle(decoder, rect,
+						    (uint32_t *) (rect + 1));
+		} else {
+			decoder->p = rect + 1;
+			wcap_decoder_decode_rectangle(decoder,
+						      (struct wcap_rectangle *) rect,
+						      (void *) (rect + 1) +
+						      rect->size);
+		}
+		decoder->p = (void *) (rect + 1) + rect->size;
+	}
+
+	decoder->p = end;
+
+	return 1;
+}
+
+int
+wcap_decoder_get_frame(struct wcap_decoder *decoder)
+{
+	if (decoder->version >= 2)
+		return wcap_decoder_get_frame_v2(decoder);
+	else
+		return wcap_decoder_get_frame_v1(decoder);
+}
+
+/** Decode the given frame
+ *
+ * \param decoder The decoder.
+ * \param frame The number of the frame, starting from 0.
+ * \return 0 on success, -1 if there is no such frame.
+ *
+ * Decoding restarts from the closest key frame before the given frame,
+ * unless the current frame is already between the two.  Version 1 files
+ * only have a key frame at the start.  The next call to
+ * wcap_decoder_get_frame() returns the frame after the given one.
+ */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame)
+{
+	uint32_t key = 0;
+
+	if (decoder->index) {
+		if (frame >= decoder->nframes)
+			return -1;
+
+		for (key = frame; key > 0; key--)
+			if (decoder->index[key].flags & WCAP_FRAME_KEYFRAME)
+				break;
+	}
+
+	if (decoder->count == 0 ||
+	    decoder->count - 1 < key || decoder->count - 1 > frame) {
+		if (decoder->index)
+			decoder->p = decoder->map + decoder->index[key].offset;
+		else
+			decoder->p = decoder->frames;
+		decoder->count = key;
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+	}
+
+	while (decoder->count < frame + 1)
+		if (!wcap_decoder_get_frame(decoder))
+			return -1;
+
+	return 0;
+}
+
+/* Without a valid index, as in files cut short, the frames are scanned
+ * up to the last complete one. */
+static int
+wcap_decoder_build_index(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header;
+	struct wcap_index_entry *index;
+	void *p = decoder->frames;
+	uint32_t size = 0;
+
+	decoder->nframes = 0;
+	while (p + sizeof *header <= decoder->end) {
+		header = p;
+		if ((header->flags & WCAP_FRAME_INDEX) ||
+		    (void *) (header + 1) + header->size > decoder->end)
+			break;
+
+		if (decoder->nframes == size) {
+			size = size ? size * 2 : 256;
+			index = realloc(decoder->index, size * sizeof *index);
+			if (index == NULL)
+				return -1;
+			decoder->index = index;
+		}
+
+		index = &decoder->index[decoder->nframes++];
+		index->offset = p - decoder->map;
+		index->msecs = header->msecs;
+		index->flags = header->flags;
+
+		p = (void *) (header + 1) + header->size;
+	}
+
+	decoder->end = p;
+
+	return 0;
+}
+
+/* Every entry has to point at a complete frame between the first frame
+ * and the index, in file order. */
+static int
+wcap_decoder_index_is_valid(struct wcap_decoder *decoder,
+			    uint64_t index_offset)
+{
+	struct wcap_frame_header_v2 header;
+	uint64_t offset = decoder->frames - decoder->map;
+	uint32_t i;
+
+	for (i = 0; i < decoder->nframes; i++) {
+		if (decoder->index[i].offset < offset ||
+		    decoder->index[i].offset + sizeof header > index_offset)
+			return 0;
+
+		offset = decoder->index[i].offset;
+		memcpy(&header, decoder->map + offset, sizeof header);
+		if ((header.flags & WCAP_FRAME_INDEX) ||
+		    header.size > index_offset - offset - sizeof header)
+			return 0;
+
+		offset += sizeof header + header.size;
+	}
 
 	return 1;
 }
 
+static int
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer trailer;
+	struct wcap_frame_header_v2 header;
+	size_t size;
+	void *p;
+
+	if ((size_t) (decoder->end - decoder->frames) <
+	    sizeof header + sizeof trailer)
+		return -1;
+
+	memcpy(&trailer, decoder->end - sizeof trailer, sizeof trailer);
+	if (trailer.magic != WCAP_INDEX_MAGIC)
+		return -1;
+
+	size = (size_t) trailer.count * sizeof *decoder->index;
+	if (trailer.index_offset < (uint64_t) (decoder->frames - decoder->map) ||
+	    trailer.index_offset + sizeof header + size + sizeof trailer !=
+	    decoder->size)
+		return -1;
+
+	p = decoder->map + trailer.index_offset;
+	memcpy(&header, p, sizeof header);
+	if (!(header.flags & WCAP_FRAME_INDEX) || header.size != size)
+		return -1;
+
+	decoder->index = malloc(size ? size : 1);
+	if (decoder->index == NULL)
+		return -1;
+
+	memcpy(decoder->index, p + sizeof header, size);
+	decoder->nframes = trailer.count;
+
+	if (!wcap_decoder_index_is_valid(decoder, trailer.index_offset)) {
+		free(decoder->index);
+		decoder->index = NULL;
+		decoder->nframes = 0;
+		return -1;
+	}
+
+	decoder->end = p;
+
+	return 0;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
+	struct wcap_header_v2 *header_v2;
 	int frame_size;
 	struct stat buf;
 
-	decoder = malloc(sizeof *decoder);
+	decoder = calloc(1, sizeof *decoder);
 	if (decoder == NULL)
 		return NULL;
 
@@ -127,12 +388,16 @@ wcap_decoder_create(const char *filename)
 
 	fstat(decoder->fd, &buf);
 	decoder->size = buf.st_size;
+	if (decoder->size < sizeof *header) {
+		fprintf(stderr, "file too short\n");
+		goto err_fd;
+	}
+
 	decoder->map = mmap(NULL, decoder->size,
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
 	if (decoder->map == MAP_FAILED) {
 		fprintf(stderr, "mmap failed\n");
-		free(decoder);
-		return NULL;
+		goto err_fd;
 	}
 
 	header = decoder->map;
@@ -140,18 +405,45 @@ wcap_decoder_create(const char *filename)
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
+	decoder->version = 1;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
 
+	if (header->magic == WCAP_HEADER_MAGIC_V2) {
+		header_v2 = decoder->map;
+		if (decoder->size < sizeof *header_v2 ||
+		    header_v2->version != WCAP_VERSION) {
+			fprintf(stderr, "unsupported wcap version\n");
+			goto err_map;
+		}
+		decoder->version = header_v2->version;
+		decoder->p = header_v2 + 1;
+	}
+	decoder->frames = decoder->p;
+	decoder->rle = wcap_rle_kernels_best();
+
+	if (decoder->version >= 2 &&
+	    wcap_decoder_read_index(decoder) < 0 &&
+	    wcap_decoder_build_index(decoder) < 0) {
+		fprintf(stderr, "out of memory\n");
+		goto err_map;
+	}
+
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
-	if (decoder->frame == NULL) {
-		free(decoder);
-		return NULL;
-	}
+	if (decoder->frame == NULL)
+		goto err_map;
 	memset(decoder->frame, 0, frame_size);
 
 	return decoder;
+
+err_map:
+	free(decoder->index);
+	munmap(decoder->map, decoder->size);
+err_fd:
+	close(decoder->fd);
+	free(decoder);
+	return NULL;
 }
 
 void
@@ -159,6 +451,7 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->index);
 	free(decoder->frame);
 	free(decoder);
 }
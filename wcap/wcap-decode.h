@@ -28,7 +28,11 @@
 
 #include <stdint.h>
 
+struct wcap_rle_kernels;
+
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57434958
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -50,6 +54,47 @@ struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+/* Version 2 of the format, see wcap/README */
+#define WCAP_VERSION		2
+
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+#define WCAP_FRAME_INDEX	(1 << 1)
+
+#define WCAP_RECTANGLE_RAW	(1 << 0)
+
+struct wcap_header_v2 {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t width, height;
+	uint32_t version;
+	uint32_t flags;
+};
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+};
+
+struct wcap_rectangle_v2 {
+	int32_t x1, y1, x2, y2;
+	uint32_t flags;
+	uint32_t size;
+};
+
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+struct wcap_index_trailer {
+	uint64_t index_offset;
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -59,9 +104,18 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	uint32_t version;
+	void *frames;
+	/* Every frame of a version 2 file, NULL for version 1 */
+	struct wcap_index_entry *index;
+	uint32_t nframes;
+
+	const struct wcap_rle_kernels *rle;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -0,0 +1,397 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A pixel difference is the component-wise difference of the R, G and
+ * B bytes, modulo 256, with the X byte cleared.  That is a byte-wise
+ * subtraction, so the SIMD kernels compute the differences of 4 or 8
+ * pixels at once and only fall back to the scalar run tracking when a
+ * run ends among them.
+ *
+ * SSE2 and NEON are used when the compiler targets them.  AVX2 is
+ * picked at runtime on x86 CPUs that have it.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "wcap-rle.h"
+
+#define DELTA_MASK 0x00ffffff
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static inline void
+encode_pixel(struct wcap_rle_encoder *e, uint32_t delta)
+{
+	if (e->run == 0 || delta == e->prev) {
+		e->run++;
+	} else {
+		e->p = output_run(e->p, e->prev, e->run);
+		e->run = 1;
+	}
+	e->prev = delta;
+}
+
+void
+wcap_rle_encoder_init(struct wcap_rle_encoder *encoder, uint32_t *p)
+{
+	encoder->p = p;
+	encoder->prev = 0;
+	encoder->run = 0;
+}
+
+/** Ends the last run
+ *
+ * \param encoder The encoder.
+ * \return The end of the encoded data.
+ */
+uint32_t *
+wcap_rle_encoder_finish(struct wcap_rle_encoder *encoder)
+{
+	encoder->p = output_run(encoder->p, encoder->prev, encoder->run);
+	encoder->run = 0;
+
+	return encoder->p;
+}
+
+static void
+encode_row_c(struct wcap_rle_encoder *encoder,
+	     const uint32_t *src, uint32_t *ref, int width)
+{
+	struct wcap_rle_encoder e = *encoder;
+	int k;
+
+	for (k = 0; k < width; k++) {
+		encode_pixel(&e, component_delta(src[k], ref[k]));
+		ref[k] = src[k];
+	}
+
+	*encoder = e;
+}
+
+static void
+apply_delta_c(uint32_t *dst, uint32_t delta, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = wcap_rle_apply_pixel(dst[i], delta);
+}
+
+static const struct wcap_rle_kernels kernels_c = {
+	"c", encode_row_c, apply_delta_c
+};
+
+#ifdef __SSE2__
+
+static void
+encode_row_sse2(struct wcap_rle_encoder *encoder,
+		const uint32_t *src, uint32_t *ref, int width)
+{
+	const __m128i mask = _mm_set1_epi32(DELTA_MASK);
+	struct wcap_rle_encoder e = *encoder;
+	uint32_t deltas[4];
+	__m128i s, d, delta;
+	int i, k;
+
+	for (k = 0; k + 4 <= width; k += 4) {
+		s = _mm_loadu_si128((const __m128i *) (src + k));
+		d = _mm_loadu_si128((const __m128i *) (ref + k));
+		delta = _mm_and_si128(_mm_sub_epi8(s, d), mask);
+		_mm_storeu_si128((__m128i *) (ref + k), s);
+
+		/* All four pixels continue the current run */
+		if (e.run > 0 &&
+		    _mm_movemask_epi8(_mm_cmpeq_epi32(delta,
+				_mm_set1_epi32(e.prev))) == 0xffff) {
+			e.run += 4;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *) deltas, delta);
+		for (i = 0; i < 4; i++)
+			encode_pixel(&e, deltas[i]);
+	}
+
+	for (; k < width; k++) {
+		encode_pixel(&e, component_delta(src[k], ref[k]));
+		ref[k] = src[k];
+	}
+
+	*encoder = e;
+}
+
+static void
+apply_delta_sse2(uint32_t *dst, uint32_t delta, int n)
+{
+	const __m128i alpha = _mm_set1_epi32(0xff000000);
+	const __m128i d = _mm_set1_epi32(delta & DELTA_MASK);
+	__m128i v;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *) (dst + i));
+		v = _mm_or_si128(_mm_add_epi8(v, d), alpha);
+		_mm_storeu_si128((__m128i *) (dst + i), v);
+	}
+
+	for (; i < n; i++)
+		dst[i] = wcap_rle_apply_pixel(dst[i], delta);
+}
+
+static const struct wcap_rle_kernels kernels_sse2 = {
+	"sse2", encode_row_sse2, apply_delta_sse2
+};
+
+#endif
+
+#ifdef HAVE_AVX2_KERNELS
+
+__attribute__((target("avx2"))) static void
+encode_row_avx2(struct wcap_rle_encoder *encoder,
+		const uint32_t *src, uint32_t *ref, int width)
+{
+	const __m256i mask = _mm256_set1_epi32(DELTA_MASK);
+	struct wcap_rle_encoder e = *encoder;
+	uint32_t deltas[8];
+	__m256i s, d, delta;
+	int i, k;
+
+	for (k = 0; k + 8 <= width; k += 8) {
+		s = _mm256_loadu_si256((const __m256i *) (src + k));
+		d = _mm256_loadu_si256((const __m256i *) (ref + k));
+		delta = _mm256_and_si256(_mm256_sub_epi8(s, d), mask);
+		_mm256_storeu_si256((__m256i *) (ref + k), s);
+
+		/* All eight pixels continue the current run */
+		if (e.run > 0 &&
+		    _mm256_movemask_epi8(_mm256_cmpeq_epi32(delta,
+				_mm256_set1_epi32(e.prev))) == -1) {
+			e.run += 8;
+			continue;
+		}
+
+		_mm256_storeu_si256((__m256i *) deltas, delta);
+		for (i = 0; i < 8; i++)
+			encode_pixel(&e, deltas[i]);
+	}
+
+	for (; k < width; k++) {
+		encode_pixel(&e, component_delta(src[k], ref[k]));
+		ref[k] = src[k];
+	}
+
+	*encoder = e;
+}
+
+__attribute__((target("avx2"))) static void
+apply_delta_avx2(uint32_t *dst, uint32_t delta, int n)
+{
+	const __m256i alpha = _mm256_set1_epi32(0xff000000);
+	const __m256i d = _mm256_set1_epi32(delta & DELTA_MASK);
+	__m256i v;
+	__m128i v4;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *) (dst + i));
+		v = _mm256_or_si256(_mm256_add_epi8(v, d), alpha);
+		_mm256_storeu_si256((__m256i *) (dst + i), v);
+	}
+
+	/* Runs are often a bit over 8 pixels. */
+	if (i + 4 <= n) {
+		v4 = _mm_loadu_si128((const __m128i *) (dst + i));
+		v4 = _mm_or_si128(_mm_add_epi8(v4, _mm256_castsi256_si128(d)),
+				  _mm256_castsi256_si128(alpha));
+		_mm_storeu_si128((__m128i *) (dst + i), v4);
+		i += 4;
+	}
+
+	for (; i < n; i++)
+		dst[i] = wcap_rle_apply_pixel(dst[i], delta);
+}
+
+static const struct wcap_rle_kernels kernels_avx2 = {
+	"avx2", encode_row_avx2, apply_delta_avx2
+};
+
+#endif
+
+#ifdef __ARM_NEON
+
+static void
+encode_row_neon(struct wcap_rle_encoder *encoder,
+		const uint32_t *src, uint32_t *ref, int width)
+{
+	const uint32x4_t mask = vdupq_n_u32(DELTA_MASK);
+	struct wcap_rle_encoder e = *encoder;
+	uint32_t deltas[4];
+	uint32x4_t s, d, delta, eq;
+	uint32x2_t all;
+	int i, k;
+
+	for (k = 0; k + 4 <= width; k += 4) {
+		s = vld1q_u32(src + k);
+		d = vld1q_u32(ref + k);
+		delta = vandq_u32(vreinterpretq_u32_u8(
+				vsubq_u8(vreinterpretq_u8_u32(s),
+					 vreinterpretq_u8_u32(d))), mask);
+		vst1q_u32(ref + k, s);
+
+		/* All four pixels continue the current run */
+		if (e.run > 0) {
+			eq = vceqq_u32(delta, vdupq_n_u32(e.prev));
+			all = vand_u32(vget_low_u32(eq), vget_high_u32(eq));
+			if (vget_lane_u32(all, 0) & vget_lane_u32(all, 1)) {
+				e.run += 4;
+				continue;
+			}
+		}
+
+		vst1q_u32(deltas, delta);
+		for (i = 0; i < 4; i++)
+			encode_pixel(&e, deltas[i]);
+	}
+
+	for (; k < width; k++) {
+		encode_pixel(&e, component_delta(src[k], ref[k]));
+		ref[k] = src[k];
+	}
+
+	*encoder = e;
+}
+
+static void
+apply_delta_neon(uint32_t *dst, uint32_t delta, int n)
+{
+	const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+	const uint8x16_t d = vreinterpretq_u8_u32(
+				vdupq_n_u32(delta & DELTA_MASK));
+	uint32x4_t v;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = vld1q_u32(dst + i);
+		v = vreinterpretq_u32_u8(vaddq_u8(vreinterpretq_u8_u32(v), d));
+		vst1q_u32(dst + i, vorrq_u32(v, alpha));
+	}
+
+	for (; i < n; i++)
+		dst[i] = wcap_rle_apply_pixel(dst[i], delta);
+}
+
+static const struct wcap_rle_kernels kernels_neon = {
+	"neon", encode_row_neon, apply_delta_neon
+};
+
+#endif
+
+/** Get the kernels this CPU can run
+ *
+ * \param index Starts at 0, for the plain C kernels.
+ * \return The kernels, ordered from slowest to fastest, or NULL past the
+ * last one.
+ */
+const struct wcap_rle_kernels *
+wcap_rle_kernels_get(int index)
+{
+	const struct wcap_rle_kernels *list[4];
+	int n = 0;
+
+	list[n++] = &kernels_c;
+#ifdef __SSE2__
+	list[n++] = &kernels_sse2;
+#endif
+#ifdef HAVE_AVX2_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		list[n++] = &kernels_avx2;
+#endif
+#ifdef __ARM_NEON
+	list[n++] = &kernels_neon;
+#endif
+
+	if (index < 0 || index >= n)
+		return NULL;
+
+	return list[index];
+}
+
+const struct wcap_rle_kernels *
+wcap_rle_kernels_best(void)
+{
+	const struct wcap_rle_kernels *kernels, *best = NULL;
+	int i;
+
+	for (i = 0; (kernels = wcap_rle_kernels_get(i)); i++)
+		best = kernels;
+
+	return best;
+}
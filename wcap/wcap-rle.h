@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2017 Weston contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_RLE_
+#define _WCAP_RLE_
+
+#include <stdint.h>
+
+/* The run-length encoder state, carried over from one row of a
+ * rectangle to the next. */
+struct wcap_rle_encoder {
+	uint32_t *p;
+	uint32_t prev;
+	int run;
+};
+
+/* The per-pixel loops of the wcap encoder and decoder.  All of them
+ * produce exactly the same results, the SIMD ones just handle several
+ * pixels at a time. */
+struct wcap_rle_kernels {
+	const char *name;
+
+	/* Appends the differences between src and ref to the runs and
+	 * copies src into ref. */
+	void (*encode_row)(struct wcap_rle_encoder *encoder,
+			   const uint32_t *src, uint32_t *ref, int width);
+
+	/* Adds the RGB components of delta to n pixels. */
+	void (*apply_delta)(uint32_t *dst, uint32_t delta, int n);
+};
+
+void
+wcap_rle_encoder_init(struct wcap_rle_encoder *encoder, uint32_t *p);
+
+uint32_t *
+wcap_rle_encoder_finish(struct wcap_rle_encoder *encoder);
+
+const struct wcap_rle_kernels *
+wcap_rle_kernels_get(int index);
+
+const struct wcap_rle_kernels *
+wcap_rle_kernels_best(void);
+
+static inline uint32_t
+wcap_rle_apply_pixel(uint32_t pixel, uint32_t delta)
+{
+	unsigned char r, g, b;
+
+	r = (pixel >> 16) + (delta >> 16);
+	g = (pixel >>  8) + (delta >>  8);
+	b = (pixel >>  0) + (delta >>  0);
+
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+#endif